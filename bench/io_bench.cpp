@@ -0,0 +1,180 @@
+#include "join_server/epoll_reactor.hpp"
+#include "join_server/io_stats.hpp"
+#include "join_server/scheduler.hpp"
+#include "join_server/session.hpp"
+#include "join_server/tables.hpp"
+#include "join_server/uring_reactor.hpp"
+#include "join_server/worker_pool.hpp"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace
+{
+
+using Clock = std::chrono::steady_clock;
+
+// Commands each client sends before reading the replies.
+constexpr int kPipeline = 32;
+
+struct Result
+{
+  double seconds{0};
+  std::uint64_t syscalls{0};
+};
+
+int listen_on_loopback(uint16_t &port)
+{
+  const int fd = ::socket(AF_INET, SOCK_STREAM, 0);
+  sockaddr_in addr{};
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  socklen_t length = sizeof(addr);
+  if (fd < 0 || ::bind(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) < 0 || ::listen(fd, SOMAXCONN) < 0 ||
+      ::getsockname(fd, reinterpret_cast<sockaddr *>(&addr), &length) < 0)
+    throw std::runtime_error("cannot listen on loopback");
+  port = ntohs(addr.sin_port);
+  return fd;
+}
+
+int connect_to(uint16_t port)
+{
+  const int fd = ::socket(AF_INET, SOCK_STREAM, 0);
+  sockaddr_in addr{};
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  addr.sin_port = htons(port);
+  if (fd < 0 || ::connect(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) < 0)
+    throw std::runtime_error("cannot connect");
+  return fd;
+}
+
+// One client: pipelined INSERTs with ids of its own, waiting for every batch
+// of replies before sending the next batch.
+void client(uint16_t port, int index, int commands)
+{
+  const int fd = connect_to(port);
+  std::string batch;
+  char chunk[4096];
+  for (int sent = 0; sent < commands; sent += kPipeline)
+  {
+    batch.clear();
+    const int count = std::min(kPipeline, commands - sent);
+    for (int i = 0; i < count; ++i)
+      batch += "INSERT A " + std::to_string(index * commands + sent + i) + " name\n";
+    ::send(fd, batch.data(), batch.size(), MSG_NOSIGNAL);
+
+    int replies = 0;
+    while (replies < count)
+    {
+      const ssize_t received = ::recv(fd, chunk, sizeof(chunk), 0);
+      if (received <= 0)
+        throw std::runtime_error("server went away");
+      replies += static_cast<int>(std::count(chunk, chunk + received, '\n'));
+    }
+  }
+  ::close(fd);
+}
+
+Result run_clients(uint16_t port, int clients, int commands)
+{
+  const auto syscalls = join_server::io_syscalls();
+  const auto start = Clock::now();
+  std::vector<std::thread> threads;
+  for (int i = 0; i < clients; ++i)
+    threads.emplace_back(client, port, i, commands);
+  for (auto &thread : threads)
+    thread.join();
+  Result result;
+  result.seconds = std::chrono::duration<double>(Clock::now() - start).count();
+  result.syscalls = join_server::io_syscalls() - syscalls;
+  return result;
+}
+
+// A thread per connection with blocking reads and writes.
+Result threads_backend(int clients, int commands)
+{
+  uint16_t port = 0;
+  const int listener = listen_on_loopback(port);
+  join_server::TablesStore store;
+  std::thread acceptor(
+      [listener, clients, &store]
+      {
+        std::vector<std::thread> sessions;
+        for (int i = 0; i < clients; ++i)
+        {
+          join_server::count_io_syscall();
+          const int fd = ::accept(listener, nullptr, nullptr);
+          if (fd >= 0)
+            sessions.emplace_back(join_server::serve_blocking, fd, std::ref(store));
+        }
+        for (auto &session : sessions)
+          session.join();
+      });
+  const auto result = run_clients(port, clients, commands);
+  acceptor.join();
+  ::close(listener);
+  return result;
+}
+
+template <typename Reactor>
+Result reactor_backend(int clients, int commands)
+{
+  uint16_t port = 0;
+  const int listener = listen_on_loopback(port);
+  join_server::TablesStore store;
+  join_server::WorkerPool workers(0);
+  join_server::CommandScheduler scheduler(workers);
+  Result result;
+  {
+    Reactor reactor(listener, store, scheduler);
+    std::thread loop([&reactor] { reactor.run(); });
+    result = run_clients(port, clients, commands);
+    reactor.stop();
+    loop.join();
+  }
+  ::close(listener);
+  return result;
+}
+
+void report(const char *name, const Result &result, std::size_t commands)
+{
+  std::cout << std::left << std::setw(12) << name << std::right << std::fixed << std::setprecision(0)
+            << std::setw(16) << static_cast<double>(commands) / result.seconds << std::setprecision(3)
+            << std::setw(18) << static_cast<double>(result.syscalls) / static_cast<double>(commands) << '\n';
+}
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+  const int clients = argc > 1 ? std::atoi(argv[1]) : 8;
+  const int commands = argc > 2 ? std::atoi(argv[2]) : 50000;
+  const auto total = static_cast<std::size_t>(clients) * static_cast<std::size_t>(commands);
+
+  std::cout << clients << " clients x " << commands << " INSERTs, " << kPipeline << " per batch\n";
+  std::cout << "backend           commands/s  syscalls/command\n";
+  report("threads", threads_backend(clients, commands), total);
+  report("epoll", reactor_backend<join_server::EpollReactor>(clients, commands), total);
+  try
+  {
+    report("uring", reactor_backend<join_server::UringReactor>(clients, commands), total);
+  }
+  catch (const std::runtime_error &e)
+  {
+    std::cout << "uring unavailable: " << e.what() << '\n';
+  }
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,185 @@
+#include "join_server/id_column.hpp"
+#include "join_server/tables.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace
+{
+
+using Clock = std::chrono::steady_clock;
+
+double elapsed_ms(Clock::time_point since)
+{
+  return std::chrono::duration<double, std::milli>(Clock::now() - since).count();
+}
+
+const char *engine_name(join_server::StorageEngine engine)
+{
+  return engine == join_server::StorageEngine::Flat ? "flat" : "map";
+}
+
+join_server::StoreOptions options_for(join_server::StorageEngine engine, bool views, bool compress_ids)
+{
+  join_server::StoreOptions options;
+  options.engine = engine;
+  options.materialized_views = views;
+  options.compress_ids = compress_ids;
+  return options;
+}
+
+void run(const char *label, const join_server::StoreOptions &options, const std::vector<int> &ids_a,
+         const std::vector<int> &ids_b, int rounds)
+{
+  join_server::TablesStore store(options);
+  std::string error;
+
+  const auto insert_start = Clock::now();
+  for (const int id : ids_a)
+    store.insert(join_server::TableId::A, id, "value" + std::to_string(id % 1000), error);
+  for (const int id : ids_b)
+    store.insert(join_server::TableId::B, id, "value" + std::to_string(id % 1000), error);
+  const double insert_ms = elapsed_ms(insert_start);
+
+  std::size_t checksum = 0;
+  const auto intersection_start = Clock::now();
+  for (int i = 0; i < rounds; ++i)
+    checksum += store.intersection().size();
+  const double intersection_ms = elapsed_ms(intersection_start) / rounds;
+
+  const auto difference_start = Clock::now();
+  for (int i = 0; i < rounds; ++i)
+    checksum += store.symmetric_difference().size();
+  const double difference_ms = elapsed_ms(difference_start) / rounds;
+
+  std::cout << std::left << std::setw(11) << label << std::right << std::fixed << std::setprecision(1)
+            << std::setw(12) << insert_ms << std::setw(16) << intersection_ms
+            << std::setw(16) << difference_ms << "   (" << checksum << ")\n";
+}
+
+// Join time of the flat engine for a growing number of join threads.
+void run_scaling(const std::vector<int> &ids_a, const std::vector<int> &ids_b, int rounds)
+{
+  const unsigned max_threads = std::max(4U, std::thread::hardware_concurrency());
+  double base_ms = 0.0;
+  for (unsigned threads = 1; threads <= max_threads; threads *= 2)
+  {
+    join_server::StoreOptions options;
+    options.join_threads = threads;
+    join_server::TablesStore store(options);
+    std::string error;
+    for (const int id : ids_a)
+      store.insert(join_server::TableId::A, id, "value", error);
+    for (const int id : ids_b)
+      store.insert(join_server::TableId::B, id, "value", error);
+    store.symmetric_difference(); // fold pending rows before timing
+
+    const auto start = Clock::now();
+    std::size_t checksum = 0;
+    for (int i = 0; i < rounds; ++i)
+      checksum += store.intersection().size() + store.symmetric_difference().size();
+    const double ms = elapsed_ms(start) / rounds;
+    if (threads == 1)
+      base_ms = ms;
+
+    std::cout << std::setw(7) << threads << std::fixed << std::setprecision(1) << std::setw(12) << ms
+              << std::setprecision(2) << std::setw(10) << base_ms / ms << "x   (" << checksum << ")\n";
+  }
+}
+
+// Insert latency percentiles while another thread keeps running joins.
+void run_latency(join_server::StorageEngine engine, const std::vector<int> &ids_a, const std::vector<int> &ids_b)
+{
+  join_server::TablesStore store(engine);
+  std::string error;
+  for (const int id : ids_b)
+    store.insert(join_server::TableId::B, id, "value", error);
+
+  std::atomic<bool> done{false};
+  std::size_t joins = 0;
+  std::thread reader([&store, &done, &joins]
+                     {
+                       while (!done)
+                       {
+                         store.intersection();
+                         ++joins;
+                       } });
+
+  std::vector<double> latencies;
+  latencies.reserve(ids_a.size());
+  for (const int id : ids_a)
+  {
+    const auto start = Clock::now();
+    store.insert(join_server::TableId::A, id, "value", error);
+    latencies.push_back(std::chrono::duration<double, std::micro>(Clock::now() - start).count());
+  }
+  done = true;
+  reader.join();
+
+  std::sort(latencies.begin(), latencies.end());
+  const auto percentile = [&latencies](double p)
+  { return latencies[static_cast<std::size_t>(p * static_cast<double>(latencies.size() - 1))]; };
+
+  std::cout << std::left << std::setw(6) << engine_name(engine) << std::right << std::fixed
+            << std::setprecision(1) << std::setw(10) << percentile(0.5) << std::setw(10) << percentile(0.99)
+            << std::setw(12) << latencies.back() << std::setw(10) << joins << '\n';
+}
+
+// Id bytes a join walks over for one table in each column encoding.
+void report_id_bytes(std::vector<int> ids)
+{
+  std::sort(ids.begin(), ids.end());
+  const auto packed = join_server::IdColumn::pack(ids);
+  const auto bitmap = join_server::IdColumn::bitmap(ids);
+  const join_server::IdColumn plain(std::move(ids));
+  std::cout << "plain  " << std::setw(12) << plain.memory_bytes() << '\n';
+  std::cout << "packed " << std::setw(12) << packed.memory_bytes() << '\n';
+  std::cout << "bitmap " << std::setw(12) << bitmap.memory_bytes() << '\n';
+}
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+  const int rows = argc > 1 ? std::atoi(argv[1]) : 1000000;
+  const int rounds = argc > 2 ? std::atoi(argv[2]) : 5;
+
+  std::mt19937 rng(42);
+  std::vector<int> ids_a(static_cast<std::size_t>(rows));
+  std::vector<int> ids_b(static_cast<std::size_t>(rows));
+  for (int i = 0; i < rows; ++i)
+  {
+    ids_a[static_cast<std::size_t>(i)] = i * 2;
+    ids_b[static_cast<std::size_t>(i)] = i * 3;
+  }
+  std::shuffle(ids_a.begin(), ids_a.end(), rng);
+  std::shuffle(ids_b.begin(), ids_b.end(), rng);
+
+  std::cout << rows << " rows per table, " << rounds << " rounds\n";
+  std::cout << "store        insert ms  intersection ms  sym. diff ms\n";
+  run("map", options_for(join_server::StorageEngine::Map, false, false), ids_a, ids_b, rounds);
+  run("flat", options_for(join_server::StorageEngine::Flat, false, false), ids_a, ids_b, rounds);
+  run("flat+views", options_for(join_server::StorageEngine::Flat, true, false), ids_a, ids_b, rounds);
+  run("flat+packed", options_for(join_server::StorageEngine::Flat, false, true), ids_a, ids_b, rounds);
+
+  std::cout << "\nid column bytes scanned per table\n";
+  report_id_bytes(ids_a);
+
+  std::cout << "\nflat join (intersection + sym. diff) by join threads\n";
+  std::cout << "threads     time ms   speedup\n";
+  run_scaling(ids_a, ids_b, rounds);
+
+  std::cout << "\ninsert latency under concurrent INTERSECTION, us\n";
+  std::cout << "engine     p50       p99         max     joins\n";
+  run_latency(join_server::StorageEngine::Map, ids_a, ids_b);
+  run_latency(join_server::StorageEngine::Flat, ids_a, ids_b);
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,69 @@
+#include "join_server/command.hpp"
+#include "join_server/tables.hpp"
+
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace
+{
+
+using Clock = std::chrono::steady_clock;
+
+// Rows in scrambled id order, as "id name" lines.
+std::vector<std::string> make_rows(int rows)
+{
+  std::vector<std::string> lines;
+  lines.reserve(static_cast<std::size_t>(rows));
+  for (int i = 0; i < rows; ++i)
+  {
+    const long long id = (static_cast<long long>(i) * 2654435761LL) % rows;
+    lines.push_back(std::to_string(id) + " name" + std::to_string(i % 1000));
+  }
+  return lines;
+}
+
+double insert_rate(join_server::StorageEngine engine, const std::vector<std::string> &lines)
+{
+  join_server::TablesStore store(engine);
+  join_server::CommandProcessor processor(store);
+  const auto start = Clock::now();
+  for (const auto &line : lines)
+    processor.execute("INSERT A " + line);
+  store.intersection(); // folds pending flat-engine rows
+  return static_cast<double>(lines.size()) / std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+double load_rate(join_server::StorageEngine engine, const std::vector<std::string> &lines)
+{
+  join_server::TablesStore store(engine);
+  join_server::CommandProcessor processor(store);
+  const auto start = Clock::now();
+  processor.execute("LOAD A " + std::to_string(lines.size()));
+  for (const auto &line : lines)
+    processor.execute(line);
+  return static_cast<double>(lines.size()) / std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+  const int rows = argc > 1 ? std::atoi(argv[1]) : 1000000;
+  const auto lines = make_rows(rows);
+
+  std::cout << rows << " rows\n";
+  std::cout << "engine      INSERT rows/s    LOAD rows/s\n";
+  for (const auto engine : {join_server::StorageEngine::Map, join_server::StorageEngine::Flat})
+  {
+    const double insert = insert_rate(engine, lines);
+    const double load = load_rate(engine, lines);
+    std::cout << std::left << std::setw(10) << (engine == join_server::StorageEngine::Map ? "map" : "flat")
+              << std::right << std::fixed << std::setprecision(0) << std::setw(15) << insert << std::setw(15) << load
+              << '\n';
+  }
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,61 @@
+#include "join_server/command.hpp"
+#include "join_server/tables.hpp"
+
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace
+{
+
+using Clock = std::chrono::steady_clock;
+
+double rate(join_server::CommandProcessor &processor, const std::vector<std::string> &lines)
+{
+  const auto start = Clock::now();
+  for (const auto &line : lines)
+    processor.execute(line);
+  const double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+  return static_cast<double>(lines.size()) / seconds;
+}
+
+void report(const char *name, double commands_per_second)
+{
+  std::cout << std::left << std::setw(28) << name << std::right << std::fixed << std::setprecision(0)
+            << std::setw(14) << commands_per_second << '\n';
+}
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+  const int count = argc > 1 ? std::atoi(argv[1]) : 1000000;
+
+  std::vector<std::string> inserts;
+  std::vector<std::string> fetches;
+  std::vector<std::string> truncates;
+  inserts.reserve(static_cast<std::size_t>(count));
+  for (int i = 0; i < count; ++i)
+  {
+    inserts.push_back((i % 2 == 0 ? "INSERT A " : "insert b ") + std::to_string(i) + " name" +
+                      std::to_string(i % 100));
+    // Parsed and rejected without touching the tables.
+    fetches.push_back("FETCH " + std::to_string(i % 1000 + 1));
+    truncates.push_back(i % 2 == 0 ? "TRUNCATE A" : "truncate b");
+  }
+
+  join_server::TablesStore store(join_server::StorageEngine::Flat);
+  join_server::CommandProcessor processor(store);
+  join_server::TablesStore map_store(join_server::StorageEngine::Map);
+  join_server::CommandProcessor map_processor(map_store);
+
+  std::cout << count << " commands per workload\n";
+  std::cout << "workload                      commands/s\n";
+  report("INSERT (flat engine)", rate(processor, inserts));
+  report("FETCH without cursor", rate(processor, fetches));
+  report("TRUNCATE of empty table", rate(map_processor, truncates));
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,169 @@
+#include "join_server/binary_protocol.hpp"
+#include "join_server/command.hpp"
+#include "join_server/tables.hpp"
+
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace
+{
+
+using Clock = std::chrono::steady_clock;
+
+// Commands per simulated read, as a pipelining client would send them.
+constexpr int kPipeline = 64;
+
+struct Result
+{
+  double seconds{0};
+  std::size_t bytes_in{0};
+  std::size_t bytes_out{0};
+};
+
+join_server::ResponseBuffer counting_buffer(std::size_t &bytes)
+{
+  return join_server::ResponseBuffer(
+      [&bytes](std::string_view data)
+      {
+        bytes += data.size();
+        return true;
+      });
+}
+
+Result text_inserts(int count)
+{
+  std::vector<std::string> requests;
+  for (int i = 0; i < count; ++i)
+    requests.push_back((i % 2 == 0 ? "INSERT A " : "INSERT B ") + std::to_string(i) + " name" +
+                       std::to_string(i % 100));
+
+  join_server::TablesStore store;
+  join_server::CommandProcessor processor(store);
+  Result result;
+  auto out = counting_buffer(result.bytes_out);
+  std::vector<std::string_view> lines;
+  const auto start = Clock::now();
+  for (int i = 0; i < count; i += kPipeline)
+  {
+    lines.clear();
+    for (int j = i; j < count && j < i + kPipeline; ++j)
+    {
+      lines.push_back(requests[static_cast<std::size_t>(j)]);
+      result.bytes_in += requests[static_cast<std::size_t>(j)].size() + 1;
+    }
+    processor.execute_batch(lines, out);
+    out.flush();
+  }
+  result.seconds = std::chrono::duration<double>(Clock::now() - start).count();
+  return result;
+}
+
+Result binary_inserts(int count)
+{
+  std::vector<std::string> requests;
+  for (int i = 0; i < count; i += kPipeline)
+  {
+    std::string frames;
+    for (int j = i; j < count && j < i + kPipeline; ++j)
+      join_server::binary::encode_insert(frames, j % 2 == 0 ? join_server::TableId::A : join_server::TableId::B, j,
+                                         "name" + std::to_string(j % 100));
+    requests.push_back(std::move(frames));
+  }
+
+  join_server::TablesStore store;
+  join_server::CommandProcessor text(store);
+  join_server::BinaryProcessor processor(store, text);
+  Result result;
+  auto out = counting_buffer(result.bytes_out);
+  const auto start = Clock::now();
+  for (const auto &frames : requests)
+  {
+    std::size_t consumed = 0;
+    processor.execute(frames, out, consumed);
+    out.flush();
+    result.bytes_in += frames.size();
+  }
+  result.seconds = std::chrono::duration<double>(Clock::now() - start).count();
+  return result;
+}
+
+void fill(join_server::TablesStore &store, int count)
+{
+  std::string error;
+  for (int i = 0; i < count; ++i)
+  {
+    store.insert(join_server::TableId::A, i * 3, "left" + std::to_string(i % 100), error);
+    store.insert(join_server::TableId::B, i * 2, "right" + std::to_string(i % 100), error);
+  }
+}
+
+Result text_join(join_server::TablesStore &store, int repeats)
+{
+  join_server::CommandProcessor processor(store);
+  Result result;
+  auto out = counting_buffer(result.bytes_out);
+  const auto start = Clock::now();
+  for (int i = 0; i < repeats; ++i)
+  {
+    processor.execute("SYMMETRIC_DIFFERENCE", out);
+    out.flush();
+    result.bytes_in += sizeof("SYMMETRIC_DIFFERENCE");
+  }
+  result.seconds = std::chrono::duration<double>(Clock::now() - start).count();
+  return result;
+}
+
+Result binary_join(join_server::TablesStore &store, int repeats)
+{
+  join_server::CommandProcessor text(store);
+  join_server::BinaryProcessor processor(store, text);
+  std::string request;
+  join_server::binary::encode_join(request, join_server::JoinKind::SymmetricDifference);
+  Result result;
+  auto out = counting_buffer(result.bytes_out);
+  const auto start = Clock::now();
+  for (int i = 0; i < repeats; ++i)
+  {
+    std::size_t consumed = 0;
+    processor.execute(request, out, consumed);
+    out.flush();
+    result.bytes_in += request.size();
+  }
+  result.seconds = std::chrono::duration<double>(Clock::now() - start).count();
+  return result;
+}
+
+void report(const char *name, const Result &result, std::size_t operations)
+{
+  std::cout << std::left << std::setw(30) << name << std::right << std::fixed << std::setprecision(0)
+            << std::setw(14) << static_cast<double>(operations) / result.seconds << std::setw(14) << result.bytes_in
+            << std::setw(14) << result.bytes_out << '\n';
+}
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+  const int count = argc > 1 ? std::atoi(argv[1]) : 1000000;
+  const int repeats = 10;
+
+  join_server::TablesStore store(join_server::StorageEngine::Flat);
+  fill(store, count);
+  join_server::TablesStore map_store(join_server::StorageEngine::Map);
+  fill(map_store, count);
+  const auto rows = store.symmetric_difference().size() * static_cast<std::size_t>(repeats);
+
+  std::cout << count << " inserts, " << repeats << " x SYMMETRIC_DIFFERENCE of " << rows / repeats << " rows\n";
+  std::cout << "workload                        operations/s      bytes in     bytes out\n";
+  report("INSERT text", text_inserts(count), static_cast<std::size_t>(count));
+  report("INSERT binary", binary_inserts(count), static_cast<std::size_t>(count));
+  report("join rows text (flat)", text_join(store, repeats), rows);
+  report("join rows binary (flat)", binary_join(store, repeats), rows);
+  report("join rows text (map)", text_join(map_store, repeats), rows);
+  report("join rows binary (map)", binary_join(map_store, repeats), rows);
+  return EXIT_SUCCESS;
+}
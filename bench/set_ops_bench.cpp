@@ -0,0 +1,62 @@
+#include "join_server/set_ops.hpp"
+
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <vector>
+
+namespace
+{
+
+using Clock = std::chrono::steady_clock;
+
+// Sorted keys where roughly `density` of [0, size / density) is present.
+std::vector<int> make_keys(std::mt19937 &rng, std::size_t size, double density)
+{
+  std::bernoulli_distribution keep(density);
+  std::vector<int> keys;
+  keys.reserve(size);
+  for (int key = 0; keys.size() < size; ++key)
+    if (keep(rng))
+      keys.push_back(key);
+  return keys;
+}
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+  const std::size_t size = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 10000000;
+  const int rounds = argc > 2 ? std::atoi(argv[2]) : 5;
+
+  std::mt19937 rng(42);
+  std::cout << size << " keys per side, best kernel: "
+            << join_server::set_kernel_name(join_server::best_set_kernel()) << '\n';
+  std::cout << "density  kernel     ms/round   matches\n";
+
+  for (const double density : {0.1, 0.5, 0.9})
+  {
+    const auto a = make_keys(rng, size, density);
+    const auto b = make_keys(rng, size, density);
+    for (const auto kernel : {join_server::SetKernel::Scalar, join_server::SetKernel::Sse, join_server::SetKernel::Avx2})
+    {
+      if (!join_server::set_kernel_supported(kernel))
+        continue;
+      std::vector<join_server::IndexPair> out;
+      out.reserve(size);
+      const auto start = Clock::now();
+      for (int round = 0; round < rounds; ++round)
+      {
+        out.clear();
+        join_server::intersect_sorted(kernel, a.data(), a.size(), b.data(), b.size(), out);
+      }
+      const double ms = std::chrono::duration<double, std::milli>(Clock::now() - start).count() / rounds;
+      std::cout << std::fixed << std::setprecision(1) << std::setw(7) << density << "  " << std::left << std::setw(8)
+                << join_server::set_kernel_name(kernel) << std::right << std::setprecision(2) << std::setw(11) << ms
+                << std::setw(10) << out.size() << '\n';
+    }
+  }
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,80 @@
+#include "join_server/tables.hpp"
+#include "join_server/wal.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace
+{
+
+using Clock = std::chrono::steady_clock;
+
+const char *durability_name(join_server::Durability durability)
+{
+  switch (durability)
+  {
+  case join_server::Durability::Batch:
+    return "batch";
+  case join_server::Durability::EveryOp:
+    return "every-op";
+  case join_server::Durability::None:
+    break;
+  }
+  return "none";
+}
+
+// Insert throughput of `threads` writers, each inserting `rows` rows into
+// the table picked by its parity, with every insert logged to `path`.
+void run(join_server::Durability durability, const std::string &path, int threads, int rows)
+{
+  std::remove(path.c_str());
+  join_server::TablesStore store;
+  auto wal = std::make_unique<join_server::WriteAheadLog>(path, durability);
+  const auto *log = wal.get();
+  store.attach_wal(std::move(wal));
+
+  const auto start = Clock::now();
+  std::vector<std::thread> writers;
+  for (int t = 0; t < threads; ++t)
+  {
+    writers.emplace_back([&store, t, rows]
+                         {
+                           std::string error;
+                           const auto table = t % 2 == 0 ? join_server::TableId::A : join_server::TableId::B;
+                           for (int i = 0; i < rows; ++i)
+                             store.insert(table, t * rows + i, "value" + std::to_string(i % 1000), error); });
+  }
+  for (auto &writer : writers)
+    writer.join();
+  const double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+  const auto total = static_cast<double>(threads) * rows;
+  std::cout << std::left << std::setw(10) << durability_name(durability) << std::right << std::fixed
+            << std::setprecision(0) << std::setw(14) << total / seconds << std::setw(10) << log->syncs() << '\n';
+  std::remove(path.c_str());
+}
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+  const int rows = argc > 1 ? std::atoi(argv[1]) : 20000;
+  const int threads = argc > 2 ? std::atoi(argv[2]) : 8;
+  const std::string path = argc > 3 ? argv[3] : "wal_bench.log";
+
+  std::cout << threads << " writers, " << rows << " inserts each\n";
+  std::cout << "mode        inserts/s     syncs\n";
+  run(join_server::Durability::None, path, threads, rows);
+  run(join_server::Durability::Batch, path, threads, rows);
+  // One sync per insert; a tenth of the rows keeps the run short.
+  run(join_server::Durability::EveryOp, path, threads, std::max(1, rows / 10));
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <sys/types.h>
+#include <thread>
+
+namespace join_server
+{
+
+// Rows written by a snapshot writer so far. Lives in memory shared with the
+// forked child, so the parent can watch the child's progress.
+struct SnapshotProgress
+{
+  std::atomic<std::uint64_t> rows_written{0};
+  std::atomic<std::uint64_t> rows_total{0};
+};
+
+struct BackgroundSaveStats
+{
+  bool in_progress{false};
+  std::uint64_t rows_written{0};
+  std::uint64_t rows_total{0};
+  std::uint64_t completed{0};
+  std::uint64_t failed{0};
+  // How long writers were paused: from taking the table locks until fork()
+  // returned in the parent.
+  std::uint64_t last_fork_us{0};
+  std::uint64_t last_duration_ms{0};
+  bool last_ok{false};
+};
+
+// Runs snapshot writes in a forked child process. The child works on its
+// copy-on-write image of the parent's memory, so the parent only pauses for
+// the fork itself and keeps serving clients while the file is written.
+class BackgroundSaver
+{
+public:
+  using Writer = std::function<bool(SnapshotProgress &)>;
+  // Runs in the parent once the child wrote the file successfully; a false
+  // result counts the save as failed.
+  using Finisher = std::function<bool()>;
+
+  BackgroundSaver();
+  ~BackgroundSaver();
+
+  BackgroundSaver(const BackgroundSaver &) = delete;
+  BackgroundSaver &operator=(const BackgroundSaver &) = delete;
+
+  using Clock = std::chrono::steady_clock;
+
+  // Forks and runs `write` in the child, which exits with its result. The
+  // caller holds whatever locks make the fork point consistent, taken at
+  // `paused`, and releases them once this returns. `write` must not take
+  // locks: in the child only the forking thread exists, so a lock held by
+  // any other thread at fork time would never be released.
+  bool start(const Writer &write, Finisher finish, Clock::time_point paused, std::string &error);
+
+  BackgroundSaveStats stats() const;
+
+private:
+  void wait_child(pid_t pid, Clock::time_point started, const Finisher &finish);
+
+  SnapshotProgress *progress_{nullptr};
+  mutable std::mutex mtx_;
+  BackgroundSaveStats stats_;
+  std::thread waiter_;
+};
+
+} // namespace join_server
@@ -0,0 +1,116 @@
+#pragma once
+
+#include "join_server/command.hpp"
+#include "join_server/tables.hpp"
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace join_server
+{
+
+// Binary framing, entered with the text command BINARY. Every frame is a
+// little-endian uint32 payload length followed by the payload; the payload
+// starts with a one-byte opcode (requests) or status (replies).
+//
+// Requests:
+//   INSERT                 table:u8 id:i32 value:rest of frame
+//   TRUNCATE               table:u8
+//   INTERSECTION           -
+//   SYMMETRIC_DIFFERENCE   -
+//   TEXT                   any text command, without the newline
+// Tables are 0 for A and 1 for B.
+//
+// Replies: OK carries the text reply lines before the closing OK, if any,
+// and ERR the error without its "ERR " prefix; neither ends in a newline. A
+// join, including a TEXT INTERSECTION or SYMMETRIC_DIFFERENCE, is answered
+// with ROWS frames and a closing OK. A ROWS frame is count:varint, the id column as the first id
+// zigzag-encoded and then the gaps to each next id, and a blob of
+// size:varint holding length:varint and bytes of from_a and from_b per row.
+namespace binary
+{
+
+enum class Opcode : std::uint8_t
+{
+  Insert = 1,
+  Truncate = 2,
+  Intersection = 3,
+  SymmetricDifference = 4,
+  Text = 5
+};
+
+enum class Status : std::uint8_t
+{
+  Ok = 0,
+  Error = 1,
+  Rows = 2
+};
+
+constexpr std::size_t kLengthBytes = 4;
+// Longest payload a request may have; a longer one ends the connection.
+constexpr std::uint32_t kMaxRequestBytes = 16 * 1024 * 1024;
+
+// Client side: append one request frame to `out`.
+void encode_insert(std::string &out, TableId table, int id, std::string_view value);
+void encode_truncate(std::string &out, TableId table);
+void encode_join(std::string &out, JoinKind kind);
+void encode_text(std::string &out, std::string_view line);
+
+// One reply frame; the views point into the decoded input.
+struct Reply
+{
+  Status status{Status::Ok};
+  std::string_view text;
+  std::vector<DataRow> rows;
+};
+
+// Decodes the reply frame at the front of `input` and drops it from there.
+// Returns false if `input` does not start with a whole, well-formed frame.
+bool decode_reply(std::string_view &input, Reply &reply);
+
+} // namespace binary
+
+// Server side of the binary framing for one connection.
+class BinaryProcessor
+{
+public:
+  // TEXT requests go to `text`, which keeps its cursor and LOAD state.
+  BinaryProcessor(TablesStore &store, CommandProcessor &text);
+
+  // Runs every whole frame at the front of `input`, appending the replies to
+  // `out`, and returns how many bytes it consumed. Consecutive INSERTs run as
+  // one TablesStore::insert_batch. Unless `allow_scans`, stops in front of a
+  // join frame, see stopped_before_scan(); stops after a join that paused,
+  // see paused(). Returns false if a frame announces more than
+  // kMaxRequestBytes, after replying with an error.
+  bool execute(std::string_view input, ResponseBuffer &out, std::size_t &consumed, bool allow_scans = true);
+  // Whether the last execute() left a join frame for a scan task.
+  bool stopped_before_scan() const { return stopped_before_scan_; }
+  // Whether a join paused because the peer fell behind, see JoinStream.
+  bool paused() const { return join_.paused(); }
+  // Continues a paused join and sends its closing OK once it ends. Returns
+  // false if it paused again.
+  bool resume_join(ResponseBuffer &out);
+
+private:
+  void run_frame(std::string_view payload, ResponseBuffer &out);
+  void run_join(JoinKind kind, ResponseBuffer &out);
+  void append_rows(const DataRow *rows, std::size_t count, ResponseBuffer &out);
+  void run_text(std::string_view command_line, ResponseBuffer &out);
+  void flush_inserts(ResponseBuffer &out);
+  void reply(ResponseBuffer &out, binary::Status status, std::string_view text);
+
+  TablesStore &store_;
+  CommandProcessor &text_;
+  std::vector<InsertRow> batch_;
+  std::vector<std::string> batch_errors_;
+  // Scratch for frames under construction and TEXT replies.
+  std::string frame_;
+  ResponseBuffer text_reply_;
+  JoinStream join_;
+  bool stopped_before_scan_{false};
+};
+
+} // namespace join_server
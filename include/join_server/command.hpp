@@ -2,7 +2,9 @@
 
 #include "join_server/tables.hpp"
 
+#include <functional>
 #include <string>
+#include <string_view>
 #include <vector>
 
 namespace join_server
@@ -14,15 +16,148 @@ struct CommandOutput
   bool success{false};
 };
 
+// Reply text of one connection. Commands append their lines in place; once
+// the buffer passes kFlushBytes it is handed to the sink and reused, so a
+// connection keeps one allocation however much it sends. Without a sink
+// everything is kept.
+class ResponseBuffer
+{
+public:
+  // Receives newline-terminated lines in pieces. Returning false, e.g. when
+  // the peer went away, drops the rest of the output.
+  using Sink = std::function<bool(std::string_view data)>;
+  // Whether the peer has fallen behind on what the sink took; a join pauses
+  // while it has, see JoinStream.
+  using Backlog = std::function<bool()>;
+
+  static constexpr std::size_t kFlushBytes = 64 * 1024;
+
+  explicit ResponseBuffer(Sink sink = {}, Backlog backlog = {});
+
+  void append_line(std::string_view text);
+  // "<id>,<from_a>,<from_b>"
+  void append_row(const DataRow &row);
+  // "ERR <what><detail>"
+  void append_error(std::string_view what, std::string_view detail = {});
+  // Bytes as they are, e.g. a binary frame.
+  void append(std::string_view bytes);
+
+  // Hands everything buffered to the sink. Returns false once the sink has
+  // failed.
+  bool flush();
+  bool failed() const { return failed_; }
+  bool behind() const { return backlog_ && backlog_(); }
+
+  const std::string &data() const { return data_; }
+  void clear() { data_.clear(); }
+
+private:
+  void flush_if_full();
+
+  Sink sink_;
+  Backlog backlog_;
+  std::string data_;
+  bool failed_{false};
+};
+
+// Rows of an INTERSECTION or SYMMETRIC_DIFFERENCE reply. Once the peer falls
+// behind the join stops after the chunk it is on and later resumes with
+// TablesStore::join_batch() from the next id, like a cursor, so a slow reader
+// costs neither a worker nor a queue the size of the result. Changes behind
+// the rows already sent are not seen; changes ahead of them are.
+class JoinStream
+{
+public:
+  // Appends `count` rows to `out` in the caller's framing.
+  using Emit = std::function<void(const DataRow *rows, std::size_t count, ResponseBuffer &out)>;
+
+  // Streams the join until its end or until the peer falls behind. Returns
+  // false if it paused; the caller appends the closing reply otherwise.
+  bool start(const TablesStore &store, JoinKind kind, ResponseBuffer &out, const Emit &emit);
+  // Continues a paused join; same result as start().
+  bool resume(const TablesStore &store, ResponseBuffer &out, const Emit &emit);
+  bool paused() const { return paused_; }
+
+private:
+  JoinKind kind_{JoinKind::Intersection};
+  int next_{0};
+  bool paused_{false};
+};
+
+class CommandScheduler;
+
+// Whether the command is a join (INTERSECTION, SYMMETRIC_DIFFERENCE, OPEN_*
+// or FETCH), which CommandScheduler runs in its scan class.
+bool is_scan_command(std::string_view command_line);
+// Whether the command is INTERSECTION or SYMMETRIC_DIFFERENCE, without
+// arguments; `kind` receives which.
+bool is_join_command(std::string_view command_line, JoinKind &kind);
+
 class CommandProcessor
 {
 public:
-  explicit CommandProcessor(TablesStore &store);
+  // STATS also reports the queues of `scheduler`, if given.
+  explicit CommandProcessor(TablesStore &store, const CommandScheduler *scheduler = nullptr);
+
+  // Runs one command and appends its reply to `out`; join rows go from the
+  // tables straight into the buffer, and a join may pause, see paused().
+  // Returns whether the command succeeded.
+  bool execute(std::string_view command_line, ResponseBuffer &out);
+  // Same, with the reply collected into separate lines.
+  CommandOutput execute(std::string_view command_line);
+  // Runs `lines` in order with the same replies as execute() one by one, but
+  // hands each run of consecutive INSERTs to the store as a single batch.
+  // Stops after a BINARY command or a join that paused, or before a join
+  // unless `allow_scans`, and returns how many lines it ran.
+  std::size_t execute_batch(const std::vector<std::string_view> &lines, ResponseBuffer &out,
+                            bool allow_scans = true);
+
+  // Whether a join reply paused because the peer fell behind; nothing else
+  // may run before resume_join() has finished it.
+  bool paused() const { return join_.paused(); }
+  // Continues a paused join and closes its reply once it ends. Returns
+  // false if it paused again.
+  bool resume_join(ResponseBuffer &out);
 
-  CommandOutput execute(const std::string &command_line);
+  // Whether BINARY switched the connection to the binary framing.
+  bool binary() const { return binary_; }
 
 private:
+  // Join cursor of OPEN_INTERSECTION / OPEN_SYMMETRIC_DIFFERENCE; every FETCH
+  // resumes the merge at `next`.
+  struct Cursor
+  {
+    bool open{false};
+    JoinKind kind{JoinKind::Intersection};
+    int next{0};
+  };
+
+  // Block of rows announced by LOAD; the reply follows its last line.
+  struct Load
+  {
+    bool active{false};
+    TableId table{TableId::A};
+    std::size_t remaining{0};
+    std::vector<int> ids;
+    // Values are packed into `text`; `ends` holds where each one stops.
+    std::string text;
+    std::vector<std::size_t> ends;
+    // First malformed row; the rest of the block is still consumed.
+    std::string error;
+  };
+
+  bool load_row(std::string_view line, ResponseBuffer &out);
+  void flush_inserts(ResponseBuffer &out);
+
   TablesStore &store_;
+  const CommandScheduler *scheduler_;
+  Cursor cursor_;
+  JoinStream join_;
+  Load load_;
+  // Pending run of INSERTs in execute_batch().
+  std::vector<InsertRow> batch_;
+  std::vector<std::string> batch_errors_;
+  bool binary_{false};
 };
 
 } // namespace join_server
@@ -0,0 +1,25 @@
+#pragma once
+
+#include "join_server/tables.hpp"
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+
+namespace join_server
+{
+
+// Loads `path`, a local file of "id,name" lines, into `table` as one
+// TablesStore::load block. The file is mapped, split on line boundaries
+// across `threads` workers (0 uses every core), parsed and sorted per
+// worker, and the sorted parts are merged before loading. Errors name the
+// file as `shown_as` (the path if empty) and the offending line, but never
+// quote its contents; repeated or existing ids fail like INSERT does.
+bool import_csv(TablesStore &store, TableId table, const std::string &path, std::size_t threads,
+                std::size_t &rows, std::string &error, std::string_view shown_as = {});
+
+// Resolves `name`, a path relative to `dir`, for IMPORT. Fails unless the
+// file exists and, with symbolic links followed, lies inside `dir`.
+bool resolve_import_path(const std::string &dir, std::string_view name, std::string &path, std::string &error);
+
+} // namespace join_server
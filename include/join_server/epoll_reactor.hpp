@@ -0,0 +1,63 @@
+#pragma once
+
+#include "join_server/session.hpp"
+#include "join_server/tables.hpp"
+#include "join_server/scheduler.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+namespace join_server
+{
+
+// Edge-triggered epoll loop over non-blocking sockets. The reactor thread
+// accepts, reads and writes out replies the socket would not take at once;
+// commands run on the worker pool, one task at a time per connection, so
+// replies keep their order. A worker never waits for a client: a connection
+// with a backlog of replies stops running commands until the reactor has
+// sent them. An idle connection costs its socket and an empty Session,
+// nothing more.
+class EpollReactor
+{
+public:
+  // Serves the connections accepted on `listener`, which becomes
+  // non-blocking. The listener stays owned by the caller.
+  EpollReactor(int listener, TablesStore &store, CommandScheduler &scheduler);
+  // Waits for the commands still running on the workers.
+  ~EpollReactor();
+
+  EpollReactor(const EpollReactor &) = delete;
+  EpollReactor &operator=(const EpollReactor &) = delete;
+
+  // Runs the event loop until stop() or an epoll failure.
+  void run();
+  // Callable from any thread.
+  void stop();
+
+private:
+  struct Connection;
+
+  void accept_all();
+  void on_readable(const std::shared_ptr<Connection> &connection);
+  void on_writable(const std::shared_ptr<Connection> &connection);
+  // Closes connections whose queued replies made no progress for too long.
+  void close_stalled(std::chrono::steady_clock::time_point now);
+  void schedule(const std::shared_ptr<Connection> &connection, TaskClass task_class);
+  void process(const std::shared_ptr<Connection> &connection, TaskClass task_class);
+  void drop(int fd);
+
+  int listener_;
+  int epoll_fd_{-1};
+  int wake_fd_{-1};
+  TablesStore &store_;
+  CommandScheduler &scheduler_;
+  std::atomic<std::size_t> tasks_{0};
+  std::mutex connections_mtx_;
+  std::unordered_map<int, std::shared_ptr<Connection>> connections_;
+};
+
+} // namespace join_server
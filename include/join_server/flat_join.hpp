@@ -0,0 +1,34 @@
+#pragma once
+
+#include "join_server/flat_table.hpp"
+#include "join_server/tables.hpp"
+
+#include <cstddef>
+#include <vector>
+
+namespace join_server
+{
+
+// Appends the rows of an INTERSECTION or SYMMETRIC_DIFFERENCE of two sorted
+// runs to `rows`, in key order. With threads > 1 the key space is split into
+// ranges by sampling the runs; each range is merge-joined on its own worker
+// and the partial results are concatenated, so the output is identical to
+// the serial join.
+void join_runs(JoinKind kind, const FlatTable::Run &a, const FlatTable::Run &b, std::size_t threads,
+               std::vector<DataRow> &rows);
+
+// Same join, handed to `sink` in key order in chunks of at most
+// `chunk_rows` rows instead of being collected. Parallel joins work through
+// the key space a batch of ranges at a time, so memory stays bounded by the
+// batch rather than the result. Once the sink returns false no further
+// range is joined and false is returned.
+bool visit_runs(JoinKind kind, const FlatTable::Run &a, const FlatTable::Run &b, std::size_t threads,
+                std::size_t chunk_rows, const RowSink &sink);
+
+// Appends at most `limit` rows of the join with ids >= `from` to `rows`,
+// merging only as far as needed. Returns whether ids past the last
+// appended row remain in either run.
+bool join_runs_from(JoinKind kind, const FlatTable::Run &a, const FlatTable::Run &b, int from, std::size_t limit,
+                    std::vector<DataRow> &rows);
+
+} // namespace join_server
@@ -0,0 +1,148 @@
+#pragma once
+
+#include "join_server/id_column.hpp"
+#include "join_server/value_arena.hpp"
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <string_view>
+#include <unordered_set>
+#include <vector>
+
+namespace join_server
+{
+
+// Value references of a run, owned or borrowed from a mapped snapshot.
+class RefColumn
+{
+public:
+  RefColumn() = default;
+  explicit RefColumn(std::vector<ValueArena::Ref> refs) : owned_(std::move(refs)) {}
+  RefColumn(const ValueArena::Ref *refs, std::size_t size, std::shared_ptr<const void> owner)
+      : borrowed_(refs), size_(size), owner_(std::move(owner))
+  {
+  }
+
+  std::size_t size() const { return borrowed_ != nullptr ? size_ : owned_.size(); }
+  ValueArena::Ref operator[](std::size_t index) const
+  {
+    return borrowed_ != nullptr ? borrowed_[index] : owned_[index];
+  }
+
+private:
+  std::vector<ValueArena::Ref> owned_;
+  const ValueArena::Ref *borrowed_{nullptr};
+  std::size_t size_{0};
+  std::shared_ptr<const void> owner_;
+};
+
+// Table stored as sorted parallel key/value arrays. New rows land in an
+// unsorted buffer which is merged into the sorted arrays when a reader asks
+// for a snapshot. The buffer is capped at a fraction of the sorted part: once
+// full it is sealed, a fresh one takes the inserts, and the writer that sealed
+// it merges it after releasing the writer lock.
+//
+// Readers never block writers: the table is published as an immutable,
+// reference-counted version and a reader keeps whatever version it loaded
+// alive until it drops the snapshot.
+//
+// A run is columnar: the id column is all a merge join scans, and a value is
+// resolved through its arena reference only once its row is emitted.
+class FlatTable
+{
+public:
+  struct Run
+  {
+    IdColumn keys;
+    RefColumn values;
+    std::shared_ptr<const ValueArena> arena;
+
+    std::string_view value(std::size_t index) const { return arena->get(values[index]); }
+  };
+  using Snapshot = std::shared_ptr<const Run>;
+
+  struct Row
+  {
+    int id;
+    std::string_view value;
+  };
+
+  // With `compress_ids` large sorted runs keep their id column bit-packed.
+  explicit FlatTable(bool compress_ids = false);
+
+  // On success `stored`, when given, receives the interned copy of `value`.
+  bool insert(int id, std::string_view value, std::string_view *stored = nullptr);
+  // Same as insert() for each row in order, taking the writer lock once per
+  // buffer that fills up rather than once per row.
+  // inserted[i] tells whether row i was added.
+  void insert_many(const std::vector<Row> &rows, std::vector<bool> &inserted);
+  // Adds `rows`, sorted by id without repeats, with a single merge into the
+  // sorted part. If an id is already present nothing is added and it is
+  // reported in `duplicate`.
+  bool insert_sorted(const std::vector<Row> &rows, int &duplicate);
+  // Sorts by id: radix sort for large inputs, nothing if already sorted.
+  static void sort_rows(std::vector<Row> &rows);
+  // Drops every row and releases the value arena in one step.
+  void clear();
+  // Replaces every row with `run`, whose values live in `arena`; later
+  // inserts are interned into the same arena.
+  void reset(std::shared_ptr<ValueArena> arena, Snapshot run);
+
+  // Sorted view of every row inserted before the call.
+  Snapshot snapshot() const;
+
+  std::size_t size() const;
+  // Rows not merged into the sorted part yet.
+  std::size_t buffered() const;
+
+  // Arena that currently receives inserted values.
+  std::shared_ptr<const ValueArena> arena() const;
+
+private:
+  // Append-only insert buffer. Slots below `size` are immutable once
+  // published, so readers may copy them without taking the writer lock.
+  struct Delta
+  {
+    explicit Delta(std::size_t capacity);
+
+    std::vector<int> keys;
+    std::vector<ValueArena::Ref> values;
+    std::atomic<std::size_t> size{0};
+  };
+
+  // `sealed`, when set, is a full buffer being merged into `base`.
+  struct Version
+  {
+    Snapshot base;
+    std::shared_ptr<Delta> sealed;
+    std::shared_ptr<Delta> delta;
+  };
+
+  std::shared_ptr<const Version> load() const;
+  void publish(std::shared_ptr<const Version> version) const;
+  bool contains(const Version &version, int id) const;
+  static std::size_t buffered(const Version &version);
+  // Buffers one row into `version`, sealing or growing the buffer when full;
+  // write_mtx_ held and `id` not present. A version whose buffer got sealed
+  // is left in `to_merge` for merge_sealed().
+  ValueArena::Ref append(std::shared_ptr<const Version> &version, int id, std::string_view value,
+                         std::shared_ptr<const Version> &to_merge);
+  // Same rows as `version`, with room for as many more buffered; write_mtx_ held.
+  std::shared_ptr<const Version> grow(const Version &version) const;
+  // Merges the sealed buffer of `seen` into its base; write_mtx_ not held.
+  void merge_sealed(const std::shared_ptr<const Version> &seen) const;
+  void fold(const std::shared_ptr<const Version> &seen, std::size_t folded, Snapshot merged) const;
+
+  const bool compress_ids_;
+  mutable std::mutex write_mtx_;
+  mutable std::shared_ptr<const Version> current_;
+  // Writer side of the arena shared by the current version; under write_mtx_.
+  std::shared_ptr<ValueArena> arena_;
+  // Keys in the current delta and in the sealed one, touched only under write_mtx_.
+  mutable std::unordered_set<int> pending_index_;
+  mutable std::unordered_set<int> sealed_index_;
+};
+
+} // namespace join_server
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace join_server
+{
+
+// Strictly increasing id column of a table run. Kept as a plain int array;
+// for large cold runs delta-encoded and bit-packed in blocks of kBlockSize
+// ids; or, for dense id ranges, as a bitmap over the range with a rank
+// directory, where the position of an id is the number of set bits below it.
+class IdColumn
+{
+public:
+  enum class Encoding
+  {
+    Plain,
+    Packed,
+    Bitmap
+  };
+
+  static constexpr std::size_t kBlockSize = 128;
+
+  IdColumn() = default;
+  explicit IdColumn(std::vector<int> ids);
+
+  static IdColumn pack(const std::vector<int> &ids);
+  static IdColumn bitmap(const std::vector<int> &ids);
+  // Plain column over ids stored elsewhere, e.g. a mapped snapshot, which
+  // `owner` keeps alive.
+  static IdColumn view(const int *ids, std::size_t size, std::shared_ptr<const void> owner);
+
+  Encoding encoding() const { return encoding_; }
+  bool packed() const { return encoding_ == Encoding::Packed; }
+  std::size_t size() const { return size_; }
+  bool empty() const { return size_ == 0; }
+
+  int at(std::size_t index) const;
+  std::size_t lower_bound(int key) const;
+  bool contains(int key) const;
+
+  // Points `data` at up to `max` consecutive ids starting at `pos` and
+  // returns how many there are. Plain columns are returned in place, others
+  // are decoded into `scratch`.
+  std::size_t window(std::size_t pos, std::size_t max, const int *&data, std::vector<int> &scratch) const;
+
+  // Bitmap columns only: bit k is set when 64 * word + k is in the column.
+  std::uint64_t bitmap_word(std::int64_t word) const;
+
+  std::vector<int> to_vector() const;
+  std::size_t memory_bytes() const;
+
+private:
+  void decode_block(std::size_t block, int *out) const;
+  std::size_t block_size(std::size_t block) const;
+  std::size_t rank(std::uint64_t bit) const;
+  const int *plain_data() const { return borrowed_ != nullptr ? borrowed_ : plain_.data(); }
+  std::uint64_t select(std::size_t index) const;
+
+  Encoding encoding_{Encoding::Plain};
+  std::size_t size_{0};
+  std::vector<int> plain_;
+  const int *borrowed_{nullptr};
+  std::shared_ptr<const void> owner_;
+
+  // Packed layout: first id of each block, bit width of each block's
+  // (delta - 1) values and the position of its first bit in words_.
+  std::vector<int> heads_;
+  std::vector<std::uint8_t> widths_;
+  std::vector<std::uint64_t> bit_offsets_;
+  std::vector<std::uint64_t> words_;
+
+  // Bitmap layout: words_ holds the bits of ids from 64 * base_word_ on and
+  // ranks_ the number of set bits before every kRankStride words.
+  std::int64_t base_word_{0};
+  std::vector<std::uint64_t> ranks_;
+};
+
+} // namespace join_server
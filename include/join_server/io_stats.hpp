@@ -0,0 +1,15 @@
+#pragma once
+
+#include <cstdint>
+
+namespace join_server
+{
+
+// Socket and ring system calls made by the I/O backends, for comparing them
+// in benchmarks. Every thread counts into a slot of its own, so the reactor
+// and the workers never contend for one cache line.
+void count_io_syscall(std::uint64_t calls = 1);
+// Calls counted so far by all threads, including those that have exited.
+std::uint64_t io_syscalls();
+
+} // namespace join_server
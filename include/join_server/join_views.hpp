@@ -0,0 +1,44 @@
+#pragma once
+
+#include "join_server/tables.hpp"
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string_view>
+
+namespace join_server
+{
+
+// INTERSECTION and SYMMETRIC_DIFFERENCE kept up to date on every write, so
+// that queries are a scan of an already computed result instead of a merge.
+class JoinViews
+{
+public:
+  // Callers apply the deltas in the same order as the table writes they
+  // describe; each (table, id) pair is reported at most once between
+  // truncates. `value` must stay valid while `owner` is alive.
+  void on_insert(TableId table, int id, std::string_view value, std::shared_ptr<const void> owner);
+  void on_truncate(TableId table);
+
+  JoinResult intersection() const;
+  JoinResult symmetric_difference() const;
+  // Up to `limit` rows of a view with ids >= `from`; returns whether more
+  // rows follow.
+  bool batch(JoinKind kind, int from, std::size_t limit, JoinResult &result) const;
+
+private:
+  struct DifferenceRow
+  {
+    TableId side;
+    DataRow row;
+  };
+
+  std::map<int, DataRow> intersection_;
+  std::map<int, DifferenceRow> difference_;
+  // Storage of the values referenced from each table, indexed by TableId.
+  std::shared_ptr<const void> owners_[2];
+  mutable std::mutex mtx_;
+};
+
+} // namespace join_server
@@ -0,0 +1,98 @@
+#pragma once
+
+#include "join_server/worker_pool.hpp"
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+
+namespace join_server
+{
+
+enum class TaskClass
+{
+  // INSERTs and the other commands that hold a table lock only briefly.
+  Write,
+  // Joins, which hold the tables and a worker for as long as the result is.
+  Scan
+};
+
+struct SchedulerOptions
+{
+  // Scans running at once; zero means half the workers, at least one.
+  std::size_t max_scans{0};
+  // Writes that may start ahead of a waiting scan before it gets its turn.
+  std::size_t write_burst{8};
+};
+
+struct TaskClassStats
+{
+  std::uint64_t queued{0};
+  std::uint64_t running{0};
+  std::uint64_t completed{0};
+  // Time from submit() until a worker was handed the task.
+  std::uint64_t wait_us_total{0};
+  std::uint64_t wait_us_max{0};
+};
+
+struct SchedulerStats
+{
+  TaskClassStats write;
+  TaskClassStats scan;
+};
+
+// Feeds the worker pool from two queues. No more tasks than there are
+// workers are handed to the pool at a time, so the rest wait here, where
+// writes overtake scans, but no more than write_burst of them in a row while
+// a scan waits; then the oldest scan gets its turn. At most
+// max_scans scans run at once, leaving the other workers to writes however
+// many joins come in. The backlog therefore queues here rather than in the
+// pool's deques, where the ordering above could not be kept.
+class CommandScheduler
+{
+public:
+  using Task = WorkerPool::Task;
+
+  CommandScheduler(WorkerPool &workers, const SchedulerOptions &options = {});
+  // Waits for the tasks still queued or running.
+  ~CommandScheduler();
+
+  CommandScheduler(const CommandScheduler &) = delete;
+  CommandScheduler &operator=(const CommandScheduler &) = delete;
+
+  void submit(TaskClass task_class, Task task);
+  SchedulerStats stats() const;
+
+private:
+  using Clock = std::chrono::steady_clock;
+
+  struct Entry
+  {
+    Task task;
+    Clock::time_point queued;
+  };
+
+  // Hands queued tasks to the pool while workers are free; mtx_ held.
+  void dispatch();
+  void finished(TaskClass task_class);
+  // Nothing queued or running; mtx_ held.
+  bool idle() const;
+
+  WorkerPool &workers_;
+  std::size_t max_running_;
+  std::size_t max_scans_;
+  std::size_t write_burst_;
+
+  mutable std::mutex mtx_;
+  // Notified when the last task finishes, for the destructor.
+  std::condition_variable drained_;
+  std::deque<Entry> queues_[2];
+  std::size_t running_[2]{0, 0};
+  std::size_t writes_in_row_{0};
+  TaskClassStats stats_[2];
+};
+
+} // namespace join_server
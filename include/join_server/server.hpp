@@ -1,31 +1,65 @@
 #pragma once
 
+#include "join_server/scheduler.hpp"
+
+#include <cstddef>
 #include <cstdint>
 #include <memory>
+#include <vector>
 
 namespace join_server
 {
 
 class TablesStore;
 
+enum class IoBackend
+{
+  // A blocking thread per connection.
+  Threads,
+  // One epoll reactor thread plus a pool of command workers.
+  Epoll,
+  // Same with an io_uring reactor; falls back to Epoll where unsupported.
+  Uring
+};
+
+struct ServerOptions
+{
+  uint16_t port{0};
+  IoBackend backend{IoBackend::Epoll};
+  // Command workers of the reactor backends; zero means one per core.
+  std::size_t workers{0};
+  // Reactor threads, each with its own SO_REUSEPORT listener on the port so
+  // the kernel spreads new connections over them; zero means one per core.
+  std::size_t reactors{1};
+  // Pins reactor thread i to CPU i (modulo the CPU count).
+  bool cpu_affinity{false};
+  // How the reactor backends share the workers between writes and joins.
+  SchedulerOptions scheduler;
+};
+
 class TcpServer
 {
 public:
-  TcpServer(uint16_t port, std::shared_ptr<TablesStore> store);
+  TcpServer(const ServerOptions &options, std::shared_ptr<TablesStore> store);
   ~TcpServer();
 
   TcpServer(const TcpServer &) = delete;
   TcpServer &operator=(const TcpServer &) = delete;
 
+  // Serves until the backend fails. A reactor that fails closes its own
+  // listener and leaves the port to the others; once none is left, throws.
   void run();
 
 private:
-  void close_listener();
-  void handle_client(int client_fd);
-  bool send_all(int client_fd, const std::string &data);
+  void open_listener(bool reuse_port);
+  void close_listeners();
+
+  void run_threads();
+  void run_reactors();
+  void run_reactor(int listener, CommandScheduler &scheduler);
 
-  int listener_{-1};
-  uint16_t port_{};
+  std::vector<int> listeners_;
+  ServerOptions options_;
   std::shared_ptr<TablesStore> store_;
 };
 
@@ -0,0 +1,49 @@
+#pragma once
+
+#include "join_server/binary_protocol.hpp"
+#include "join_server/command.hpp"
+#include "join_server/tables.hpp"
+
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace join_server
+{
+
+// Command stream of one connection in either framing; every I/O backend
+// feeds the bytes it reads through one of these.
+class Session
+{
+public:
+  // STATS reports the queues of `scheduler`, if given.
+  explicit Session(TablesStore &store, const CommandScheduler *scheduler = nullptr);
+
+  Session(const Session &) = delete;
+  Session &operator=(const Session &) = delete;
+
+  // Runs every complete line or frame at the front of `input`, appends the
+  // replies to `out` and drops what it ran from `input`. All complete lines
+  // run as one batch, so pipelined INSERTs share a lock acquisition. Unless
+  // `allow_scans`, stops in front of the first join and leaves it for a task
+  // of the scan class, see stopped_before_scan(). A join whose reader falls
+  // behind `out` pauses, see paused(); the next run() with `allow_scans`
+  // continues it before anything else. Returns false when the connection has
+  // to be closed.
+  bool run(std::string &input, ResponseBuffer &out, bool allow_scans = true);
+  bool stopped_before_scan() const { return stopped_before_scan_; }
+  bool paused() const { return text_.paused() || binary_.paused(); }
+
+private:
+  CommandProcessor text_;
+  BinaryProcessor binary_;
+  std::vector<std::string_view> lines_;
+  std::vector<std::size_t> line_ends_;
+  bool stopped_before_scan_{false};
+};
+
+// Serves `fd` on the calling thread with blocking recv() and send() until the
+// peer goes away, then closes it.
+void serve_blocking(int fd, TablesStore &store);
+
+} // namespace join_server
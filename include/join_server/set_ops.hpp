@@ -0,0 +1,41 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace join_server
+{
+
+// Positions of one key that is present in both inputs.
+struct IndexPair
+{
+  std::uint32_t a;
+  std::uint32_t b;
+};
+
+enum class SetKernel
+{
+  Scalar,
+  Sse,
+  Avx2
+};
+
+// Fastest kernel the running CPU supports, detected once.
+SetKernel best_set_kernel();
+bool set_kernel_supported(SetKernel kernel);
+const char *set_kernel_name(SetKernel kernel);
+
+// Appends (i, j) for every a[i] == b[j], in increasing i. Both inputs must be
+// strictly increasing. Inputs of very different sizes are intersected by
+// galloping through the larger one regardless of the kernel.
+void intersect_sorted(SetKernel kernel, const int *a, std::size_t size_a, const int *b, std::size_t size_b,
+                      std::vector<IndexPair> &out);
+
+inline void intersect_sorted(const int *a, std::size_t size_a, const int *b, std::size_t size_b,
+                             std::vector<IndexPair> &out)
+{
+  intersect_sorted(best_set_kernel(), a, size_a, b, size_b, out);
+}
+
+} // namespace join_server
@@ -0,0 +1,48 @@
+#pragma once
+
+#include "join_server/background_save.hpp"
+#include "join_server/tables.hpp"
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <string_view>
+
+namespace join_server
+{
+
+// One table as the snapshot writer reads it: `rows` rows, which `visit`
+// hands over in key order each time it is called. Nothing is copied, so a
+// forked child can write straight from its copy-on-write image.
+struct SnapshotTable
+{
+  using Visitor = std::function<void(int id, std::string_view value)>;
+
+  std::size_t rows{0};
+  std::function<void(const Visitor &)> visit;
+};
+
+// Snapshot files hold both tables in key order. Each table is an id column,
+// a column of 64-bit value offsets and a blob of distinct values in
+// ValueArena layout, located through a fixed header that also records the
+// last write-ahead log record the tables include. The file is written next
+// to a fresh temporary file and renamed over it, so a crash never leaves a
+// torn snapshot behind. `progress`, when given, counts rows as they are
+// written.
+bool write_snapshot(const SnapshotTable &table_a, const SnapshotTable &table_b, std::uint64_t wal_lsn,
+                    const std::string &path, std::string &error, SnapshotProgress *progress = nullptr);
+
+// Maps `path` copy-on-write and hands both tables to `store` without
+// copying them: the flat engine serves joins straight from the mapped pages.
+// Only the header is checked, against its checksum and the file size, so the
+// cost does not depend on the rows; a value reference outside the file reads
+// as an empty value. A missing file loads nothing. `wal_lsn`, when given,
+// receives the log position the snapshot was taken at.
+bool map_snapshot(TablesStore &store, const std::string &path, std::size_t &rows, std::string &error,
+                  std::uint64_t *wal_lsn = nullptr);
+
+// Scans both tables of `path`: every id in order and every value within the
+// file. A missing file passes.
+bool verify_snapshot(const std::string &path, std::string &error);
+
+} // namespace join_server
@@ -1,8 +1,15 @@
 #pragma once
 
+#include "join_server/background_save.hpp"
+#include "join_server/flat_table.hpp"
+
+#include <cstddef>
+#include <functional>
 #include <map>
+#include <memory>
 #include <mutex>
 #include <string>
+#include <string_view>
 #include <tuple>
 #include <vector>
 
@@ -15,33 +22,172 @@ enum class TableId
   B
 };
 
+// Backing representation of tables A and B, chosen once at startup.
+enum class StorageEngine
+{
+  Map,
+  Flat
+};
+
+enum class JoinKind
+{
+  Intersection,
+  SymmetricDifference
+};
+
+// Values point into table storage owned by the JoinResult the row came from.
 struct DataRow
 {
   int id{};
-  std::string from_a;
-  std::string from_b;
+  std::string_view from_a;
+  std::string_view from_b;
 };
 
+struct JoinResult
+{
+  std::vector<DataRow> rows;
+  // Keeps the storage behind the row values alive.
+  std::vector<std::shared_ptr<const void>> owners;
+
+  std::size_t size() const { return rows.size(); }
+  bool empty() const { return rows.empty(); }
+  const DataRow &operator[](std::size_t index) const { return rows[index]; }
+  std::vector<DataRow>::const_iterator begin() const { return rows.begin(); }
+  std::vector<DataRow>::const_iterator end() const { return rows.end(); }
+};
+
+// Receives join rows in key order, a chunk at a time. Row values are only
+// valid during the call. Returning false stops the join.
+using RowSink = std::function<bool(const DataRow *rows, std::size_t count)>;
+
+struct InsertRow
+{
+  TableId table;
+  int id;
+  std::string_view value;
+};
+
+struct StoreOptions
+{
+  StorageEngine engine{StorageEngine::Map};
+  // Maintain INTERSECTION / SYMMETRIC_DIFFERENCE incrementally on writes.
+  bool materialized_views{false};
+  // Worker threads per flat-engine join; 1 keeps joins on the calling thread.
+  std::size_t join_threads{1};
+  // Keep the id columns of large flat-engine runs delta/bit-packed.
+  bool compress_ids{false};
+  // File written by save_snapshot(); empty disables snapshots.
+  std::string snapshot_path;
+  // Directory the IMPORT command may read from; empty disables IMPORT.
+  std::string import_dir;
+};
+
+class JoinViews;
+class WriteAheadLog;
+struct SnapshotTable;
+
 class TablesStore
 {
 public:
-  TablesStore();
+  explicit TablesStore(StoreOptions options = {});
+  explicit TablesStore(StorageEngine engine);
+  ~TablesStore();
+
+  StorageEngine engine() const { return engine_; }
+  const std::string &import_dir() const { return import_dir_; }
+
+  // Logs every later successful insert and truncate to `wal`. Call before
+  // the store is shared between threads, e.g. right after replaying the log.
+  // Once the log fails the store turns read-only: changes are not rolled
+  // back, so the write whose commit failed stays visible, but every later
+  // write is refused with the log error.
+  void attach_wal(std::unique_ptr<WriteAheadLog> wal);
 
-  bool insert(TableId table, int id, const std::string &value, std::string &error);
-  void truncate(TableId table);
+  bool insert(TableId table, int id, std::string_view value, std::string &error);
+  // Same as insert() for each row in order, with the table locks taken once
+  // for the batch and one log commit. errors[i] is empty if row i was
+  // inserted and holds what insert() would have reported otherwise.
+  void insert_batch(const std::vector<InsertRow> &rows, std::vector<std::string> &errors);
+  // Inserts all of `rows` or, if any id repeats or is already present, none
+  // of them. Rows are radix-sorted by id and added in one merge under a
+  // single lock acquisition.
+  bool load(TableId table, std::vector<FlatTable::Row> rows, std::string &error);
+  bool truncate(TableId table, std::string &error);
 
-  std::vector<DataRow> intersection() const;
-  std::vector<DataRow> symmetric_difference() const;
+  JoinResult intersection() const;
+  JoinResult symmetric_difference() const;
+
+  // Streams a join to `sink` in chunks of at most `chunk_rows` rows, so memory
+  // is bounded by the chunk rather than the result. The flat engine joins its
+  // current versions chunk by chunk; the map engine and views go through
+  // join_batch(), so each chunk sees the tables as they are when it is built.
+  // Returns false if the sink stopped the join before its end.
+  bool visit_join(JoinKind kind, std::size_t chunk_rows, const RowSink &sink) const;
+
+  // One step of a join cursor: at most `limit` rows with ids >= `from`, in
+  // key order. Locks are held for this batch only, so consecutive batches
+  // see the tables as they are at the time of each call. Returns whether
+  // ids past the last row remain.
+  bool join_batch(JoinKind kind, int from, std::size_t limit, JoinResult &batch) const;
+
+  // Every row of one table in key order, with the other side left empty.
+  JoinResult rows(TableId table) const;
+
+  // Replaces the contents of `table` with `run`, whose values live in
+  // `arena`. The flat engine serves the run as is; the map engine copies it.
+  // Meant for startup, before a WAL is attached: the change is not logged.
+  void restore(TableId table, std::shared_ptr<ValueArena> arena, FlatTable::Snapshot run);
+
+  // Writes both tables to StoreOptions::snapshot_path. Fails while a
+  // background save is running; two saves never overlap.
+  bool save_snapshot(std::string &error) const;
+  // Same, from a forked child: writers only wait for the fork, not the write.
+  bool background_save(std::string &error);
+  BackgroundSaveStats background_save_stats() const;
 
 private:
-  using Table = std::map<int, std::string>;
+  using Table = std::map<int, ValueArena::Ref>;
 
   Table &table_ref(TableId table);
   const Table &table_ref(TableId table) const;
+  std::shared_ptr<ValueArena> &arena_ref(TableId table);
+  std::mutex &mutex_ref(TableId table) const;
+  FlatTable &flat_ref(TableId table);
+
+  // Engine insert plus view update; the caller holds the locks it needs.
+  bool insert_row(TableId table, int id, std::string_view value);
+  // insert_batch() for a flat store with neither views nor a log.
+  void insert_flat_batch(const std::vector<InsertRow> &rows, std::vector<std::string> &errors);
+  JoinResult flat_join(JoinKind kind) const;
+  // Row builders for rows(); neither takes a lock.
+  static JoinResult run_rows(TableId table, const FlatTable::Snapshot &run);
+  JoinResult map_rows(TableId table) const;
+  // Snapshot writer input streaming `run`, or the map table when there is no
+  // run; the map must not change while it is written.
+  SnapshotTable snapshot_table(TableId table, FlatTable::Snapshot run) const;
 
+  StorageEngine engine_;
+  std::size_t join_threads_;
+  std::string snapshot_path_;
+  std::string import_dir_;
   Table table_a_;
   Table table_b_;
-  mutable std::mutex mtx_;
+  std::shared_ptr<ValueArena> arena_a_;
+  std::shared_ptr<ValueArena> arena_b_;
+  FlatTable flat_a_;
+  FlatTable flat_b_;
+  std::unique_ptr<JoinViews> views_;
+  std::unique_ptr<WriteAheadLog> wal_;
+  std::unique_ptr<BackgroundSaver> saver_;
+  // Per-table locks of the map engine; joins take them in A, B order.
+  // FlatTable serializes its own writers and publishes snapshots to readers.
+  // With views or a WAL enabled the lock also covers the view update and the
+  // log append for both engines.
+  mutable std::mutex mtx_a_;
+  mutable std::mutex mtx_b_;
+  // Held for a whole snapshot write, and by a background save until its
+  // child runs, so snapshot files and log checkpoints go in order.
+  mutable std::mutex save_mtx_;
 };
 
 } // namespace join_server
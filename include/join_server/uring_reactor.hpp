@@ -0,0 +1,95 @@
+#pragma once
+
+#include "join_server/session.hpp"
+#include "join_server/tables.hpp"
+#include "join_server/scheduler.hpp"
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace join_server
+{
+
+// io_uring event loop driven through the raw system calls. One multishot
+// accept and one multishot receive per connection stay armed; receives land
+// in a pool of provided buffers, so idle connections pin no memory. Workers
+// queue replies on the connection and the reactor sends them, submitting the
+// sends of every connection together with all other requests in a single
+// io_uring_enter. Commands run on the worker pool, one task at a time per
+// connection, as with EpollReactor; a connection with a backlog of replies
+// gives up its worker until the reactor has taken them.
+class UringReactor
+{
+public:
+  // Throws std::runtime_error if the kernel cannot run it (io_uring missing
+  // or disabled, or without multishot receives, which Linux 6.0 added), so
+  // the caller can fall back to another backend.
+  UringReactor(int listener, TablesStore &store, CommandScheduler &scheduler);
+  // Waits for the commands still running on the workers.
+  ~UringReactor();
+
+  UringReactor(const UringReactor &) = delete;
+  UringReactor &operator=(const UringReactor &) = delete;
+
+  // Runs the event loop until stop() or a ring failure.
+  void run();
+  // Callable from any thread.
+  void stop();
+
+private:
+  class Ring;
+  struct Connection;
+
+  void arm_accept();
+  void arm_wake();
+  void arm_sweep();
+  void arm_receive(Connection &connection);
+  void on_accept(int result, std::uint32_t flags);
+  void on_receive(Connection &connection, int result, std::uint32_t flags);
+  void on_send(Connection &connection, int result);
+  void on_wake();
+  void start_send(Connection &connection);
+  void maybe_close(Connection &connection);
+  // Drops the replies of a connection that cannot take them; its mtx held.
+  void break_locked(Connection &connection);
+  // Closes connections whose send made no progress for too long.
+  void close_stalled();
+  void provide_buffers(std::uint16_t first, unsigned count);
+  // Tries a multishot receive on a socket pair; constructor only.
+  bool probe_multishot_receive(std::string &error);
+
+  // Worker side.
+  void schedule(const std::shared_ptr<Connection> &connection, TaskClass task_class);
+  void process(const std::shared_ptr<Connection> &connection, TaskClass task_class);
+  bool queue_reply(Connection &connection, std::string_view data);
+  void notify(std::uint64_t id);
+
+  int listener_;
+  TablesStore &store_;
+  CommandScheduler &scheduler_;
+  std::unique_ptr<Ring> ring_;
+  int wake_fd_{-1};
+  std::uint64_t wake_value_{0};
+  std::atomic<bool> stopping_{false};
+  std::atomic<std::size_t> tasks_{0};
+
+  // Receive buffers handed to the kernel; each one is given back as soon as
+  // its data has been copied to the connection.
+  std::unique_ptr<char[]> buffers_;
+
+  // Reactor thread only.
+  std::uint64_t next_id_{1};
+  std::unordered_map<std::uint64_t, std::shared_ptr<Connection>> connections_;
+
+  // Connections with news for the reactor, filled by the workers.
+  std::mutex ready_mtx_;
+  std::vector<std::uint64_t> ready_;
+  std::vector<std::uint64_t> ready_swap_;
+};
+
+} // namespace join_server
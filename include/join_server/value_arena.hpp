@@ -0,0 +1,74 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string_view>
+#include <vector>
+
+namespace join_server
+{
+
+// Append-only storage for table values with a built-in intern table, so a
+// name repeated across millions of rows is stored once. Values are addressed
+// by compact 64-bit references and released all at once with the arena.
+//
+// intern() must be called by one writer at a time. get() may run
+// concurrently with intern() for any reference the reader obtained through a
+// properly synchronized publication; stored bytes never move.
+class ValueArena
+{
+public:
+  using Ref = std::uint64_t;
+
+  ValueArena();
+  // Adopts the `size` bytes at `data`, laid out as by encode(), as the first
+  // chunk, so a byte offset into `data` is a reference. `owner` keeps the
+  // bytes alive. Adopted values are not interned: storing one again copies
+  // it. get() yields an empty value for a reference that does not name a
+  // whole value within them.
+  ValueArena(const char *data, std::size_t size, std::shared_ptr<const void> owner);
+  ~ValueArena();
+
+  ValueArena(const ValueArena &) = delete;
+  ValueArena &operator=(const ValueArena &) = delete;
+
+  Ref intern(std::string_view value);
+  std::string_view get(Ref ref) const;
+
+  // Arena layout of one value: varint length, then the bytes. encode writes
+  // encoded_size(value) bytes to `out`.
+  static std::size_t encoded_size(std::string_view value);
+  static void encode(std::string_view value, char *out);
+  // Whether `ref` names a whole value encoded within the first `size` bytes
+  // of `data`, as laid out for the adopting constructor.
+  static bool encoded_within(const char *data, std::size_t size, Ref ref);
+
+  // Distinct values stored and bytes reserved for them.
+  std::size_t distinct() const { return distinct_; }
+  std::size_t reserved_bytes() const { return reserved_bytes_; }
+
+private:
+  Ref append(std::string_view value);
+  char *chunk(std::size_t index) const;
+  void add_chunk(std::size_t size);
+  void grow_index();
+
+  // Two-level chunk directory. Entries are written once, before any
+  // reference into the chunk is handed out, and never move afterwards.
+  std::unique_ptr<std::unique_ptr<char *[]>[]> directory_;
+  std::vector<std::unique_ptr<char[]>> owned_;
+  std::shared_ptr<const void> external_;
+  const char *adopted_{nullptr};
+  std::size_t adopted_size_{0};
+  std::size_t chunk_count_{0};
+  std::size_t chunk_used_{0};
+  std::size_t chunk_size_{0};
+
+  // Open-addressing intern table over stored references.
+  std::vector<Ref> index_;
+  std::size_t distinct_{0};
+  std::size_t reserved_bytes_{0};
+};
+
+} // namespace join_server
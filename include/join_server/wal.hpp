@@ -0,0 +1,111 @@
+#pragma once
+
+#include "join_server/tables.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <string_view>
+
+namespace join_server
+{
+
+enum class Durability
+{
+  // Records reach the page cache before the client sees OK.
+  None,
+  // Concurrent writers share one fdatasync (group commit).
+  Batch,
+  // Every record is written and synced on its own.
+  EveryOp
+};
+
+// Append-only log of successful INSERT and TRUNCATE operations. Each record
+// is framed with its length and a checksum, so a torn tail left by a crash is
+// detected and dropped on replay.
+//
+// Records are numbered across the life of the log. A checkpoint drops every
+// record a durable snapshot already holds and starts the file at the next
+// number, so the log only grows between snapshots.
+class WriteAheadLog
+{
+public:
+  using Lsn = std::uint64_t;
+
+  // Last record appended and where the log ends after it.
+  struct Position
+  {
+    Lsn lsn{0};
+    std::uint64_t offset{0};
+  };
+
+  // Opens `path` for appending, creating it if needed; throws if it cannot
+  // be opened or is not a log.
+  WriteAheadLog(const std::string &path, Durability durability);
+  ~WriteAheadLog();
+
+  WriteAheadLog(const WriteAheadLog &) = delete;
+  WriteAheadLog &operator=(const WriteAheadLog &) = delete;
+
+  // Queue a record and return its sequence number. Callers append while they
+  // hold the lock of the table they changed, so the log order matches the
+  // order in which changes were applied.
+  Lsn append_insert(TableId table, int id, std::string_view value);
+  Lsn append_truncate(TableId table);
+
+  // Blocks until the record `lsn` is as durable as the mode promises. Call
+  // it without holding table locks so writers can batch their syncs.
+  bool commit(Lsn lsn, std::string &error);
+
+  // Taken while the tables hold exactly the changes logged so far.
+  Position position() const;
+  // Rewrites the log without the records up to `position`, which a durable
+  // snapshot now holds, and renames it over the old file. The records after
+  // `position` are copied and synced without blocking appends; only those
+  // written meanwhile are copied under the lock, just before the swap.
+  bool checkpoint(const Position &position, std::string &error);
+
+  // False, with the error, once a write or sync of the log has failed; the
+  // log accepts no more records after that.
+  bool healthy(std::string &error) const;
+
+  Durability durability() const { return durability_; }
+  std::uint64_t syncs() const;
+
+  // Applies every intact record of `path` numbered after `after`, the
+  // position of the snapshot the store was loaded from, and cuts off a torn
+  // tail. A missing file is an empty log. Fails if a record does not apply
+  // or if the log was checkpointed past `after`, since rows would be lost.
+  static bool replay(const std::string &path, TablesStore &store, std::size_t &records, std::string &error,
+                     Lsn after = 0);
+
+private:
+  Lsn append(const std::string &record);
+  bool write_all(const std::string &data, std::string &error);
+
+  const std::string path_;
+  const Durability durability_;
+  int fd_{-1};
+  // Record number the file starts after and bytes of records dropped by
+  // checkpoints; Position::offset counts those bytes too. Both under mtx_.
+  Lsn base_{0};
+  std::uint64_t dropped_{0};
+  std::uint64_t size_{0};
+
+  // Writers that need a sync queue on flush_mtx_; whoever gets it first
+  // syncs every queued record, so most of the others find their record
+  // already durable once they get in.
+  std::mutex flush_mtx_;
+  mutable std::mutex mtx_;
+  // One checkpoint at a time; taken before the other two.
+  std::mutex checkpoint_mtx_;
+  std::string pending_;
+  Lsn appended_{0};
+  Lsn durable_{0};
+  std::uint64_t syncs_{0};
+  // First I/O error; once set every later commit fails with it.
+  std::string failure_;
+};
+
+} // namespace join_server
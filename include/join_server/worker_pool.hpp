@@ -0,0 +1,73 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace join_server
+{
+
+// Fixed set of threads running submitted tasks. Every worker has a deque of
+// its own: tasks submitted from outside the pool are dealt to the deques in
+// turn, a worker submitting a task keeps it, and a worker whose deque runs dry
+// steals from the back of a random other one. A long join therefore holds up
+// only its own worker, and whatever was queued behind it moves to idle ones.
+// Tasks are not ordered against each other; callers that need ordering, such
+// as the reactors for the commands of one connection, submit the next task
+// when the previous one has finished.
+//
+// Behind CommandScheduler, which hands over no more tasks than there are
+// workers, the deques stay nearly empty: stealing then only moves a task
+// dealt to a busy worker over to the idle one that must exist. Balancing
+// long deques matters only to callers that submit to the pool directly.
+class WorkerPool
+{
+public:
+  using Task = std::function<void()>;
+
+  // Zero threads means one per core.
+  explicit WorkerPool(std::size_t threads);
+  // Runs the tasks already queued, then joins the threads.
+  ~WorkerPool();
+
+  WorkerPool(const WorkerPool &) = delete;
+  WorkerPool &operator=(const WorkerPool &) = delete;
+
+  void submit(Task task);
+  std::size_t size() const { return threads_.size(); }
+  // Tasks taken from another worker's deque so far.
+  std::size_t steals() const { return steals_.load(std::memory_order_relaxed); }
+
+private:
+  struct Queue
+  {
+    std::mutex mtx;
+    std::deque<Task> tasks;
+  };
+
+  void work(std::size_t index);
+  bool pop(std::size_t index, Task &task);
+  bool steal(std::size_t victim, Task &task);
+
+  std::vector<std::unique_ptr<Queue>> queues_;
+  std::atomic<std::size_t> next_queue_{0};
+  // Tasks queued in any deque.
+  std::atomic<std::size_t> pending_{0};
+  std::atomic<std::size_t> steals_{0};
+
+  // Idle workers sleep here.
+  std::atomic<std::size_t> idle_{0};
+  std::mutex idle_mtx_;
+  std::condition_variable ready_;
+  bool stopping_{false};
+
+  std::vector<std::thread> threads_;
+};
+
+} // namespace join_server
@@ -0,0 +1,93 @@
+#include "join_server/background_save.hpp"
+
+#include <cerrno>
+#include <cstring>
+#include <new>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <utility>
+
+namespace join_server
+{
+
+BackgroundSaver::BackgroundSaver()
+{
+  void *shared = ::mmap(nullptr, sizeof(SnapshotProgress), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS,
+                        -1, 0);
+  if (shared == MAP_FAILED)
+    throw std::runtime_error(std::string("cannot map progress page: ") + std::strerror(errno));
+  progress_ = new (shared) SnapshotProgress();
+}
+
+BackgroundSaver::~BackgroundSaver()
+{
+  if (waiter_.joinable())
+    waiter_.join();
+  progress_->~SnapshotProgress();
+  ::munmap(progress_, sizeof(SnapshotProgress));
+}
+
+bool BackgroundSaver::start(const Writer &write, Finisher finish, Clock::time_point paused, std::string &error)
+{
+  std::lock_guard<std::mutex> lk(mtx_);
+  if (stats_.in_progress)
+  {
+    error = "background save already in progress";
+    return false;
+  }
+  if (waiter_.joinable())
+    waiter_.join();
+
+  progress_->rows_written.store(0, std::memory_order_relaxed);
+  progress_->rows_total.store(0, std::memory_order_relaxed);
+
+  const auto started = Clock::now();
+  const pid_t pid = ::fork();
+  if (pid < 0)
+  {
+    error = std::string("fork failed: ") + std::strerror(errno);
+    return false;
+  }
+  if (pid == 0)
+    ::_exit(write(*progress_) ? 0 : 1);
+
+  const auto forked = Clock::now();
+  stats_.in_progress = true;
+  stats_.last_fork_us =
+      static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(forked - paused).count());
+  waiter_ = std::thread(&BackgroundSaver::wait_child, this, pid, started, std::move(finish));
+  return true;
+}
+
+BackgroundSaveStats BackgroundSaver::stats() const
+{
+  std::lock_guard<std::mutex> lk(mtx_);
+  BackgroundSaveStats stats = stats_;
+  stats.rows_written = progress_->rows_written.load(std::memory_order_relaxed);
+  stats.rows_total = progress_->rows_total.load(std::memory_order_relaxed);
+  return stats;
+}
+
+void BackgroundSaver::wait_child(pid_t pid, Clock::time_point started, const Finisher &finish)
+{
+  int status = 0;
+  while (::waitpid(pid, &status, 0) < 0 && errno == EINTR)
+  {
+  }
+  const bool ok = WIFEXITED(status) && WEXITSTATUS(status) == 0 && (!finish || finish());
+
+  std::lock_guard<std::mutex> lk(mtx_);
+  stats_.in_progress = false;
+  stats_.last_ok = ok;
+  stats_.last_duration_ms = static_cast<std::uint64_t>(
+      std::chrono::duration_cast<std::chrono::milliseconds>(Clock::now() - started).count());
+  if (ok)
+    ++stats_.completed;
+  else
+    ++stats_.failed;
+}
+
+} // namespace join_server
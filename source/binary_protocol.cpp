@@ -0,0 +1,388 @@
+#include "join_server/binary_protocol.hpp"
+
+namespace
+{
+
+using join_server::binary::Opcode;
+using join_server::binary::Status;
+
+void store_u32(char *out, std::uint32_t value)
+{
+  out[0] = static_cast<char>(value);
+  out[1] = static_cast<char>(value >> 8);
+  out[2] = static_cast<char>(value >> 16);
+  out[3] = static_cast<char>(value >> 24);
+}
+
+void put_u32(std::string &out, std::uint32_t value)
+{
+  char bytes[4];
+  store_u32(bytes, value);
+  out.append(bytes, sizeof(bytes));
+}
+
+std::uint32_t get_u32(const char *data)
+{
+  const auto *bytes = reinterpret_cast<const unsigned char *>(data);
+  return static_cast<std::uint32_t>(bytes[0]) | static_cast<std::uint32_t>(bytes[1]) << 8 |
+         static_cast<std::uint32_t>(bytes[2]) << 16 | static_cast<std::uint32_t>(bytes[3]) << 24;
+}
+
+void put_varint(std::string &out, std::uint64_t value)
+{
+  char bytes[10];
+  std::size_t size = 0;
+  while (value >= 0x80)
+  {
+    bytes[size++] = static_cast<char>(value | 0x80);
+    value >>= 7;
+  }
+  bytes[size++] = static_cast<char>(value);
+  out.append(bytes, size);
+}
+
+std::size_t varint_size(std::uint64_t value)
+{
+  std::size_t size = 1;
+  for (; value >= 0x80; value >>= 7)
+    ++size;
+  return size;
+}
+
+bool get_varint(std::string_view &input, std::uint64_t &value)
+{
+  value = 0;
+  for (unsigned shift = 0; shift < 64 && !input.empty(); shift += 7)
+  {
+    const auto byte = static_cast<unsigned char>(input.front());
+    input.remove_prefix(1);
+    value |= static_cast<std::uint64_t>(byte & 0x7f) << shift;
+    if ((byte & 0x80) == 0)
+      return true;
+  }
+  return false;
+}
+
+// Starts a frame in `out`; finish_frame() fills in its length.
+std::size_t begin_frame(std::string &out, std::uint8_t code)
+{
+  const auto start = out.size();
+  put_u32(out, 0);
+  out.push_back(static_cast<char>(code));
+  return start;
+}
+
+void finish_frame(std::string &out, std::size_t start)
+{
+  store_u32(&out[start], static_cast<std::uint32_t>(out.size() - start - join_server::binary::kLengthBytes));
+}
+
+void encode_rows(std::string &out, const join_server::DataRow *rows, std::size_t count)
+{
+  const auto start = begin_frame(out, static_cast<std::uint8_t>(Status::Rows));
+  put_varint(out, count);
+  // Rows come in key order, so every gap after the first id is positive.
+  std::uint32_t previous = 0;
+  for (std::size_t i = 0; i < count; ++i)
+  {
+    const auto id = static_cast<std::uint32_t>(rows[i].id);
+    if (i == 0)
+      put_varint(out, (id << 1) ^ static_cast<std::uint32_t>(rows[i].id >> 31));
+    else
+      put_varint(out, id - previous);
+    previous = id;
+  }
+
+  std::size_t blob = 0;
+  for (std::size_t i = 0; i < count; ++i)
+  {
+    blob += varint_size(rows[i].from_a.size()) + rows[i].from_a.size();
+    blob += varint_size(rows[i].from_b.size()) + rows[i].from_b.size();
+  }
+  put_varint(out, blob);
+  for (std::size_t i = 0; i < count; ++i)
+  {
+    put_varint(out, rows[i].from_a.size());
+    out.append(rows[i].from_a);
+    put_varint(out, rows[i].from_b.size());
+    out.append(rows[i].from_b);
+  }
+  finish_frame(out, start);
+}
+
+bool decode_rows(std::string_view payload, std::vector<join_server::DataRow> &rows)
+{
+  std::uint64_t count = 0;
+  if (!get_varint(payload, count) || count > payload.size())
+    return false;
+  rows.resize(static_cast<std::size_t>(count));
+  std::uint32_t id = 0;
+  for (std::size_t i = 0; i < rows.size(); ++i)
+  {
+    std::uint64_t code = 0;
+    if (!get_varint(payload, code))
+      return false;
+    const auto value = static_cast<std::uint32_t>(code);
+    id = i == 0 ? (value >> 1) ^ (0u - (value & 1)) : id + value;
+    rows[i].id = static_cast<int>(id);
+  }
+
+  std::uint64_t blob = 0;
+  if (!get_varint(payload, blob) || blob != payload.size())
+    return false;
+  const auto take = [&payload](std::string_view &value)
+  {
+    std::uint64_t size = 0;
+    if (!get_varint(payload, size) || size > payload.size())
+      return false;
+    value = payload.substr(0, static_cast<std::size_t>(size));
+    payload.remove_prefix(static_cast<std::size_t>(size));
+    return true;
+  };
+  for (auto &row : rows)
+  {
+    if (!take(row.from_a) || !take(row.from_b))
+      return false;
+  }
+  return payload.empty();
+}
+
+bool parse_table(char code, join_server::TableId &table)
+{
+  if (code != 0 && code != 1)
+    return false;
+  table = code == 0 ? join_server::TableId::A : join_server::TableId::B;
+  return true;
+}
+
+bool is_scan_frame(std::string_view payload)
+{
+  if (payload.empty())
+    return false;
+  const auto opcode = static_cast<Opcode>(payload[0]);
+  return opcode == Opcode::Intersection || opcode == Opcode::SymmetricDifference ||
+         (opcode == Opcode::Text && join_server::is_scan_command(payload.substr(1)));
+}
+
+} // namespace
+
+namespace join_server
+{
+
+namespace binary
+{
+
+void encode_insert(std::string &out, TableId table, int id, std::string_view value)
+{
+  const auto start = begin_frame(out, static_cast<std::uint8_t>(Opcode::Insert));
+  out.push_back(table == TableId::A ? 0 : 1);
+  put_u32(out, static_cast<std::uint32_t>(id));
+  out.append(value);
+  finish_frame(out, start);
+}
+
+void encode_truncate(std::string &out, TableId table)
+{
+  const auto start = begin_frame(out, static_cast<std::uint8_t>(Opcode::Truncate));
+  out.push_back(table == TableId::A ? 0 : 1);
+  finish_frame(out, start);
+}
+
+void encode_join(std::string &out, JoinKind kind)
+{
+  const auto code = kind == JoinKind::Intersection ? Opcode::Intersection : Opcode::SymmetricDifference;
+  finish_frame(out, begin_frame(out, static_cast<std::uint8_t>(code)));
+}
+
+void encode_text(std::string &out, std::string_view line)
+{
+  const auto start = begin_frame(out, static_cast<std::uint8_t>(Opcode::Text));
+  out.append(line);
+  finish_frame(out, start);
+}
+
+bool decode_reply(std::string_view &input, Reply &reply)
+{
+  if (input.size() < kLengthBytes)
+    return false;
+  const auto length = get_u32(input.data());
+  if (length == 0 || input.size() - kLengthBytes < length)
+    return false;
+  auto payload = input.substr(kLengthBytes + 1, length - 1);
+  const auto status = static_cast<Status>(input[kLengthBytes]);
+
+  reply.status = status;
+  reply.text = {};
+  reply.rows.clear();
+  if (status == Status::Ok || status == Status::Error)
+    reply.text = payload;
+  else if (status != Status::Rows || !decode_rows(payload, reply.rows))
+    return false;
+  input.remove_prefix(kLengthBytes + length);
+  return true;
+}
+
+} // namespace binary
+
+BinaryProcessor::BinaryProcessor(TablesStore &store, CommandProcessor &text) : store_(store), text_(text) {}
+
+bool BinaryProcessor::execute(std::string_view input, ResponseBuffer &out, std::size_t &consumed, bool allow_scans)
+{
+  consumed = 0;
+  stopped_before_scan_ = false;
+  batch_.clear();
+  bool ok = true;
+  while (input.size() - consumed >= binary::kLengthBytes)
+  {
+    const auto length = get_u32(input.data() + consumed);
+    if (length > binary::kMaxRequestBytes)
+    {
+      flush_inserts(out);
+      reply(out, Status::Error, "frame too long");
+      ok = false;
+      break;
+    }
+    if (input.size() - consumed - binary::kLengthBytes < length)
+      break;
+
+    const auto payload = input.substr(consumed + binary::kLengthBytes, length);
+    if (!allow_scans && is_scan_frame(payload))
+    {
+      stopped_before_scan_ = true;
+      break;
+    }
+    consumed += binary::kLengthBytes + length;
+
+    // INSERT: opcode, table, 4-byte id, then the value.
+    InsertRow row{};
+    if (payload.size() > 6 && payload[0] == static_cast<char>(Opcode::Insert) && parse_table(payload[1], row.table))
+    {
+      row.id = static_cast<int>(get_u32(payload.data() + 2));
+      row.value = payload.substr(6);
+      batch_.push_back(row);
+      continue;
+    }
+    flush_inserts(out);
+    run_frame(payload, out);
+    if (join_.paused())
+      break;
+  }
+  flush_inserts(out);
+  return ok;
+}
+
+void BinaryProcessor::run_frame(std::string_view payload, ResponseBuffer &out)
+{
+  if (payload.empty())
+  {
+    reply(out, Status::Error, "empty frame");
+    return;
+  }
+
+  const auto opcode = static_cast<Opcode>(payload[0]);
+  payload.remove_prefix(1);
+  TableId table{};
+  switch (opcode)
+  {
+  case Opcode::Insert:
+    reply(out, Status::Error, "wrong frame format");
+    return;
+  case Opcode::Truncate:
+  {
+    if (payload.size() != 1 || !parse_table(payload[0], table))
+    {
+      reply(out, Status::Error, "wrong frame format");
+      return;
+    }
+    std::string error;
+    const bool ok = store_.truncate(table, error);
+    reply(out, ok ? Status::Ok : Status::Error, error);
+    return;
+  }
+  case Opcode::Intersection:
+  case Opcode::SymmetricDifference:
+    if (!payload.empty())
+    {
+      reply(out, Status::Error, "wrong frame format");
+      return;
+    }
+    run_join(opcode == Opcode::Intersection ? JoinKind::Intersection : JoinKind::SymmetricDifference, out);
+    return;
+  case Opcode::Text:
+    run_text(payload, out);
+    return;
+  }
+  reply(out, Status::Error, "unknown opcode");
+}
+
+void BinaryProcessor::run_join(JoinKind kind, ResponseBuffer &out)
+{
+  const auto emit = [this](const DataRow *rows, std::size_t count, ResponseBuffer &to)
+  { append_rows(rows, count, to); };
+  if (join_.start(store_, kind, out, emit))
+    reply(out, Status::Ok, {});
+}
+
+bool BinaryProcessor::resume_join(ResponseBuffer &out)
+{
+  if (!join_.paused())
+    return true;
+  const auto emit = [this](const DataRow *rows, std::size_t count, ResponseBuffer &to)
+  { append_rows(rows, count, to); };
+  if (!join_.resume(store_, out, emit))
+    return false;
+  reply(out, Status::Ok, {});
+  return true;
+}
+
+void BinaryProcessor::append_rows(const DataRow *rows, std::size_t count, ResponseBuffer &out)
+{
+  frame_.clear();
+  encode_rows(frame_, rows, count);
+  out.append(frame_);
+}
+
+void BinaryProcessor::run_text(std::string_view command_line, ResponseBuffer &out)
+{
+  // A whole join is streamed as ROWS frames rather than collected as text.
+  JoinKind kind{};
+  if (is_join_command(command_line, kind))
+  {
+    run_join(kind, out);
+    return;
+  }
+
+  text_reply_.clear();
+  const bool ok = text_.execute(command_line, text_reply_);
+  std::string_view text = text_reply_.data();
+  if (!text.empty() && text.back() == '\n')
+    text.remove_suffix(1);
+  if (!ok && text.substr(0, 4) == "ERR ")
+    text.remove_prefix(4);
+  if (ok && text == "OK")
+    text = {};
+  if (ok && text.size() > 3 && text.substr(text.size() - 3) == "\nOK")
+    text.remove_suffix(3);
+  reply(out, ok ? Status::Ok : Status::Error, text);
+}
+
+void BinaryProcessor::flush_inserts(ResponseBuffer &out)
+{
+  if (batch_.empty())
+    return;
+  store_.insert_batch(batch_, batch_errors_);
+  for (const auto &error : batch_errors_)
+    reply(out, error.empty() ? Status::Ok : Status::Error, error);
+  batch_.clear();
+}
+
+void BinaryProcessor::reply(ResponseBuffer &out, binary::Status status, std::string_view text)
+{
+  frame_.clear();
+  const auto start = begin_frame(frame_, static_cast<std::uint8_t>(status));
+  frame_.append(text);
+  finish_frame(frame_, start);
+  out.append(frame_);
+}
+
+} // namespace join_server
@@ -1,68 +1,148 @@
 #include "join_server/command.hpp"
 
+#include "join_server/csv_import.hpp"
+#include "join_server/scheduler.hpp"
+
 #include <algorithm>
-#include <cctype>
+#include <charconv>
 #include <limits>
-#include <sstream>
+#include <utility>
 
 namespace
 {
 
-std::string trim_copy(const std::string &value)
+constexpr std::size_t kJoinChunkRows = 1024;
+// Largest FETCH batch, which bounds the memory a cursor reply can take.
+constexpr int kMaxFetchRows = 100000;
+// Rows reserved up front for a LOAD block; larger blocks grow as they come.
+constexpr std::size_t kLoadReserve = 1 << 20;
+
+constexpr std::string_view kSpaces = " \t\n\v\f\r";
+
+std::string_view trim(std::string_view value)
 {
-  const auto first = value.find_first_not_of(" \t\r\n");
-  if (first == std::string::npos)
+  const auto first = value.find_first_not_of(kSpaces);
+  if (first == std::string_view::npos)
     return {};
-  const auto last = value.find_last_not_of(" \t\r\n");
+  const auto last = value.find_last_not_of(kSpaces);
   return value.substr(first, last - first + 1);
 }
 
-std::string to_upper_copy(std::string value)
+// Splits a command line into whitespace-separated tokens in place.
+class Tokenizer
+{
+public:
+  explicit Tokenizer(std::string_view line) : rest_(trim(line)) {}
+
+  // Next token, or an empty view once the line is used up.
+  std::string_view next()
+  {
+    const auto end = std::min(rest_.find_first_of(kSpaces), rest_.size());
+    const auto token = rest_.substr(0, end);
+    rest_ = trim(rest_.substr(end));
+    return token;
+  }
+
+  // Whatever follows the tokens read so far, trimmed.
+  std::string_view rest() const { return rest_; }
+  bool done() const { return rest_.empty(); }
+
+private:
+  std::string_view rest_;
+};
+
+// `keyword` is upper case.
+bool equals_keyword(std::string_view token, std::string_view keyword)
+{
+  if (token.size() != keyword.size())
+    return false;
+  for (std::size_t i = 0; i < token.size(); ++i)
+  {
+    const char ch = token[i];
+    if ((ch >= 'a' && ch <= 'z' ? static_cast<char>(ch - 'a' + 'A') : ch) != keyword[i])
+      return false;
+  }
+  return true;
+}
+
+bool is_scan_keyword(std::string_view token)
 {
-  std::transform(value.begin(), value.end(), value.begin(), [](unsigned char ch)
-                 { return static_cast<char>(std::toupper(ch)); });
-  return value;
+  return equals_keyword(token, "INTERSECTION") || equals_keyword(token, "SYMMETRIC_DIFFERENCE") ||
+         equals_keyword(token, "OPEN_INTERSECTION") || equals_keyword(token, "OPEN_SYMMETRIC_DIFFERENCE") ||
+         equals_keyword(token, "FETCH");
 }
 
-bool parse_table_id(const std::string &token, join_server::TableId &out, std::string &error)
+void append_class_stats(join_server::ResponseBuffer &out, const char *name, const join_server::TaskClassStats &stats)
 {
-  const auto normalized = to_upper_copy(token);
-  if (normalized == "A")
+  const std::string prefix = std::string("sched_") + name + "_";
+  const auto started = stats.completed + stats.running;
+  out.append_line(prefix + "queued " + std::to_string(stats.queued));
+  out.append_line(prefix + "running " + std::to_string(stats.running));
+  out.append_line(prefix + "completed " + std::to_string(stats.completed));
+  out.append_line(prefix + "wait_us_avg " + std::to_string(started == 0 ? 0 : stats.wait_us_total / started));
+  out.append_line(prefix + "wait_us_max " + std::to_string(stats.wait_us_max));
+}
+
+bool parse_table_id(std::string_view token, join_server::TableId &out, std::string &error)
+{
+  if (equals_keyword(token, "A"))
   {
     out = join_server::TableId::A;
     return true;
   }
-  if (normalized == "B")
+  if (equals_keyword(token, "B"))
   {
     out = join_server::TableId::B;
     return true;
   }
-  error = "unknown table " + token;
+  error = "unknown table " + std::string(token);
   return false;
 }
 
-bool parse_int(const std::string &token, int &out)
+bool parse_int(std::string_view token, int &out)
+{
+  // Keep accepting an explicit plus sign, which from_chars does not.
+  if (token.size() > 1 && token[0] == '+' && token[1] >= '0' && token[1] <= '9')
+    token.remove_prefix(1);
+  const auto *end = token.data() + token.size();
+  const auto [ptr, ec] = std::from_chars(token.data(), end, out);
+  return ec == std::errc() && ptr == end;
+}
+
+// Arguments of INSERT. Errors go to `out` when it is given.
+bool parse_insert(Tokenizer &tokens, join_server::InsertRow &row, join_server::ResponseBuffer *out)
 {
-  try
+  const auto table_token = tokens.next();
+  const auto id_token = tokens.next();
+  row.value = tokens.rest();
+  if (row.value.empty())
   {
-    size_t idx{};
-    const long value = std::stol(token, &idx, 10);
-    if (idx != token.size())
-      return false;
-    if (value < std::numeric_limits<int>::min() || value > std::numeric_limits<int>::max())
-      return false;
-    out = static_cast<int>(value);
-    return true;
+    if (out != nullptr)
+      out->append_error("wrong command format");
+    return false;
+  }
+
+  std::string error;
+  if (!parse_table_id(table_token, row.table, error))
+  {
+    if (out != nullptr)
+      out->append_error(error);
+    return false;
   }
-  catch (const std::exception &)
+
+  if (!parse_int(id_token, row.id))
   {
+    if (out != nullptr)
+      out->append_error("invalid id ", id_token);
     return false;
   }
+  return true;
 }
 
-std::string format_row(const join_server::DataRow &row)
+void append_rows(const join_server::DataRow *rows, std::size_t count, join_server::ResponseBuffer &out)
 {
-  return std::to_string(row.id) + ',' + row.from_a + ',' + row.from_b;
+  for (std::size_t i = 0; i < count && !out.failed(); ++i)
+    out.append_row(rows[i]);
 }
 
 } // namespace
@@ -70,135 +150,525 @@ std::string format_row(const join_server::DataRow &row)
 namespace join_server
 {
 
-CommandProcessor::CommandProcessor(TablesStore &store) : store_(store) {}
+ResponseBuffer::ResponseBuffer(Sink sink, Backlog backlog) : sink_(std::move(sink)), backlog_(std::move(backlog)) {}
 
-CommandOutput CommandProcessor::execute(const std::string &command_line)
+void ResponseBuffer::append_line(std::string_view text)
 {
-  CommandOutput output;
+  data_.append(text);
+  data_.push_back('\n');
+  flush_if_full();
+}
+
+void ResponseBuffer::append_row(const DataRow &row)
+{
+  char id[16];
+  const auto end = std::to_chars(id, id + sizeof(id), row.id).ptr;
+  data_.append(id, end);
+  data_.push_back(',');
+  data_.append(row.from_a);
+  data_.push_back(',');
+  data_.append(row.from_b);
+  data_.push_back('\n');
+  flush_if_full();
+}
+
+void ResponseBuffer::append_error(std::string_view what, std::string_view detail)
+{
+  data_.append("ERR ");
+  data_.append(what);
+  data_.append(detail);
+  data_.push_back('\n');
+  flush_if_full();
+}
+
+void ResponseBuffer::append(std::string_view bytes)
+{
+  data_.append(bytes);
+  flush_if_full();
+}
+
+bool ResponseBuffer::flush()
+{
+  if (!sink_)
+    return true;
+  if (!failed_ && !data_.empty())
+    failed_ = !sink_(data_);
+  data_.clear();
+  return !failed_;
+}
+
+void ResponseBuffer::flush_if_full()
+{
+  if (sink_ && data_.size() >= kFlushBytes)
+    flush();
+}
+
+bool JoinStream::start(const TablesStore &store, JoinKind kind, ResponseBuffer &out, const Emit &emit)
+{
+  kind_ = kind;
+  paused_ = false;
+  store.visit_join(kind, kJoinChunkRows,
+                   [&](const DataRow *rows, std::size_t count)
+                   {
+                     emit(rows, count, out);
+                     // Once the client is gone there is no point joining further.
+                     if (out.failed())
+                       return false;
+                     if (count == 0 || rows[count - 1].id == std::numeric_limits<int>::max() || !out.behind())
+                       return true;
+                     paused_ = true;
+                     next_ = rows[count - 1].id + 1;
+                     return false;
+                   });
+  return !paused_;
+}
 
-  const auto trimmed = trim_copy(command_line);
-  if (trimmed.empty())
+bool JoinStream::resume(const TablesStore &store, ResponseBuffer &out, const Emit &emit)
+{
+  while (paused_ && !out.failed())
   {
-    output.lines.push_back("ERR empty command");
-    return output;
+    JoinResult batch;
+    const bool more = store.join_batch(kind_, next_, kJoinChunkRows, batch);
+    if (!batch.rows.empty())
+      emit(batch.rows.data(), batch.size(), out);
+    if (!more)
+      break;
+    next_ = batch.rows.back().id + 1;
+    if (out.behind())
+      return false;
   }
+  paused_ = false;
+  return true;
+}
 
-  std::istringstream iss(trimmed);
-  std::string command_token;
-  iss >> command_token;
-  const auto command = to_upper_copy(command_token);
+bool is_scan_command(std::string_view command_line)
+{
+  Tokenizer tokens(command_line);
+  return is_scan_keyword(tokens.next());
+}
+
+bool is_join_command(std::string_view command_line, JoinKind &kind)
+{
+  Tokenizer tokens(command_line);
+  const auto keyword = tokens.next();
+  if (!tokens.done())
+    return false;
+  if (equals_keyword(keyword, "INTERSECTION"))
+    kind = JoinKind::Intersection;
+  else if (equals_keyword(keyword, "SYMMETRIC_DIFFERENCE"))
+    kind = JoinKind::SymmetricDifference;
+  else
+    return false;
+  return true;
+}
+
+CommandProcessor::CommandProcessor(TablesStore &store, const CommandScheduler *scheduler)
+    : store_(store), scheduler_(scheduler)
+{
+}
+
+bool CommandProcessor::execute(std::string_view command_line, ResponseBuffer &out)
+{
+  if (load_.active)
+    return load_row(command_line, out);
+
+  Tokenizer tokens(command_line);
+  if (tokens.done())
+  {
+    out.append_error("empty command");
+    return false;
+  }
 
-  if (command == "INSERT")
+  const auto command = tokens.next();
+  const auto is = [command](std::string_view keyword) { return equals_keyword(command, keyword); };
+
+  if (is("INSERT"))
   {
-    std::string table_token;
-    std::string id_token;
-    if (!(iss >> table_token >> id_token))
+    InsertRow row{};
+    if (!parse_insert(tokens, row, &out))
+      return false;
+
+    std::string error;
+    if (!store_.insert(row.table, row.id, row.value, error))
     {
-      output.lines.push_back("ERR wrong command format");
-      return output;
+      out.append_error(error);
+      return false;
     }
 
-    std::string name_token;
-    std::getline(iss, name_token);
-    name_token = trim_copy(name_token);
-    if (name_token.empty())
+    out.append_line("OK");
+    return true;
+  }
+
+  if (is("LOAD"))
+  {
+    const auto table_token = tokens.next();
+    const auto count_token = tokens.next();
+    if (count_token.empty() || !tokens.done())
     {
-      output.lines.push_back("ERR wrong command format");
-      return output;
+      out.append_error("wrong command format");
+      return false;
     }
 
     TableId table_id;
-    std::string table_error;
-    if (!parse_table_id(table_token, table_id, table_error))
+    std::string error;
+    if (!parse_table_id(table_token, table_id, error))
     {
-      output.lines.push_back("ERR " + table_error);
-      return output;
+      out.append_error(error);
+      return false;
     }
 
-    int id{};
-    if (!parse_int(id_token, id))
+    int count{};
+    if (!parse_int(count_token, count) || count < 0)
+    {
+      out.append_error("invalid count ", count_token);
+      return false;
+    }
+    if (count == 0)
+    {
+      out.append_line("OK");
+      return true;
+    }
+
+    // No reply until the last row of the block has arrived.
+    load_.active = true;
+    load_.table = table_id;
+    load_.remaining = static_cast<std::size_t>(count);
+    load_.ids.reserve(std::min(load_.remaining, kLoadReserve));
+    load_.ends.reserve(std::min(load_.remaining, kLoadReserve));
+    return true;
+  }
+
+  if (is("IMPORT"))
+  {
+    const auto table_token = tokens.next();
+    const auto path = tokens.rest();
+    if (path.empty())
     {
-      output.lines.push_back("ERR invalid id " + id_token);
-      return output;
+      out.append_error("wrong command format");
+      return false;
     }
 
+    TableId table_id;
     std::string error;
-    if (!store_.insert(table_id, id, name_token, error))
+    if (!parse_table_id(table_token, table_id, error))
     {
-      output.lines.push_back("ERR " + error);
-      return output;
+      out.append_error(error);
+      return false;
+    }
+    if (store_.import_dir().empty())
+    {
+      out.append_error("IMPORT is disabled");
+      return false;
     }
 
-    output.lines.push_back("OK");
-    output.success = true;
-    return output;
+    std::string resolved;
+    std::size_t rows = 0;
+    if (!resolve_import_path(store_.import_dir(), path, resolved, error) ||
+        !import_csv(store_, table_id, resolved, 0, rows, error, path))
+    {
+      out.append_error(error);
+      return false;
+    }
+    out.append_line("OK");
+    return true;
   }
 
-  if (command == "TRUNCATE")
+  if (is("TRUNCATE"))
   {
-    std::string table_token;
-    if (!(iss >> table_token))
+    const auto table_token = tokens.next();
+    if (table_token.empty() || !tokens.done())
     {
-      output.lines.push_back("ERR wrong command format");
-      return output;
+      out.append_error("wrong command format");
+      return false;
     }
 
-    std::string extra;
-    if (iss >> extra)
+    TableId table_id;
+    std::string error;
+    if (!parse_table_id(table_token, table_id, error))
     {
-      output.lines.push_back("ERR wrong command format");
-      return output;
+      out.append_error(error);
+      return false;
     }
 
-    TableId table_id;
-    std::string table_error;
-    if (!parse_table_id(table_token, table_id, table_error))
+    if (!store_.truncate(table_id, error))
+    {
+      out.append_error(error);
+      return false;
+    }
+    out.append_line("OK");
+    return true;
+  }
+
+  if (is("INTERSECTION") || is("SYMMETRIC_DIFFERENCE"))
+  {
+    if (!tokens.done())
+    {
+      out.append_error("wrong command format");
+      return false;
+    }
+
+    const auto kind = is("INTERSECTION") ? JoinKind::Intersection : JoinKind::SymmetricDifference;
+    if (join_.start(store_, kind, out, append_rows))
+      out.append_line("OK");
+    return true;
+  }
+
+  if (is("BINARY"))
+  {
+    if (!tokens.done())
+    {
+      out.append_error("wrong command format");
+      return false;
+    }
+    binary_ = true;
+    out.append_line("OK");
+    return true;
+  }
+
+  if (is("SNAPSHOT") || is("BGSAVE"))
+  {
+    if (!tokens.done())
+    {
+      out.append_error("wrong command format");
+      return false;
+    }
+
+    std::string error;
+    const bool ok = is("SNAPSHOT") ? store_.save_snapshot(error) : store_.background_save(error);
+    if (!ok)
+    {
+      out.append_error(error);
+      return false;
+    }
+    out.append_line("OK");
+    return true;
+  }
+
+  if (is("OPEN_INTERSECTION") || is("OPEN_SYMMETRIC_DIFFERENCE"))
+  {
+    if (!tokens.done())
     {
-      output.lines.push_back("ERR " + table_error);
-      return output;
+      out.append_error("wrong command format");
+      return false;
     }
 
-    store_.truncate(table_id);
-    output.lines.push_back("OK");
-    output.success = true;
-    return output;
+    // Opening again restarts the cursor from the first key.
+    cursor_.open = true;
+    cursor_.kind = is("OPEN_INTERSECTION") ? JoinKind::Intersection : JoinKind::SymmetricDifference;
+    cursor_.next = std::numeric_limits<int>::min();
+    out.append_line("OK");
+    return true;
   }
 
-  if (command == "INTERSECTION")
+  if (is("FETCH"))
   {
-    std::string extra;
-    if (iss >> extra)
+    const auto count_token = tokens.next();
+    if (count_token.empty() || !tokens.done())
+    {
+      out.append_error("wrong command format");
+      return false;
+    }
+
+    int count{};
+    if (!parse_int(count_token, count) || count < 1 || count > kMaxFetchRows)
+    {
+      out.append_error("invalid count ", count_token);
+      return false;
+    }
+    if (!cursor_.open)
     {
-      output.lines.push_back("ERR wrong command format");
-      return output;
+      out.append_error("no open cursor");
+      return false;
     }
 
-    const auto rows = store_.intersection();
-    for (const auto &row : rows)
-      output.lines.push_back(format_row(row));
-    output.lines.push_back("OK");
-    output.success = true;
-    return output;
+    JoinResult batch;
+    const bool more = store_.join_batch(cursor_.kind, cursor_.next, static_cast<std::size_t>(count), batch);
+    for (const auto &row : batch)
+      out.append_row(row);
+    if (more)
+    {
+      cursor_.next = batch.rows.back().id + 1;
+    }
+    else
+    {
+      // The last batch closes the cursor.
+      cursor_.open = false;
+      out.append_line("END");
+    }
+    out.append_line("OK");
+    return true;
   }
 
-  if (command == "SYMMETRIC_DIFFERENCE")
+  if (is("CLOSE"))
   {
-    std::string extra;
-    if (iss >> extra)
+    if (!tokens.done())
+    {
+      out.append_error("wrong command format");
+      return false;
+    }
+    if (!cursor_.open)
     {
-      output.lines.push_back("ERR wrong command format");
-      return output;
+      out.append_error("no open cursor");
+      return false;
     }
 
-    const auto rows = store_.symmetric_difference();
-    for (const auto &row : rows)
-      output.lines.push_back(format_row(row));
-    output.lines.push_back("OK");
-    output.success = true;
-    return output;
+    cursor_.open = false;
+    out.append_line("OK");
+    return true;
   }
 
-  output.lines.push_back("ERR unknown command " + command_token);
+  if (is("STATS"))
+  {
+    if (!tokens.done())
+    {
+      out.append_error("wrong command format");
+      return false;
+    }
+
+    const auto stats = store_.background_save_stats();
+    const char *last = stats.completed + stats.failed == 0 ? "none" : stats.last_ok ? "ok" : "failed";
+    out.append_line("bgsave_in_progress " + std::to_string(stats.in_progress ? 1 : 0));
+    out.append_line("bgsave_rows_written " + std::to_string(stats.rows_written));
+    out.append_line("bgsave_rows_total " + std::to_string(stats.rows_total));
+    out.append_line("bgsave_last_status " + std::string(last));
+    out.append_line("bgsave_last_fork_us " + std::to_string(stats.last_fork_us));
+    out.append_line("bgsave_last_duration_ms " + std::to_string(stats.last_duration_ms));
+    out.append_line("bgsave_completed " + std::to_string(stats.completed));
+    out.append_line("bgsave_failed " + std::to_string(stats.failed));
+    if (scheduler_ != nullptr)
+    {
+      const auto queues = scheduler_->stats();
+      append_class_stats(out, "write", queues.write);
+      append_class_stats(out, "scan", queues.scan);
+    }
+    out.append_line("OK");
+    return true;
+  }
+
+  out.append_error("unknown command ", command);
+  return false;
+}
+
+bool CommandProcessor::load_row(std::string_view line, ResponseBuffer &out)
+{
+  if (load_.error.empty())
+  {
+    Tokenizer tokens(line);
+    const auto id_token = tokens.next();
+    const auto name = tokens.rest();
+    int id{};
+    if (name.empty())
+    {
+      load_.error = "wrong row format";
+    }
+    else if (!parse_int(id_token, id))
+    {
+      load_.error = "invalid id " + std::string(id_token);
+    }
+    else
+    {
+      load_.ids.push_back(id);
+      load_.text.append(name);
+      load_.ends.push_back(load_.text.size());
+    }
+  }
+
+  if (--load_.remaining > 0)
+    return true;
+
+  Load load = std::move(load_);
+  load_ = Load{};
+  std::string error = load.error;
+  if (error.empty())
+  {
+    std::vector<FlatTable::Row> rows(load.ids.size());
+    std::size_t begin = 0;
+    for (std::size_t i = 0; i < rows.size(); ++i)
+    {
+      rows[i] = FlatTable::Row{load.ids[i], std::string_view(load.text).substr(begin, load.ends[i] - begin)};
+      begin = load.ends[i];
+    }
+    store_.load(load.table, std::move(rows), error);
+  }
+  if (!error.empty())
+  {
+    out.append_error(error);
+    return false;
+  }
+  out.append_line("OK");
+  return true;
+}
+
+bool CommandProcessor::resume_join(ResponseBuffer &out)
+{
+  if (!join_.paused())
+    return true;
+  if (!join_.resume(store_, out, append_rows))
+    return false;
+  out.append_line("OK");
+  return true;
+}
+
+std::size_t CommandProcessor::execute_batch(const std::vector<std::string_view> &lines, ResponseBuffer &out,
+                                            bool allow_scans)
+{
+  batch_.clear();
+  std::size_t done = 0;
+  for (; done < lines.size() && !binary_; ++done)
+  {
+    const auto line = lines[done];
+    if (!load_.active)
+    {
+      Tokenizer tokens(line);
+      const auto keyword = tokens.next();
+      InsertRow row{};
+      if (equals_keyword(keyword, "INSERT") && parse_insert(tokens, row, nullptr))
+      {
+        batch_.push_back(row);
+        continue;
+      }
+      if (!allow_scans && is_scan_keyword(keyword))
+        break;
+    }
+    flush_inserts(out);
+    execute(line, out);
+    if (join_.paused())
+    {
+      ++done;
+      break;
+    }
+  }
+  flush_inserts(out);
+  return done;
+}
+
+void CommandProcessor::flush_inserts(ResponseBuffer &out)
+{
+  if (batch_.empty())
+    return;
+  store_.insert_batch(batch_, batch_errors_);
+  for (const auto &error : batch_errors_)
+  {
+    if (error.empty())
+      out.append_line("OK");
+    else
+      out.append_error(error);
+  }
+  batch_.clear();
+}
+
+CommandOutput CommandProcessor::execute(std::string_view command_line)
+{
+  ResponseBuffer out;
+  CommandOutput output;
+  output.success = execute(command_line, out);
+  std::string_view text = out.data();
+  while (!text.empty())
+  {
+    const auto newline = text.find('\n');
+    output.lines.emplace_back(text.substr(0, newline));
+    text.remove_prefix(newline + 1);
+  }
   return output;
 }
 
@@ -0,0 +1,216 @@
+#include "join_server/csv_import.hpp"
+
+#include <cerrno>
+#include <charconv>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <memory>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+namespace
+{
+
+using join_server::FlatTable;
+
+// Smaller files are parsed on the calling thread.
+constexpr std::size_t kMinBytesPerThread = 1024 * 1024;
+
+struct Part
+{
+  std::string_view text;
+  std::vector<FlatTable::Row> rows;
+  std::size_t lines{0};
+  // First malformed line, counted from the start of the part.
+  std::size_t error_line{0};
+  std::string error;
+};
+
+void parse_part(Part &part)
+{
+  const char *cursor = part.text.data();
+  const char *const end = cursor + part.text.size();
+  while (cursor < end)
+  {
+    const auto *newline = static_cast<const char *>(std::memchr(cursor, '\n', static_cast<std::size_t>(end - cursor)));
+    const char *line_end = newline != nullptr ? newline : end;
+    ++part.lines;
+    std::string_view line(cursor, static_cast<std::size_t>(line_end - cursor));
+    cursor = line_end + 1;
+    if (!line.empty() && line.back() == '\r')
+      line.remove_suffix(1);
+    if (line.empty())
+      continue;
+
+    const auto comma = line.find(',');
+    if (comma == std::string_view::npos || comma + 1 == line.size())
+    {
+      part.error = "wrong row format";
+    }
+    else
+    {
+      int id{};
+      const auto [ptr, ec] = std::from_chars(line.data(), line.data() + comma, id);
+      if (ec == std::errc() && ptr == line.data() + comma)
+      {
+        part.rows.push_back(FlatTable::Row{id, line.substr(comma + 1)});
+        continue;
+      }
+      part.error = "invalid id";
+    }
+    part.error_line = part.lines;
+    return;
+  }
+}
+
+} // namespace
+
+namespace join_server
+{
+
+bool import_csv(TablesStore &store, TableId table, const std::string &path, std::size_t threads,
+                std::size_t &rows, std::string &error, std::string_view shown_as)
+{
+  rows = 0;
+  const std::string name(shown_as.empty() ? std::string_view(path) : shown_as);
+  const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+  {
+    error = "cannot open " + name + ": " + std::strerror(errno);
+    return false;
+  }
+  struct stat info = {};
+  if (::fstat(fd, &info) < 0)
+  {
+    error = "cannot stat " + name + ": " + std::strerror(errno);
+    ::close(fd);
+    return false;
+  }
+  const auto size = static_cast<std::size_t>(info.st_size);
+  if (size == 0)
+  {
+    ::close(fd);
+    return true;
+  }
+
+  void *addr = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  ::close(fd);
+  if (addr == MAP_FAILED)
+  {
+    error = "cannot map " + name + ": " + std::strerror(errno);
+    return false;
+  }
+  const std::shared_ptr<void> mapping(addr, [size](void *data) { ::munmap(data, size); });
+  ::madvise(addr, size, MADV_SEQUENTIAL);
+  const std::string_view text(static_cast<const char *>(addr), size);
+
+  if (threads == 0)
+    threads = std::max(1U, std::thread::hardware_concurrency());
+  threads = std::max<std::size_t>(1, std::min(threads, size / kMinBytesPerThread));
+
+  // Every part but the last ends just past a newline.
+  std::vector<Part> parts;
+  std::size_t begin = 0;
+  for (std::size_t t = 1; t <= threads && begin < size; ++t)
+  {
+    std::size_t end = size;
+    if (t < threads)
+    {
+      const auto newline = text.find('\n', std::max(begin, size * t / threads));
+      end = newline == std::string_view::npos ? size : newline + 1;
+    }
+    parts.push_back(Part{text.substr(begin, end - begin), {}, 0, 0, {}});
+    begin = end;
+  }
+
+  std::vector<std::thread> workers;
+  for (std::size_t i = 1; i < parts.size(); ++i)
+    workers.emplace_back([&parts, i]
+                         {
+                           parse_part(parts[i]);
+                           FlatTable::sort_rows(parts[i].rows);
+                         });
+  parse_part(parts[0]);
+  FlatTable::sort_rows(parts[0].rows);
+  for (auto &worker : workers)
+    worker.join();
+
+  std::size_t line = 0;
+  std::size_t total = 0;
+  for (const auto &part : parts)
+  {
+    if (!part.error.empty())
+    {
+      error = name + ":" + std::to_string(line + part.error_line) + ": " + part.error;
+      return false;
+    }
+    line += part.lines;
+    total += part.rows.size();
+  }
+
+  // Concatenate the sorted parts and merge neighbours pairwise.
+  std::vector<FlatTable::Row> merged;
+  merged.reserve(total);
+  std::vector<std::size_t> bounds{0};
+  for (auto &part : parts)
+  {
+    merged.insert(merged.end(), part.rows.begin(), part.rows.end());
+    bounds.push_back(merged.size());
+    std::vector<FlatTable::Row>().swap(part.rows);
+  }
+  const auto by_id = [](const FlatTable::Row &lhs, const FlatTable::Row &rhs) { return lhs.id < rhs.id; };
+  for (std::size_t width = 1; width + 1 < bounds.size(); width *= 2)
+  {
+    for (std::size_t i = 0; i + width + 1 < bounds.size(); i += 2 * width)
+    {
+      const std::size_t last = std::min(i + 2 * width, bounds.size() - 1);
+      std::inplace_merge(merged.begin() + static_cast<std::ptrdiff_t>(bounds[i]),
+                         merged.begin() + static_cast<std::ptrdiff_t>(bounds[i + width]),
+                         merged.begin() + static_cast<std::ptrdiff_t>(bounds[last]), by_id);
+    }
+  }
+
+  if (!store.load(table, std::move(merged), error))
+    return false;
+  rows = total;
+  return true;
+}
+
+bool resolve_import_path(const std::string &dir, std::string_view name, std::string &path, std::string &error)
+{
+  const std::string shown(name);
+  if (name.empty() || name.front() == '/')
+  {
+    error = "cannot open " + shown + ": expected a path inside the import directory";
+    return false;
+  }
+  const std::unique_ptr<char, decltype(&std::free)> root(::realpath(dir.c_str(), nullptr), &std::free);
+  if (root == nullptr)
+  {
+    error = std::string("import directory unavailable: ") + std::strerror(errno);
+    return false;
+  }
+  const std::unique_ptr<char, decltype(&std::free)> file(::realpath((dir + "/" + shown).c_str(), nullptr), &std::free);
+  if (file == nullptr)
+  {
+    error = "cannot open " + shown + ": " + std::strerror(errno);
+    return false;
+  }
+  const std::string prefix = std::string(root.get()) + (root.get()[1] == '\0' ? "" : "/");
+  if (std::strncmp(file.get(), prefix.c_str(), prefix.size()) != 0)
+  {
+    error = "cannot open " + shown + ": outside the import directory";
+    return false;
+  }
+  path = file.get();
+  return true;
+}
+
+} // namespace join_server
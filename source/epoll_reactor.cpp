@@ -0,0 +1,435 @@
+#include "join_server/epoll_reactor.hpp"
+
+#include "join_server/io_stats.hpp"
+
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <iostream>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+namespace
+{
+
+constexpr int kMaxEvents = 256;
+constexpr std::size_t kReadChunk = 16 * 1024;
+// Unprocessed input a connection may queue before the reactor stops reading
+// it; the worker reads the rest once it has caught up.
+constexpr std::size_t kMaxBufferedInput = 1024 * 1024;
+
+// Reply bytes the socket has not taken yet. Past kParkOutput a connection
+// runs no more commands until the reactor has written them out, and a join
+// pauses between chunks; past kMaxQueuedOutput, which only a single huge
+// non-join reply reaches, or once nothing has been written for kStallTimeout,
+// the connection is closed.
+constexpr std::size_t kParkOutput = 256 * 1024;
+constexpr std::size_t kMaxQueuedOutput = 64 * 1024 * 1024;
+constexpr std::chrono::seconds kStallTimeout{30};
+// How often the reactor looks for stalled connections.
+constexpr int kSweepIntervalMs = 1000;
+
+// Sends from the front of `data` until the socket is full. Returns false on
+// a socket error.
+bool send_some(int fd, std::string_view &data)
+{
+  while (!data.empty())
+  {
+    join_server::count_io_syscall();
+    const ssize_t sent = ::send(fd, data.data(), data.size(), MSG_NOSIGNAL);
+    if (sent >= 0)
+    {
+      data.remove_prefix(static_cast<std::size_t>(sent));
+      continue;
+    }
+    if (errno == EINTR)
+      continue;
+    return errno == EAGAIN || errno == EWOULDBLOCK;
+  }
+  return true;
+}
+
+} // namespace
+
+namespace join_server
+{
+
+struct EpollReactor::Connection
+{
+  using Clock = std::chrono::steady_clock;
+
+  Connection(int socket, TablesStore &store, const CommandScheduler &scheduler)
+      : fd(socket), session(store, &scheduler)
+  {
+  }
+  // Closed only here, so the descriptor cannot be reused while anyone may
+  // still read from it.
+  ~Connection() { ::close(fd); }
+
+  const int fd;
+  Session session;
+
+  // Guards everything below; held across each read so chunks append in order.
+  std::mutex mtx;
+  std::string input;
+  // A worker task owns the connection; at most one exists at a time.
+  bool scheduled{false};
+  bool throttled{false};
+  bool eof{false};
+  bool closed{false};
+  // The task gave up its worker until `output` drains, then `resume` runs.
+  bool parked{false};
+  TaskClass resume{TaskClass::Write};
+  // Closed by the client; the socket goes once `output` is written.
+  bool draining{false};
+
+  // Input the scheduled worker has taken but not run yet, e.g. half a line.
+  std::string pending;
+
+  // Replies the socket would not take, written by the reactor on EPOLLOUT.
+  std::string output;
+  // Last time `output` became non-empty or shrank.
+  Clock::time_point progress;
+
+  // Sends `data` behind whatever is queued. Returns false once the
+  // connection is closed or its queue is past kMaxQueuedOutput.
+  bool send(std::string_view data)
+  {
+    std::lock_guard<std::mutex> lk(mtx);
+    if (closed)
+      return false;
+    if (output.empty())
+    {
+      if (!send_some(fd, data))
+        return false;
+      progress = Clock::now();
+    }
+    output.append(data);
+    return output.size() <= kMaxQueuedOutput;
+  }
+
+  // Writes queued output until the socket is full; false on a socket error.
+  bool write_locked()
+  {
+    std::string_view rest = output;
+    if (!send_some(fd, rest))
+      return false;
+    if (rest.size() == output.size())
+      return true;
+    output.erase(0, output.size() - rest.size());
+    progress = Clock::now();
+    if (output.empty() && output.capacity() > kParkOutput)
+      output.shrink_to_fit();
+    return true;
+  }
+
+  // Reads until the socket is drained or the input is full.
+  void read_locked()
+  {
+    char chunk[kReadChunk];
+    while (!eof)
+    {
+      if (input.size() >= kMaxBufferedInput)
+      {
+        throttled = true;
+        return;
+      }
+      count_io_syscall();
+      const ssize_t received = ::recv(fd, chunk, sizeof(chunk), 0);
+      if (received > 0)
+      {
+        input.append(chunk, static_cast<std::size_t>(received));
+        continue;
+      }
+      if (received < 0 && errno == EINTR)
+        continue;
+      if (received < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        return;
+      eof = true;
+    }
+  }
+};
+
+EpollReactor::EpollReactor(int listener, TablesStore &store, CommandScheduler &scheduler)
+    : listener_(listener), store_(store), scheduler_(scheduler)
+{
+  const int flags = ::fcntl(listener_, F_GETFL, 0);
+  if (flags < 0 || ::fcntl(listener_, F_SETFL, flags | O_NONBLOCK) < 0)
+    throw std::runtime_error(std::string("fcntl failed: ") + std::strerror(errno));
+
+  epoll_fd_ = ::epoll_create1(EPOLL_CLOEXEC);
+  if (epoll_fd_ < 0)
+    throw std::runtime_error(std::string("epoll_create1 failed: ") + std::strerror(errno));
+
+  wake_fd_ = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  epoll_event listen_event{};
+  listen_event.events = EPOLLIN;
+  listen_event.data.fd = listener_;
+  epoll_event wake_event{};
+  wake_event.events = EPOLLIN;
+  wake_event.data.fd = wake_fd_;
+  if (wake_fd_ < 0 || ::epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, listener_, &listen_event) < 0 ||
+      ::epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, wake_fd_, &wake_event) < 0)
+  {
+    const auto err = std::string("cannot set up epoll: ") + std::strerror(errno);
+    if (wake_fd_ >= 0)
+      ::close(wake_fd_);
+    ::close(epoll_fd_);
+    throw std::runtime_error(err);
+  }
+}
+
+EpollReactor::~EpollReactor()
+{
+  while (tasks_.load() != 0)
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  ::close(wake_fd_);
+  ::close(epoll_fd_);
+}
+
+void EpollReactor::stop()
+{
+  const std::uint64_t one = 1;
+  while (::write(wake_fd_, &one, sizeof(one)) < 0 && errno == EINTR)
+  {
+  }
+}
+
+void EpollReactor::run()
+{
+  epoll_event events[kMaxEvents];
+  auto next_sweep = Connection::Clock::now();
+  for (;;)
+  {
+    count_io_syscall();
+    const int ready = ::epoll_wait(epoll_fd_, events, kMaxEvents, kSweepIntervalMs);
+    if (ready < 0)
+    {
+      if (errno == EINTR)
+        continue;
+      std::cerr << "epoll_wait failed: " << std::strerror(errno) << std::endl;
+      return;
+    }
+    const auto now = Connection::Clock::now();
+    if (now >= next_sweep)
+    {
+      close_stalled(now);
+      next_sweep = now + std::chrono::milliseconds(kSweepIntervalMs);
+    }
+
+    for (int i = 0; i < ready; ++i)
+    {
+      const int fd = events[i].data.fd;
+      if (fd == wake_fd_)
+        return;
+      if (fd == listener_)
+      {
+        accept_all();
+        continue;
+      }
+
+      std::shared_ptr<Connection> connection;
+      {
+        std::lock_guard<std::mutex> lk(connections_mtx_);
+        const auto it = connections_.find(fd);
+        if (it != connections_.end())
+          connection = it->second;
+      }
+      if (connection && (events[i].events & EPOLLOUT) != 0)
+        on_writable(connection);
+      if (connection && (events[i].events & ~static_cast<std::uint32_t>(EPOLLOUT)) != 0)
+        on_readable(connection);
+    }
+  }
+}
+
+void EpollReactor::accept_all()
+{
+  for (;;)
+  {
+    count_io_syscall();
+    const int fd = ::accept4(listener_, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (fd < 0)
+    {
+      if (errno == EINTR || errno == ECONNABORTED)
+        continue;
+      if (errno != EAGAIN && errno != EWOULDBLOCK)
+        std::cerr << "accept failed: " << std::strerror(errno) << std::endl;
+      return;
+    }
+
+    auto connection = std::make_shared<Connection>(fd, store_, scheduler_);
+    {
+      std::lock_guard<std::mutex> lk(connections_mtx_);
+      connections_[fd] = connection;
+    }
+    epoll_event event{};
+    event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+    event.data.fd = fd;
+    count_io_syscall();
+    if (::epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, fd, &event) < 0)
+    {
+      std::cerr << "epoll_ctl failed: " << std::strerror(errno) << std::endl;
+      drop(fd);
+    }
+  }
+}
+
+void EpollReactor::on_readable(const std::shared_ptr<Connection> &connection)
+{
+  std::lock_guard<std::mutex> lk(connection->mtx);
+  if (connection->closed || connection->throttled)
+    return;
+  connection->read_locked();
+  if (connection->scheduled || (connection->input.empty() && !connection->eof))
+    return;
+  connection->scheduled = true;
+  tasks_.fetch_add(1);
+  schedule(connection, TaskClass::Write);
+}
+
+void EpollReactor::on_writable(const std::shared_ptr<Connection> &connection)
+{
+  bool failed = false;
+  bool done = false;
+  {
+    std::lock_guard<std::mutex> lk(connection->mtx);
+    if (connection->closed && !connection->draining)
+      return;
+    failed = !connection->write_locked();
+    done = connection->draining && connection->output.empty();
+    if (!failed && connection->parked && connection->output.empty())
+    {
+      connection->parked = false;
+      tasks_.fetch_add(1);
+      schedule(connection, connection->resume);
+    }
+    if (failed)
+      connection->closed = true;
+  }
+  if (failed || done)
+    drop(connection->fd);
+}
+
+void EpollReactor::close_stalled(std::chrono::steady_clock::time_point now)
+{
+  std::vector<std::shared_ptr<Connection>> connections;
+  {
+    std::lock_guard<std::mutex> lk(connections_mtx_);
+    connections.reserve(connections_.size());
+    for (const auto &entry : connections_)
+      connections.push_back(entry.second);
+  }
+  for (const auto &connection : connections)
+  {
+    {
+      std::lock_guard<std::mutex> lk(connection->mtx);
+      if (connection->output.empty() || now - connection->progress < kStallTimeout)
+        continue;
+      // A running task fails its next send and stops.
+      connection->closed = true;
+      ::shutdown(connection->fd, SHUT_RDWR);
+    }
+    drop(connection->fd);
+  }
+}
+
+void EpollReactor::schedule(const std::shared_ptr<Connection> &connection, TaskClass task_class)
+{
+  scheduler_.submit(task_class, [this, connection, task_class] { process(connection, task_class); });
+}
+
+void EpollReactor::process(const std::shared_ptr<Connection> &connection, TaskClass task_class)
+{
+  auto &conn = *connection;
+  ResponseBuffer out([&conn](std::string_view data) { return conn.send(data); },
+                     [&conn]
+                     {
+                       std::lock_guard<std::mutex> lk(conn.mtx);
+                       return conn.output.size() > kParkOutput;
+                     });
+  bool open = true;
+  // A scan task first runs the join a write task stopped in front of.
+  bool run_pending = task_class == TaskClass::Scan;
+  for (;;)
+  {
+    {
+      std::lock_guard<std::mutex> lk(conn.mtx);
+      if (open && conn.throttled)
+      {
+        conn.throttled = false;
+        conn.read_locked();
+      }
+      if (open && conn.input.empty() && !conn.eof && !run_pending)
+      {
+        conn.scheduled = false;
+        if (conn.pending.empty())
+          conn.pending.shrink_to_fit();
+        tasks_.fetch_sub(1);
+        return;
+      }
+      if (!open || (conn.input.empty() && !run_pending))
+      {
+        conn.closed = true;
+        if (open && !conn.output.empty())
+        {
+          // The reactor drops the connection once the replies are out.
+          conn.draining = true;
+          tasks_.fetch_sub(1);
+          return;
+        }
+        break;
+      }
+      run_pending = false;
+      conn.pending.append(conn.input);
+      conn.input.clear();
+      // Sized for the next read, not for the largest one seen.
+      if (conn.input.capacity() > kReadChunk)
+        conn.input.shrink_to_fit();
+    }
+    open = conn.session.run(conn.pending, out, task_class == TaskClass::Scan);
+    open = out.flush() && open;
+    if (!open)
+      continue;
+    // Joins go through the scan queue, paused ones too; the slot is given
+    // back right after.
+    const auto next =
+        conn.session.stopped_before_scan() || conn.session.paused() ? TaskClass::Scan : TaskClass::Write;
+    {
+      // A client that does not read its replies holds up its own commands,
+      // not a worker.
+      std::lock_guard<std::mutex> lk(conn.mtx);
+      if (conn.output.size() > kParkOutput)
+      {
+        conn.parked = true;
+        conn.resume = next;
+        tasks_.fetch_sub(1);
+        return;
+      }
+    }
+    if (next == TaskClass::Scan || task_class == TaskClass::Scan)
+    {
+      schedule(connection, next);
+      return;
+    }
+  }
+  drop(conn.fd);
+  tasks_.fetch_sub(1);
+}
+
+void EpollReactor::drop(int fd)
+{
+  // The socket closes with the last reference to its connection.
+  std::lock_guard<std::mutex> lk(connections_mtx_);
+  connections_.erase(fd);
+}
+
+} // namespace join_server
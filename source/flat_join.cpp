@@ -0,0 +1,441 @@
+#include "join_server/flat_join.hpp"
+
+#include "join_server/set_ops.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <thread>
+
+namespace
+{
+
+using join_server::DataRow;
+using join_server::FlatTable;
+
+// Smaller joins are not worth the thread start-up cost.
+constexpr std::size_t kMinRowsPerThread = 64 * 1024;
+
+struct Range
+{
+  std::size_t begin_a;
+  std::size_t end_a;
+  std::size_t begin_b;
+  std::size_t end_b;
+};
+
+// Ids decoded per step from a packed or bitmap column. Plain columns are
+// scanned in place as one window, which keeps galloping effective on skewed
+// inputs.
+constexpr std::size_t kPackedWindow = 4096;
+
+// Sliding view of the ids of one run inside a range.
+class IdWindow
+{
+public:
+  IdWindow(const join_server::IdColumn &ids, std::size_t begin, std::size_t end) : ids_(ids), end_(end)
+  {
+    load(begin);
+  }
+
+  bool empty() const { return count_ == 0; }
+  std::size_t begin() const { return begin_; }
+  std::size_t size() const { return count_; }
+  const int *data() const { return data_; }
+  int operator[](std::size_t i) const { return data_[i]; }
+  int last() const { return data_[count_ - 1]; }
+
+  // Number of leading ids in the window that are <= key.
+  std::size_t count_up_to(int key) const
+  {
+    return static_cast<std::size_t>(std::upper_bound(data_, data_ + count_, key) - data_);
+  }
+
+  // Decoded ids are reused until the window runs low, then refilled.
+  void advance(std::size_t used)
+  {
+    if (plain() || used == 0 || count_ - used >= kPackedWindow / 4)
+    {
+      begin_ += used;
+      data_ += used;
+      count_ -= used;
+      if (count_ == 0)
+        load(begin_);
+      return;
+    }
+    load(begin_ + used);
+  }
+
+private:
+  void load(std::size_t pos)
+  {
+    begin_ = pos;
+    count_ = 0;
+    if (pos < end_)
+      count_ = ids_.window(pos, plain() ? end_ - pos : std::min(kPackedWindow, end_ - pos), data_, scratch_);
+  }
+
+  bool plain() const { return ids_.encoding() == join_server::IdColumn::Encoding::Plain; }
+
+  const join_server::IdColumn &ids_;
+  std::size_t end_;
+  std::size_t begin_{0};
+  std::size_t count_{0};
+  const int *data_{nullptr};
+  std::vector<int> scratch_;
+};
+
+template <typename Rows>
+void emit_matches(const FlatTable::Run &a, const FlatTable::Run &b, const IdWindow &wa, const IdWindow &wb,
+                  const std::vector<join_server::IndexPair> &matches, Rows &rows)
+{
+  rows.reserve(rows.size() + matches.size());
+  for (const auto &match : matches)
+    rows.push_back(DataRow{wa[match.a], a.value(wa.begin() + match.a), b.value(wb.begin() + match.b)});
+}
+
+// Rows between two consecutive matches exist on one side only, so the
+// symmetric difference is the ordered merge of those gaps.
+template <typename Rows>
+void emit_difference(const FlatTable::Run &a, const FlatTable::Run &b, const IdWindow &wa, std::size_t used_a,
+                     const IdWindow &wb, std::size_t used_b, const std::vector<join_server::IndexPair> &matches,
+                     Rows &rows)
+{
+  std::size_t i = 0;
+  std::size_t j = 0;
+  const auto emit_gap = [&](std::size_t end_a, std::size_t end_b)
+  {
+    while (i < end_a || j < end_b)
+    {
+      if (j == end_b || (i < end_a && wa[i] < wb[j]))
+      {
+        rows.push_back(DataRow{wa[i], a.value(wa.begin() + i), {}});
+        ++i;
+      }
+      else
+      {
+        rows.push_back(DataRow{wb[j], {}, b.value(wb.begin() + j)});
+        ++j;
+      }
+    }
+  };
+
+  for (const auto &match : matches)
+  {
+    emit_gap(match.a, match.b);
+    ++i;
+    ++j;
+  }
+  emit_gap(used_a, used_b);
+}
+
+// Word-wise joins pay for the whole id span, so they are used only when the
+// two bitmaps overlap rather than sit far apart.
+bool bitmaps(const FlatTable::Run &a, const FlatTable::Run &b)
+{
+  using Encoding = join_server::IdColumn::Encoding;
+  if (a.keys.encoding() != Encoding::Bitmap || b.keys.encoding() != Encoding::Bitmap || a.keys.empty() ||
+      b.keys.empty())
+    return false;
+
+  const std::int64_t first_a = a.keys.at(0);
+  const std::int64_t last_a = a.keys.at(a.keys.size() - 1);
+  const std::int64_t first_b = b.keys.at(0);
+  const std::int64_t last_b = b.keys.at(b.keys.size() - 1);
+  const std::int64_t span = std::max(last_a, last_b) - std::min(first_a, first_b);
+  return span <= 2 * ((last_a - first_a) + (last_b - first_b));
+}
+
+// Both id columns are bitmaps: the intersection is a word-wise AND, the
+// symmetric difference an XOR, and a row position is the running count of
+// set bits on its side.
+template <typename Rows>
+void join_bitmaps(join_server::JoinKind kind, const FlatTable::Run &a, const FlatTable::Run &b,
+                  const Range &range, Rows &rows)
+{
+  const bool has_a = range.begin_a < range.end_a;
+  const bool has_b = range.begin_b < range.end_b;
+  if (!has_a && !has_b)
+    return;
+
+  // Every id of either side inside [low, high] belongs to this range.
+  std::int64_t low = INT64_MAX;
+  std::int64_t high = INT64_MIN;
+  if (has_a)
+  {
+    low = a.keys.at(range.begin_a);
+    high = a.keys.at(range.end_a - 1);
+  }
+  if (has_b)
+  {
+    low = std::min<std::int64_t>(low, b.keys.at(range.begin_b));
+    high = std::max<std::int64_t>(high, b.keys.at(range.end_b - 1));
+  }
+
+  const std::int64_t first = low >> 6;
+  const std::int64_t last = high >> 6;
+  std::size_t pos_a = a.keys.lower_bound(static_cast<int>(first * 64));
+  std::size_t pos_b = b.keys.lower_bound(static_cast<int>(first * 64));
+  const bool intersection = kind == join_server::JoinKind::Intersection;
+
+  for (std::int64_t word = first; word <= last; ++word)
+  {
+    const std::uint64_t bits_a = a.keys.bitmap_word(word);
+    const std::uint64_t bits_b = b.keys.bitmap_word(word);
+    std::uint64_t mask = ~std::uint64_t{0};
+    if (word == first)
+      mask &= mask << (low & 63);
+    if (word == last)
+      mask &= ~std::uint64_t{0} >> (63 - (high & 63));
+
+    for (std::uint64_t bits = (intersection ? bits_a & bits_b : bits_a ^ bits_b) & mask; bits != 0;
+         bits &= bits - 1)
+    {
+      const auto bit = static_cast<unsigned>(__builtin_ctzll(bits));
+      const std::uint64_t before = (std::uint64_t{1} << bit) - 1;
+      const int id = static_cast<int>(word * 64 + bit);
+      const std::size_t i = pos_a + static_cast<std::size_t>(__builtin_popcountll(bits_a & before));
+      const std::size_t j = pos_b + static_cast<std::size_t>(__builtin_popcountll(bits_b & before));
+      if (intersection)
+        rows.push_back(DataRow{id, a.value(i), b.value(j)});
+      else if ((bits_a >> bit & 1) != 0)
+        rows.push_back(DataRow{id, a.value(i), {}});
+      else
+        rows.push_back(DataRow{id, {}, b.value(j)});
+    }
+    pos_a += static_cast<std::size_t>(__builtin_popcountll(bits_a));
+    pos_b += static_cast<std::size_t>(__builtin_popcountll(bits_b));
+  }
+}
+
+// Joins the two id windows and slides past every id that cannot match
+// anything further on: all ids up to the smaller of the two window maxima.
+// Values are resolved only for the rows that are emitted.
+template <typename Rows>
+void join_range(join_server::JoinKind kind, const FlatTable::Run &a, const FlatTable::Run &b,
+                const Range &range, Rows &rows)
+{
+  if (bitmaps(a, b))
+  {
+    join_bitmaps(kind, a, b, range, rows);
+    return;
+  }
+
+  IdWindow wa(a.keys, range.begin_a, range.end_a);
+  IdWindow wb(b.keys, range.begin_b, range.end_b);
+  std::vector<join_server::IndexPair> matches;
+  const bool difference = kind == join_server::JoinKind::SymmetricDifference;
+
+  while (!wa.empty() && !wb.empty())
+  {
+    matches.clear();
+    join_server::intersect_sorted(wa.data(), wa.size(), wb.data(), wb.size(), matches);
+
+    const int last_a = wa.last();
+    const int last_b = wb.last();
+    const std::size_t used_a = last_a <= last_b ? wa.size() : wa.count_up_to(last_b);
+    const std::size_t used_b = last_b <= last_a ? wb.size() : wb.count_up_to(last_a);
+    if (difference)
+      emit_difference(a, b, wa, used_a, wb, used_b, matches, rows);
+    else
+      emit_matches(a, b, wa, wb, matches, rows);
+    wa.advance(used_a);
+    wb.advance(used_b);
+  }
+
+  if (!difference)
+    return;
+  for (; !wa.empty(); wa.advance(wa.size()))
+    for (std::size_t i = 0; i < wa.size(); ++i)
+      rows.push_back(DataRow{wa[i], a.value(wa.begin() + i), {}});
+  for (; !wb.empty(); wb.advance(wb.size()))
+    for (std::size_t j = 0; j < wb.size(); ++j)
+      rows.push_back(DataRow{wb[j], {}, b.value(wb.begin() + j)});
+}
+
+// Row buffer for streamed joins: hands rows to the sink whenever `limit`
+// of them have been collected.
+class ChunkedRows
+{
+public:
+  ChunkedRows(std::size_t limit, const join_server::RowSink &sink) : limit_(limit), sink_(sink)
+  {
+    rows_.reserve(limit_);
+  }
+
+  std::size_t size() const { return rows_.size(); }
+  void reserve(std::size_t) {}
+
+  // Rows pushed after the sink asked to stop are dropped.
+  void push_back(const DataRow &row)
+  {
+    if (stopped_)
+      return;
+    rows_.push_back(row);
+    if (rows_.size() == limit_)
+      flush();
+  }
+
+  bool flush()
+  {
+    if (!rows_.empty() && !stopped_)
+      stopped_ = !sink_(rows_.data(), rows_.size());
+    rows_.clear();
+    return !stopped_;
+  }
+
+  bool stopped() const { return stopped_; }
+
+private:
+  std::size_t limit_;
+  const join_server::RowSink &sink_;
+  std::vector<DataRow> rows_;
+  bool stopped_{false};
+};
+
+// Splits both runs at keys sampled evenly from the larger one. A split key
+// lands in the same range on both sides, so ranges can be joined
+// independently.
+std::vector<Range> partition(const FlatTable::Run &a, const FlatTable::Run &b, std::size_t parts)
+{
+  const auto &sample = a.keys.size() >= b.keys.size() ? a.keys : b.keys;
+  std::vector<Range> ranges;
+  ranges.reserve(parts);
+
+  std::size_t begin_a = 0;
+  std::size_t begin_b = 0;
+  for (std::size_t part = 1; part < parts; ++part)
+  {
+    const int split = sample.at(sample.size() * part / parts);
+    const std::size_t end_a = a.keys.lower_bound(split);
+    const std::size_t end_b = b.keys.lower_bound(split);
+    if (end_a == begin_a && end_b == begin_b)
+      continue;
+    ranges.push_back(Range{begin_a, end_a, begin_b, end_b});
+    begin_a = end_a;
+    begin_b = end_b;
+  }
+  ranges.push_back(Range{begin_a, a.keys.size(), begin_b, b.keys.size()});
+  return ranges;
+}
+
+} // namespace
+
+namespace join_server
+{
+
+void join_runs(JoinKind kind, const FlatTable::Run &a, const FlatTable::Run &b, std::size_t threads,
+               std::vector<DataRow> &rows)
+{
+  const std::size_t total = a.keys.size() + b.keys.size();
+  threads = std::min(threads, total / kMinRowsPerThread);
+  if (threads <= 1)
+  {
+    join_range(kind, a, b, Range{0, a.keys.size(), 0, b.keys.size()}, rows);
+    return;
+  }
+
+  const auto ranges = partition(a, b, threads);
+  std::vector<std::vector<DataRow>> parts(ranges.size());
+  std::vector<std::thread> workers;
+  workers.reserve(ranges.size() - 1);
+  for (std::size_t i = 1; i < ranges.size(); ++i)
+    workers.emplace_back([&, i] { join_range(kind, a, b, ranges[i], parts[i]); });
+  join_range(kind, a, b, ranges[0], parts[0]);
+  for (auto &worker : workers)
+    worker.join();
+
+  std::size_t produced = rows.size();
+  for (const auto &part : parts)
+    produced += part.size();
+  rows.reserve(produced);
+  for (const auto &part : parts)
+    rows.insert(rows.end(), part.begin(), part.end());
+}
+
+bool join_runs_from(JoinKind kind, const FlatTable::Run &a, const FlatTable::Run &b, int from, std::size_t limit,
+                    std::vector<DataRow> &rows)
+{
+  const std::size_t size_a = a.keys.size();
+  const std::size_t size_b = b.keys.size();
+  std::size_t begin_a = a.keys.lower_bound(from);
+  std::size_t begin_b = b.keys.lower_bound(from);
+  const std::size_t first = rows.size();
+
+  // Each step joins the next `limit` ids of both sides, cut at the smaller
+  // of the two keys that follow, so that no id of the step is missing from
+  // either side.
+  while (rows.size() - first < limit && (begin_a < size_a || begin_b < size_b))
+  {
+    const std::size_t step = std::max<std::size_t>(limit - (rows.size() - first), 64);
+    std::size_t end_a = std::min(size_a, begin_a + step);
+    std::size_t end_b = std::min(size_b, begin_b + step);
+    if (end_a < size_a || end_b < size_b)
+    {
+      const int split = end_a == size_a   ? b.keys.at(end_b)
+                        : end_b == size_b ? a.keys.at(end_a)
+                                          : std::min(a.keys.at(end_a), b.keys.at(end_b));
+      end_a = a.keys.lower_bound(split);
+      end_b = b.keys.lower_bound(split);
+    }
+    join_range(kind, a, b, Range{begin_a, end_a, begin_b, end_b}, rows);
+    begin_a = end_a;
+    begin_b = end_b;
+  }
+
+  if (rows.size() - first > limit)
+  {
+    rows.resize(first + limit);
+    return true;
+  }
+  return begin_a < size_a || begin_b < size_b;
+}
+
+bool visit_runs(JoinKind kind, const FlatTable::Run &a, const FlatTable::Run &b, std::size_t threads,
+                std::size_t chunk_rows, const RowSink &sink)
+{
+  chunk_rows = std::max<std::size_t>(1, chunk_rows);
+  const std::size_t total = a.keys.size() + b.keys.size();
+  threads = std::min(threads, total / kMinRowsPerThread);
+  // Ranges of about kMinRowsPerThread input rows, so a sink that stops early
+  // leaves at most one range, or one batch of them, joined for nothing.
+  const auto ranges = partition(a, b, std::max<std::size_t>(1, total / kMinRowsPerThread));
+  if (threads <= 1)
+  {
+    ChunkedRows rows(chunk_rows, sink);
+    for (const auto &range : ranges)
+    {
+      join_range(kind, a, b, range, rows);
+      if (rows.stopped())
+        return false;
+    }
+    return rows.flush();
+  }
+
+  // Ranges are joined `threads` at a time and streamed in order, so only one
+  // batch of results is buffered.
+  std::vector<std::vector<DataRow>> parts(threads);
+  for (std::size_t first = 0; first < ranges.size(); first += threads)
+  {
+    const std::size_t count = std::min(threads, ranges.size() - first);
+    std::vector<std::thread> workers;
+    workers.reserve(count - 1);
+    for (std::size_t i = 1; i < count; ++i)
+      workers.emplace_back([&, i] { join_range(kind, a, b, ranges[first + i], parts[i]); });
+    join_range(kind, a, b, ranges[first], parts[0]);
+    for (auto &worker : workers)
+      worker.join();
+
+    for (std::size_t i = 0; i < count; ++i)
+    {
+      for (std::size_t done = 0; done < parts[i].size(); done += chunk_rows)
+      {
+        if (!sink(parts[i].data() + done, std::min(chunk_rows, parts[i].size() - done)))
+          return false;
+      }
+      parts[i].clear();
+    }
+  }
+  return true;
+}
+
+} // namespace join_server
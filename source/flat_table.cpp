@@ -0,0 +1,390 @@
+#include "join_server/flat_table.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <numeric>
+#include <utility>
+
+namespace
+{
+
+constexpr std::size_t kMinPendingRows = 1024;
+// A pending buffer holds at most 1/kPendingRatio of the sorted part before it
+// is sealed and merged, so merges stay linear in the rows inserted overall.
+constexpr std::size_t kPendingRatio = 8;
+
+std::size_t pending_limit(std::size_t sorted_rows)
+{
+  return std::max(kMinPendingRows, sorted_rows / kPendingRatio);
+}
+
+std::shared_ptr<const join_server::FlatTable::Run> empty_run(std::shared_ptr<const join_server::ValueArena> arena)
+{
+  auto run = std::make_shared<join_server::FlatTable::Run>();
+  run->arena = std::move(arena);
+  return run;
+}
+
+// Below this size std::sort beats two counting passes over 64K buckets.
+constexpr std::size_t kMinRadixRows = 64 * 1024;
+
+// Runs at least this large are rarely rebuilt, so packing their ids pays off.
+constexpr std::size_t kMinPackedRows = 64 * 1024;
+// Ids decoded per step while scanning a packed run.
+constexpr std::size_t kScanWindow = 1024;
+// Runs whose ids fill at least 1/kMaxBitmapSparsity of their range are kept
+// as bitmaps, which then cost at most a quarter of a plain column.
+constexpr std::size_t kMinBitmapRows = 4096;
+constexpr std::int64_t kMaxBitmapSparsity = 8;
+
+join_server::IdColumn seal_ids(std::vector<int> keys, bool compress_ids)
+{
+  if (keys.size() >= kMinBitmapRows)
+  {
+    const std::int64_t span = static_cast<std::int64_t>(keys.back()) - keys.front() + 1;
+    if (span <= kMaxBitmapSparsity * static_cast<std::int64_t>(keys.size()))
+      return join_server::IdColumn::bitmap(keys);
+  }
+  if (compress_ids && keys.size() >= kMinPackedRows)
+    return join_server::IdColumn::pack(keys);
+  return join_server::IdColumn(std::move(keys));
+}
+
+// Merges `count` rows, given in key order by `key(j)` and `ref(j)`, into a
+// copy of `base`. None of the keys may already be in `base`.
+template <typename Key, typename Ref>
+std::shared_ptr<join_server::FlatTable::Run> merge_sorted(const join_server::FlatTable::Run &base,
+                                                          std::size_t count, Key key, Ref ref, bool compress_ids)
+{
+  const std::size_t base_size = base.keys.size();
+  std::vector<int> keys;
+  keys.reserve(base_size + count);
+  std::vector<join_server::ValueArena::Ref> values;
+  values.reserve(base_size + count);
+
+  std::vector<int> scratch;
+  const int *window = nullptr;
+  std::size_t window_begin = 0;
+  std::size_t window_size = base.keys.window(0, kScanWindow, window, scratch);
+
+  std::size_t i = 0;
+  std::size_t j = 0;
+  while (i < base_size || j < count)
+  {
+    if (i == window_begin + window_size)
+    {
+      window_begin = i;
+      window_size = base.keys.window(i, kScanWindow, window, scratch);
+    }
+    if (j == count || (i < base_size && window[i - window_begin] < key(j)))
+    {
+      keys.push_back(window[i - window_begin]);
+      values.push_back(base.values[i]);
+      ++i;
+      continue;
+    }
+    keys.push_back(key(j));
+    values.push_back(ref(j));
+    ++j;
+  }
+
+  auto merged = std::make_shared<join_server::FlatTable::Run>();
+  merged->keys = seal_ids(std::move(keys), compress_ids);
+  merged->values = join_server::RefColumn(std::move(values));
+  merged->arena = base.arena;
+  return merged;
+}
+
+// Merges the first `sealed_count` rows of `sealed` and the first `count` of
+// `delta` into a copy of `base`. Values are arena references, so only ids and
+// 8-byte handles are copied.
+template <typename DeltaT>
+std::shared_ptr<join_server::FlatTable::Run> merge_run(const join_server::FlatTable::Run &base, const DeltaT *sealed,
+                                                       std::size_t sealed_count, const DeltaT *delta, std::size_t count,
+                                                       bool compress_ids)
+{
+  const auto key = [&](std::size_t k) { return k < sealed_count ? sealed->keys[k] : delta->keys[k - sealed_count]; };
+  const auto ref = [&](std::size_t k)
+  { return k < sealed_count ? sealed->values[k] : delta->values[k - sealed_count]; };
+
+  std::vector<std::size_t> order(sealed_count + count);
+  std::iota(order.begin(), order.end(), std::size_t{0});
+  std::sort(order.begin(), order.end(), [&key](std::size_t lhs, std::size_t rhs) { return key(lhs) < key(rhs); });
+  return merge_sorted(
+      base, order.size(), [&](std::size_t j) { return key(order[j]); }, [&](std::size_t j) { return ref(order[j]); },
+      compress_ids);
+}
+
+} // namespace
+
+namespace join_server
+{
+
+FlatTable::Delta::Delta(std::size_t capacity) : keys(capacity), values(capacity) {}
+
+FlatTable::FlatTable(bool compress_ids) : compress_ids_(compress_ids), arena_(std::make_shared<ValueArena>())
+{
+  current_ = std::make_shared<const Version>(
+      Version{empty_run(arena_), nullptr, std::make_shared<Delta>(kMinPendingRows)});
+}
+
+bool FlatTable::insert(int id, std::string_view value, std::string_view *stored)
+{
+  std::shared_ptr<const Version> to_merge;
+  {
+    std::lock_guard<std::mutex> lk(write_mtx_);
+    auto version = load();
+    if (contains(*version, id))
+      return false;
+
+    const auto ref = append(version, id, value, to_merge);
+    if (stored != nullptr)
+      *stored = arena_->get(ref);
+  }
+  if (to_merge != nullptr)
+    merge_sealed(to_merge);
+  return true;
+}
+
+void FlatTable::insert_many(const std::vector<Row> &rows, std::vector<bool> &inserted)
+{
+  inserted.assign(rows.size(), false);
+  std::size_t next = 0;
+  while (next < rows.size())
+  {
+    std::shared_ptr<const Version> to_merge;
+    {
+      std::lock_guard<std::mutex> lk(write_mtx_);
+      auto version = load();
+      for (; next < rows.size() && to_merge == nullptr; ++next)
+      {
+        if (contains(*version, rows[next].id))
+          continue;
+        append(version, rows[next].id, rows[next].value, to_merge);
+        inserted[next] = true;
+      }
+    }
+    if (to_merge != nullptr)
+      merge_sealed(to_merge);
+  }
+}
+
+bool FlatTable::contains(const Version &version, int id) const
+{
+  return version.base->keys.contains(id) || pending_index_.count(id) != 0 || sealed_index_.count(id) != 0;
+}
+
+ValueArena::Ref FlatTable::append(std::shared_ptr<const Version> &version, int id, std::string_view value,
+                                  std::shared_ptr<const Version> &to_merge)
+{
+  const std::size_t capacity = version->delta->keys.size();
+  if (version->delta->size.load(std::memory_order_relaxed) == capacity)
+  {
+    // Only one buffer is merged at a time; while it is, the next one grows.
+    const std::size_t sorted_rows = version->base->keys.size();
+    if (version->sealed == nullptr && capacity >= pending_limit(sorted_rows))
+    {
+      auto delta = std::make_shared<Delta>(pending_limit(sorted_rows + capacity));
+      version = std::make_shared<const Version>(Version{version->base, version->delta, std::move(delta)});
+      sealed_index_.swap(pending_index_);
+      to_merge = version;
+    }
+    else
+    {
+      version = grow(*version);
+    }
+    publish(version);
+  }
+  auto &delta = *version->delta;
+  const std::size_t slot = delta.size.load(std::memory_order_relaxed);
+  const auto ref = arena_->intern(value);
+  delta.keys[slot] = id;
+  delta.values[slot] = ref;
+  delta.size.store(slot + 1, std::memory_order_release);
+  pending_index_.insert(id);
+  return ref;
+}
+
+void FlatTable::sort_rows(std::vector<Row> &rows)
+{
+  const auto by_id = [](const Row &lhs, const Row &rhs) { return lhs.id < rhs.id; };
+  if (std::is_sorted(rows.begin(), rows.end(), by_id))
+    return;
+  if (rows.size() < kMinRadixRows)
+  {
+    std::sort(rows.begin(), rows.end(), by_id);
+    return;
+  }
+
+  // LSD radix sort in two 16-bit digits; the sign bit is flipped so that
+  // negative ids come first.
+  std::vector<Row> buffer(rows.size());
+  std::vector<std::size_t> offsets(1 << 16);
+  for (const unsigned shift : {0U, 16U})
+  {
+    const auto digit = [shift](int id) { return ((static_cast<std::uint32_t>(id) ^ 0x80000000U) >> shift) & 0xFFFFU; };
+    std::fill(offsets.begin(), offsets.end(), 0);
+    for (const auto &row : rows)
+      ++offsets[digit(row.id)];
+    std::size_t next = 0;
+    for (auto &offset : offsets)
+      next += std::exchange(offset, next);
+    for (const auto &row : rows)
+      buffer[offsets[digit(row.id)]++] = row;
+    rows.swap(buffer);
+  }
+}
+
+bool FlatTable::insert_sorted(const std::vector<Row> &rows, int &duplicate)
+{
+  std::lock_guard<std::mutex> lk(write_mtx_);
+  const auto version = load();
+  Snapshot base = version->base;
+  const std::size_t pending = version->delta->size.load(std::memory_order_relaxed);
+  const std::size_t sealed = version->sealed != nullptr ? version->sealed->size.load(std::memory_order_relaxed) : 0;
+  if (pending + sealed > 0)
+    base = merge_run(*base, version->sealed.get(), sealed, version->delta.get(), pending, compress_ids_);
+
+  for (const auto &row : rows)
+  {
+    if (base->keys.contains(row.id))
+    {
+      duplicate = row.id;
+      return false;
+    }
+  }
+
+  auto merged = merge_sorted(
+      *base, rows.size(), [&](std::size_t j) { return rows[j].id; },
+      [&](std::size_t j) { return arena_->intern(rows[j].value); }, compress_ids_);
+  const std::size_t limit = pending_limit(merged->keys.size());
+  publish(std::make_shared<const Version>(Version{std::move(merged), nullptr, std::make_shared<Delta>(limit)}));
+  pending_index_.clear();
+  sealed_index_.clear();
+  return true;
+}
+
+void FlatTable::clear()
+{
+  std::lock_guard<std::mutex> lk(write_mtx_);
+  arena_ = std::make_shared<ValueArena>();
+  publish(std::make_shared<const Version>(
+      Version{empty_run(arena_), nullptr, std::make_shared<Delta>(kMinPendingRows)}));
+  pending_index_.clear();
+  sealed_index_.clear();
+}
+
+void FlatTable::reset(std::shared_ptr<ValueArena> arena, Snapshot run)
+{
+  std::lock_guard<std::mutex> lk(write_mtx_);
+  arena_ = std::move(arena);
+  const std::size_t limit = pending_limit(run->keys.size());
+  publish(std::make_shared<const Version>(Version{std::move(run), nullptr, std::make_shared<Delta>(limit)}));
+  pending_index_.clear();
+  sealed_index_.clear();
+}
+
+FlatTable::Snapshot FlatTable::snapshot() const
+{
+  const auto version = load();
+  const std::size_t count = version->delta->size.load(std::memory_order_acquire);
+  const std::size_t sealed = version->sealed != nullptr ? version->sealed->size.load(std::memory_order_acquire) : 0;
+  if (count + sealed == 0)
+    return version->base;
+
+  // Merge outside the writer lock, then hand the result back to the table so
+  // later readers do not repeat the work.
+  Snapshot merged =
+      merge_run(*version->base, version->sealed.get(), sealed, version->delta.get(), count, compress_ids_);
+  fold(version, count, merged);
+  return merged;
+}
+
+std::size_t FlatTable::size() const
+{
+  const auto version = load();
+  return version->base->keys.size() + buffered(*version);
+}
+
+std::size_t FlatTable::buffered() const
+{
+  return buffered(*load());
+}
+
+std::size_t FlatTable::buffered(const Version &version)
+{
+  const std::size_t sealed = version.sealed != nullptr ? version.sealed->size.load(std::memory_order_acquire) : 0;
+  return sealed + version.delta->size.load(std::memory_order_acquire);
+}
+
+std::shared_ptr<const ValueArena> FlatTable::arena() const
+{
+  std::lock_guard<std::mutex> lk(write_mtx_);
+  return arena_;
+}
+
+std::shared_ptr<const FlatTable::Version> FlatTable::load() const
+{
+  return std::atomic_load(&current_);
+}
+
+void FlatTable::publish(std::shared_ptr<const Version> version) const
+{
+  std::atomic_store(&current_, std::move(version));
+}
+
+std::shared_ptr<const FlatTable::Version> FlatTable::grow(const Version &version) const
+{
+  // Copying the buffered rows is linear in the buffer only; merging them into
+  // the sorted part is left to the next snapshot().
+  const auto &old_delta = *version.delta;
+  const std::size_t count = old_delta.size.load(std::memory_order_relaxed);
+  auto delta = std::make_shared<Delta>(2 * old_delta.keys.size());
+  std::copy_n(old_delta.keys.begin(), count, delta->keys.begin());
+  std::copy_n(old_delta.values.begin(), count, delta->values.begin());
+  delta->size.store(count, std::memory_order_relaxed);
+  return std::make_shared<const Version>(Version{version.base, version.sealed, std::move(delta)});
+}
+
+void FlatTable::merge_sealed(const std::shared_ptr<const Version> &seen) const
+{
+  const auto &sealed = *seen->sealed;
+  Snapshot merged = merge_run(*seen->base, &sealed, sealed.size.load(std::memory_order_acquire),
+                              static_cast<const Delta *>(nullptr), 0, compress_ids_);
+
+  // Declared before the lock so that the old index is freed after it.
+  std::unordered_set<int> dropped;
+  std::lock_guard<std::mutex> lk(write_mtx_);
+  const auto current = load();
+  if (current->sealed != seen->sealed)
+    return; // a reader folded it first, or the table was reset
+
+  dropped.swap(sealed_index_);
+  publish(std::make_shared<const Version>(Version{std::move(merged), nullptr, current->delta}));
+}
+
+void FlatTable::fold(const std::shared_ptr<const Version> &seen, std::size_t folded, Snapshot merged) const
+{
+  std::unordered_set<int> dropped_pending;
+  std::unordered_set<int> dropped_sealed;
+  std::lock_guard<std::mutex> lk(write_mtx_);
+  if (load() != seen)
+    return; // a writer or another reader already moved on
+
+  // Rows appended after our merge started stay buffered.
+  const auto &old_delta = *seen->delta;
+  const std::size_t total = old_delta.size.load(std::memory_order_relaxed);
+  auto delta = std::make_shared<Delta>(std::max(pending_limit(merged->keys.size()), total - folded + 1));
+  dropped_pending.swap(pending_index_);
+  dropped_sealed.swap(sealed_index_);
+  for (std::size_t i = folded; i < total; ++i)
+  {
+    delta->keys[i - folded] = old_delta.keys[i];
+    delta->values[i - folded] = old_delta.values[i];
+    pending_index_.insert(old_delta.keys[i]);
+  }
+  delta->size.store(total - folded, std::memory_order_relaxed);
+  publish(std::make_shared<const Version>(Version{std::move(merged), nullptr, std::move(delta)}));
+}
+
+} // namespace join_server
@@ -0,0 +1,315 @@
+#include "join_server/id_column.hpp"
+
+#include <algorithm>
+#include <iterator>
+
+namespace
+{
+
+// Words per rank directory entry.
+constexpr std::size_t kRankStride = 16;
+
+unsigned bit_width(std::uint32_t value)
+{
+  return value == 0 ? 0U : 32U - static_cast<unsigned>(__builtin_clz(value));
+}
+
+// Gap between neighbouring ids minus one, so consecutive ids cost no bits.
+std::uint32_t gap(int prev, int next)
+{
+  return static_cast<std::uint32_t>(static_cast<std::int64_t>(next) - prev - 1);
+}
+
+void write_bits(std::vector<std::uint64_t> &words, std::uint64_t pos, unsigned width, std::uint64_t value)
+{
+  const auto word = static_cast<std::size_t>(pos >> 6);
+  const auto shift = static_cast<unsigned>(pos & 63);
+  words[word] |= value << shift;
+  if (shift + width > 64)
+    words[word + 1] |= value >> (64 - shift);
+}
+
+std::uint64_t below(unsigned bit)
+{
+  return (std::uint64_t{1} << bit) - 1;
+}
+
+unsigned popcount(std::uint64_t word)
+{
+  return static_cast<unsigned>(__builtin_popcountll(word));
+}
+
+std::uint32_t read_bits(const std::vector<std::uint64_t> &words, std::uint64_t pos, unsigned width)
+{
+  const auto word = static_cast<std::size_t>(pos >> 6);
+  const auto shift = static_cast<unsigned>(pos & 63);
+  std::uint64_t value = words[word] >> shift;
+  if (shift + width > 64)
+    value |= words[word + 1] << (64 - shift);
+  return static_cast<std::uint32_t>(value & ((std::uint64_t{1} << width) - 1));
+}
+
+} // namespace
+
+namespace join_server
+{
+
+IdColumn::IdColumn(std::vector<int> ids) : size_(ids.size()), plain_(std::move(ids)) {}
+
+IdColumn IdColumn::pack(const std::vector<int> &ids)
+{
+  IdColumn column;
+  column.encoding_ = Encoding::Packed;
+  column.size_ = ids.size();
+
+  const std::size_t blocks = (ids.size() + kBlockSize - 1) / kBlockSize;
+  column.heads_.reserve(blocks);
+  column.widths_.reserve(blocks);
+  column.bit_offsets_.reserve(blocks);
+
+  std::uint64_t bits = 0;
+  for (std::size_t begin = 0; begin < ids.size(); begin += kBlockSize)
+  {
+    const std::size_t end = std::min(ids.size(), begin + kBlockSize);
+    std::uint32_t widest = 0;
+    for (std::size_t i = begin + 1; i < end; ++i)
+      widest = std::max(widest, gap(ids[i - 1], ids[i]));
+
+    column.heads_.push_back(ids[begin]);
+    column.widths_.push_back(static_cast<std::uint8_t>(bit_width(widest)));
+    column.bit_offsets_.push_back(bits);
+    bits += static_cast<std::uint64_t>(end - begin - 1) * column.widths_.back();
+  }
+
+  // One spare word lets reads straddle a word boundary without a check.
+  column.words_.assign(static_cast<std::size_t>(bits / 64) + 2, 0);
+  for (std::size_t block = 0; block < blocks; ++block)
+  {
+    const std::size_t begin = block * kBlockSize;
+    const std::size_t end = std::min(ids.size(), begin + kBlockSize);
+    const unsigned width = column.widths_[block];
+    if (width == 0)
+      continue;
+    std::uint64_t pos = column.bit_offsets_[block];
+    for (std::size_t i = begin + 1; i < end; ++i, pos += width)
+      write_bits(column.words_, pos, width, gap(ids[i - 1], ids[i]));
+  }
+  return column;
+}
+
+IdColumn IdColumn::bitmap(const std::vector<int> &ids)
+{
+  IdColumn column;
+  column.encoding_ = Encoding::Bitmap;
+  column.size_ = ids.size();
+  if (ids.empty())
+    return column;
+
+  // Arithmetic shifts round towards minus infinity, so negative ids land in
+  // the right word too.
+  column.base_word_ = static_cast<std::int64_t>(ids.front()) >> 6;
+  const std::int64_t last_word = static_cast<std::int64_t>(ids.back()) >> 6;
+  column.words_.assign(static_cast<std::size_t>(last_word - column.base_word_ + 1), 0);
+  const std::int64_t base = column.base_word_ * 64;
+  for (const int id : ids)
+  {
+    const auto bit = static_cast<std::uint64_t>(id - base);
+    column.words_[bit >> 6] |= std::uint64_t{1} << (bit & 63);
+  }
+
+  column.ranks_.reserve(column.words_.size() / kRankStride + 1);
+  std::uint64_t count = 0;
+  for (std::size_t word = 0; word < column.words_.size(); ++word)
+  {
+    if (word % kRankStride == 0)
+      column.ranks_.push_back(count);
+    count += popcount(column.words_[word]);
+  }
+  return column;
+}
+
+IdColumn IdColumn::view(const int *ids, std::size_t size, std::shared_ptr<const void> owner)
+{
+  IdColumn column;
+  column.size_ = size;
+  column.borrowed_ = ids;
+  column.owner_ = std::move(owner);
+  return column;
+}
+
+int IdColumn::at(std::size_t index) const
+{
+  if (encoding_ == Encoding::Plain)
+    return plain_data()[index];
+  if (encoding_ == Encoding::Bitmap)
+    return static_cast<int>(base_word_ * 64 + static_cast<std::int64_t>(select(index)));
+
+  const std::size_t block = index / kBlockSize;
+  const unsigned width = widths_[block];
+  std::int64_t id = heads_[block];
+  std::uint64_t pos = bit_offsets_[block];
+  for (std::size_t k = block * kBlockSize; k < index; ++k, pos += width)
+    id += static_cast<std::int64_t>(width == 0 ? 0 : read_bits(words_, pos, width)) + 1;
+  return static_cast<int>(id);
+}
+
+std::size_t IdColumn::lower_bound(int key) const
+{
+  if (encoding_ == Encoding::Plain)
+    return static_cast<std::size_t>(std::lower_bound(plain_data(), plain_data() + size_, key) - plain_data());
+  if (encoding_ == Encoding::Bitmap)
+  {
+    const std::int64_t bit = key - base_word_ * 64;
+    if (bit <= 0)
+      return 0;
+    if (static_cast<std::uint64_t>(bit) >= words_.size() * 64)
+      return size_;
+    return rank(static_cast<std::uint64_t>(bit));
+  }
+
+  const auto after = std::upper_bound(heads_.begin(), heads_.end(), key);
+  if (after == heads_.begin())
+    return 0;
+  const auto block = static_cast<std::size_t>(std::distance(heads_.begin(), after)) - 1;
+
+  int ids[kBlockSize];
+  const std::size_t count = block_size(block);
+  decode_block(block, ids);
+  return block * kBlockSize + static_cast<std::size_t>(std::lower_bound(ids, ids + count, key) - ids);
+}
+
+bool IdColumn::contains(int key) const
+{
+  if (encoding_ == Encoding::Bitmap)
+    return (bitmap_word(static_cast<std::int64_t>(key) >> 6) >> (static_cast<unsigned>(key) & 63) & 1) != 0;
+  const std::size_t pos = lower_bound(key);
+  return pos < size_ && at(pos) == key;
+}
+
+std::size_t IdColumn::window(std::size_t pos, std::size_t max, const int *&data, std::vector<int> &scratch) const
+{
+  if (pos >= size_)
+    return 0;
+  const std::size_t count = std::min(max, size_ - pos);
+  if (encoding_ == Encoding::Plain)
+  {
+    data = plain_data() + pos;
+    return count;
+  }
+  if (encoding_ == Encoding::Bitmap)
+  {
+    scratch.resize(count);
+    const std::uint64_t start = select(pos);
+    std::size_t word = static_cast<std::size_t>(start >> 6);
+    std::uint64_t bits = words_[word] & ~below(static_cast<unsigned>(start & 63));
+    for (std::size_t i = 0; i < count; ++i)
+    {
+      while (bits == 0)
+        bits = words_[++word];
+      const auto offset = static_cast<std::int64_t>(word * 64 + static_cast<unsigned>(__builtin_ctzll(bits)));
+      scratch[i] = static_cast<int>(base_word_ * 64 + offset);
+      bits &= bits - 1;
+    }
+    data = scratch.data();
+    return count;
+  }
+
+  const std::size_t first = pos / kBlockSize;
+  const std::size_t skip = pos - first * kBlockSize;
+  const std::size_t last = (pos + count - 1) / kBlockSize;
+  scratch.resize((last - first + 1) * kBlockSize);
+  for (std::size_t block = first; block <= last; ++block)
+    decode_block(block, scratch.data() + (block - first) * kBlockSize);
+  data = scratch.data() + skip;
+  return count;
+}
+
+std::uint64_t IdColumn::bitmap_word(std::int64_t word) const
+{
+  const std::int64_t index = word - base_word_;
+  if (index < 0 || static_cast<std::uint64_t>(index) >= words_.size())
+    return 0;
+  return words_[static_cast<std::size_t>(index)];
+}
+
+std::vector<int> IdColumn::to_vector() const
+{
+  if (encoding_ == Encoding::Plain)
+    return std::vector<int>(plain_data(), plain_data() + size_);
+  if (encoding_ == Encoding::Bitmap)
+  {
+    std::vector<int> scratch;
+    const int *data = nullptr;
+    window(0, size_, data, scratch);
+    return scratch;
+  }
+
+  std::vector<int> ids((heads_.size()) * kBlockSize);
+  for (std::size_t block = 0; block < heads_.size(); ++block)
+    decode_block(block, ids.data() + block * kBlockSize);
+  ids.resize(size_);
+  return ids;
+}
+
+std::size_t IdColumn::memory_bytes() const
+{
+  const std::size_t borrowed = borrowed_ != nullptr ? size_ * sizeof(int) : 0;
+  return borrowed + plain_.capacity() * sizeof(int) + heads_.capacity() * sizeof(int) + widths_.capacity() +
+         bit_offsets_.capacity() * sizeof(std::uint64_t) + words_.capacity() * sizeof(std::uint64_t) +
+         ranks_.capacity() * sizeof(std::uint64_t);
+}
+
+void IdColumn::decode_block(std::size_t block, int *out) const
+{
+  const std::size_t count = block_size(block);
+  const unsigned width = widths_[block];
+  std::int64_t id = heads_[block];
+  out[0] = static_cast<int>(id);
+  if (width == 0)
+  {
+    for (std::size_t k = 1; k < count; ++k)
+      out[k] = static_cast<int>(++id);
+    return;
+  }
+
+  std::uint64_t pos = bit_offsets_[block];
+  for (std::size_t k = 1; k < count; ++k, pos += width)
+  {
+    id += static_cast<std::int64_t>(read_bits(words_, pos, width)) + 1;
+    out[k] = static_cast<int>(id);
+  }
+}
+
+std::size_t IdColumn::block_size(std::size_t block) const
+{
+  return std::min(kBlockSize, size_ - block * kBlockSize);
+}
+
+// Number of set bits before `bit`, counted from the bitmap start.
+std::size_t IdColumn::rank(std::uint64_t bit) const
+{
+  const auto word = static_cast<std::size_t>(bit >> 6);
+  std::uint64_t count = ranks_[word / kRankStride];
+  for (std::size_t k = word - word % kRankStride; k < word; ++k)
+    count += popcount(words_[k]);
+  count += popcount(words_[word] & below(static_cast<unsigned>(bit & 63)));
+  return static_cast<std::size_t>(count);
+}
+
+// Offset from the bitmap start of the set bit with the given rank.
+std::uint64_t IdColumn::select(std::size_t index) const
+{
+  const auto after = std::upper_bound(ranks_.begin(), ranks_.end(), static_cast<std::uint64_t>(index));
+  const auto stride = static_cast<std::size_t>(std::distance(ranks_.begin(), after)) - 1;
+  std::uint64_t count = ranks_[stride];
+  std::size_t word = stride * kRankStride;
+  while (count + popcount(words_[word]) <= index)
+    count += popcount(words_[word++]);
+
+  std::uint64_t bits = words_[word];
+  for (std::uint64_t skip = index - count; skip > 0; --skip)
+    bits &= bits - 1;
+  return word * 64 + static_cast<unsigned>(__builtin_ctzll(bits));
+}
+
+} // namespace join_server
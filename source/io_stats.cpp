@@ -0,0 +1,68 @@
+#include "join_server/io_stats.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+namespace
+{
+
+struct Registry
+{
+  std::mutex mtx;
+  std::vector<const std::atomic<std::uint64_t> *> live;
+  std::uint64_t retired{0};
+};
+
+// Never destroyed, so threads may still exit after main() returns.
+Registry &registry()
+{
+  static auto *const instance = new Registry;
+  return *instance;
+}
+
+// Written only by its own thread; read by io_syscalls().
+struct Slot
+{
+  Slot()
+  {
+    auto &all = registry();
+    std::lock_guard<std::mutex> lk(all.mtx);
+    all.live.push_back(&calls);
+  }
+
+  ~Slot()
+  {
+    auto &all = registry();
+    std::lock_guard<std::mutex> lk(all.mtx);
+    all.retired += calls.load(std::memory_order_relaxed);
+    all.live.erase(std::find(all.live.begin(), all.live.end(), &calls));
+  }
+
+  std::atomic<std::uint64_t> calls{0};
+};
+
+thread_local Slot slot;
+
+} // namespace
+
+namespace join_server
+{
+
+void count_io_syscall(std::uint64_t calls)
+{
+  slot.calls.store(slot.calls.load(std::memory_order_relaxed) + calls, std::memory_order_relaxed);
+}
+
+std::uint64_t io_syscalls()
+{
+  auto &all = registry();
+  std::lock_guard<std::mutex> lk(all.mtx);
+  std::uint64_t total = all.retired;
+  for (const auto *calls : all.live)
+    total += calls->load(std::memory_order_relaxed);
+  return total;
+}
+
+} // namespace join_server
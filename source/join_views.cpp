@@ -0,0 +1,113 @@
+#include "join_server/join_views.hpp"
+
+namespace
+{
+
+std::size_t owner_slot(join_server::TableId table)
+{
+  return table == join_server::TableId::A ? 0 : 1;
+}
+
+template <typename View, typename RowOf>
+bool copy_batch(const View &view, int from, std::size_t limit, std::vector<join_server::DataRow> &rows,
+                RowOf row_of)
+{
+  auto it = view.lower_bound(from);
+  for (; it != view.end() && limit > 0; ++it, --limit)
+    rows.push_back(row_of(it->second));
+  return it != view.end();
+}
+
+} // namespace
+
+namespace join_server
+{
+
+void JoinViews::on_insert(TableId table, int id, std::string_view value, std::shared_ptr<const void> owner)
+{
+  std::lock_guard<std::mutex> lk(mtx_);
+  auto &current_owner = owners_[owner_slot(table)];
+  if (current_owner != owner)
+    current_owner = std::move(owner);
+
+  const auto it = difference_.find(id);
+  if (it != difference_.end() && it->second.side != table)
+  {
+    // The other table already has this id: the pair moves into the intersection.
+    auto row = std::move(it->second.row);
+    (table == TableId::A ? row.from_a : row.from_b) = value;
+    difference_.erase(it);
+    intersection_.emplace(id, std::move(row));
+    return;
+  }
+
+  DataRow row{id, {}, {}};
+  (table == TableId::A ? row.from_a : row.from_b) = value;
+  difference_.emplace(id, DifferenceRow{table, std::move(row)});
+}
+
+void JoinViews::on_truncate(TableId table)
+{
+  std::lock_guard<std::mutex> lk(mtx_);
+  const TableId other = table == TableId::A ? TableId::B : TableId::A;
+
+  // Rows of the other table become unmatched again; rebuild the difference in
+  // one ordered pass over both views.
+  std::map<int, DifferenceRow> difference;
+  auto it_diff = difference_.begin();
+  auto it_both = intersection_.begin();
+  while (it_diff != difference_.end() || it_both != intersection_.end())
+  {
+    if (it_both == intersection_.end() || (it_diff != difference_.end() && it_diff->first < it_both->first))
+    {
+      if (it_diff->second.side == other)
+        difference.emplace_hint(difference.end(), it_diff->first, std::move(it_diff->second));
+      ++it_diff;
+      continue;
+    }
+
+    auto row = std::move(it_both->second);
+    (table == TableId::A ? row.from_a : row.from_b) = {};
+    difference.emplace_hint(difference.end(), it_both->first, DifferenceRow{other, std::move(row)});
+    ++it_both;
+  }
+
+  difference_ = std::move(difference);
+  intersection_.clear();
+  owners_[owner_slot(table)].reset();
+}
+
+JoinResult JoinViews::intersection() const
+{
+  std::lock_guard<std::mutex> lk(mtx_);
+  JoinResult result;
+  result.owners = {owners_[0], owners_[1]};
+  auto &rows = result.rows;
+  rows.reserve(intersection_.size());
+  for (const auto &entry : intersection_)
+    rows.push_back(entry.second);
+  return result;
+}
+
+JoinResult JoinViews::symmetric_difference() const
+{
+  std::lock_guard<std::mutex> lk(mtx_);
+  JoinResult result;
+  result.owners = {owners_[0], owners_[1]};
+  auto &rows = result.rows;
+  rows.reserve(difference_.size());
+  for (const auto &entry : difference_)
+    rows.push_back(entry.second.row);
+  return result;
+}
+
+bool JoinViews::batch(JoinKind kind, int from, std::size_t limit, JoinResult &result) const
+{
+  std::lock_guard<std::mutex> lk(mtx_);
+  result.owners = {owners_[0], owners_[1]};
+  if (kind == JoinKind::Intersection)
+    return copy_batch(intersection_, from, limit, result.rows, [](const DataRow &row) { return row; });
+  return copy_batch(difference_, from, limit, result.rows, [](const DifferenceRow &entry) { return entry.row; });
+}
+
+} // namespace join_server
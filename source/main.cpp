@@ -1,35 +1,222 @@
+#include "join_server/csv_import.hpp"
 #include "join_server/server.hpp"
+#include "join_server/snapshot.hpp"
 #include "join_server/tables.hpp"
+#include "join_server/wal.hpp"
 
 #include <cstdlib>
 #include <exception>
 #include <iostream>
 #include <memory>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
 
 namespace
 {
 
 constexpr unsigned long kMaxPort = 65535UL;
 
+constexpr const char *kUsage = "Usage: join_server [--engine map|flat] [--views] [--join-threads N] [--compress-ids]\n"
+                               "                   [--snapshot FILE] [--verify-snapshot] [--wal FILE]\n"
+                               "                   [--durability none|batch|every-op]\n"
+                               "                   [--import A|B=FILE]... [--import-dir DIR]\n"
+                               "                   [--io-backend epoll|uring|threads] [--workers N]\n"
+                               "                   [--reactors N] [--cpu-affinity] [--max-scans N] [--write-burst N]\n"
+                               "                   <port>\n";
+
+join_server::StorageEngine parse_engine(const std::string &value)
+{
+  if (value == "map")
+    return join_server::StorageEngine::Map;
+  if (value == "flat")
+    return join_server::StorageEngine::Flat;
+  throw std::invalid_argument("unknown storage engine " + value);
+}
+
+join_server::Durability parse_durability(const std::string &value)
+{
+  if (value == "none")
+    return join_server::Durability::None;
+  if (value == "batch")
+    return join_server::Durability::Batch;
+  if (value == "every-op")
+    return join_server::Durability::EveryOp;
+  throw std::invalid_argument("unknown durability mode " + value);
+}
+
+join_server::IoBackend parse_io_backend(const std::string &value)
+{
+  if (value == "epoll")
+    return join_server::IoBackend::Epoll;
+  if (value == "uring")
+    return join_server::IoBackend::Uring;
+  if (value == "threads")
+    return join_server::IoBackend::Threads;
+  throw std::invalid_argument("unknown I/O backend " + value);
+}
+
+// "A=path" or "B=path".
+std::pair<join_server::TableId, std::string> parse_import(const std::string &value)
+{
+  const auto equals = value.find('=');
+  if (equals == 1 && (value[0] == 'A' || value[0] == 'a'))
+    return {join_server::TableId::A, value.substr(2)};
+  if (equals == 1 && (value[0] == 'B' || value[0] == 'b'))
+    return {join_server::TableId::B, value.substr(2)};
+  throw std::invalid_argument("expected --import A=FILE or B=FILE, got " + value);
+}
+
 } // namespace
 
 int main(int argc, char *argv[])
 {
-  if (argc != 2)
-  {
-    std::cerr << "Usage: join_server <port>\n";
-    return EXIT_FAILURE;
-  }
-
   try
   {
-    const unsigned long value = std::stoul(argv[1]);
+    join_server::StoreOptions options;
+    join_server::ServerOptions server_options;
+    std::string wal_path;
+    std::vector<std::pair<join_server::TableId, std::string>> imports;
+    auto durability = join_server::Durability::Batch;
+    bool verify = false;
+    const char *port_arg = nullptr;
+    for (int i = 1; i < argc; ++i)
+    {
+      const std::string arg = argv[i];
+      if (arg == "--engine" && i + 1 < argc)
+      {
+        options.engine = parse_engine(argv[++i]);
+        continue;
+      }
+      if (arg == "--snapshot" && i + 1 < argc)
+      {
+        options.snapshot_path = argv[++i];
+        continue;
+      }
+      if (arg == "--wal" && i + 1 < argc)
+      {
+        wal_path = argv[++i];
+        continue;
+      }
+      if (arg == "--import" && i + 1 < argc)
+      {
+        imports.push_back(parse_import(argv[++i]));
+        continue;
+      }
+      if (arg == "--import-dir" && i + 1 < argc)
+      {
+        options.import_dir = argv[++i];
+        continue;
+      }
+      if (arg == "--durability" && i + 1 < argc)
+      {
+        durability = parse_durability(argv[++i]);
+        continue;
+      }
+      if (arg == "--join-threads" && i + 1 < argc)
+      {
+        options.join_threads = std::stoul(argv[++i]);
+        continue;
+      }
+      if (arg == "--io-backend" && i + 1 < argc)
+      {
+        server_options.backend = parse_io_backend(argv[++i]);
+        continue;
+      }
+      if (arg == "--workers" && i + 1 < argc)
+      {
+        server_options.workers = std::stoul(argv[++i]);
+        continue;
+      }
+      if (arg == "--reactors" && i + 1 < argc)
+      {
+        server_options.reactors = std::stoul(argv[++i]);
+        continue;
+      }
+      if (arg == "--max-scans" && i + 1 < argc)
+      {
+        server_options.scheduler.max_scans = std::stoul(argv[++i]);
+        continue;
+      }
+      if (arg == "--write-burst" && i + 1 < argc)
+      {
+        server_options.scheduler.write_burst = std::stoul(argv[++i]);
+        continue;
+      }
+      if (arg == "--cpu-affinity")
+      {
+        server_options.cpu_affinity = true;
+        continue;
+      }
+      if (arg == "--verify-snapshot")
+      {
+        verify = true;
+        continue;
+      }
+      if (arg == "--compress-ids")
+      {
+        options.compress_ids = true;
+        continue;
+      }
+      if (arg == "--views")
+      {
+        options.materialized_views = true;
+        continue;
+      }
+      if (port_arg != nullptr || arg.rfind("--", 0) == 0)
+      {
+        std::cerr << kUsage;
+        return EXIT_FAILURE;
+      }
+      port_arg = argv[i];
+    }
+
+    if (port_arg == nullptr)
+    {
+      std::cerr << kUsage;
+      return EXIT_FAILURE;
+    }
+
+    const unsigned long value = std::stoul(port_arg);
     if (value > kMaxPort)
       throw std::out_of_range("port overflow");
 
-    const auto port = static_cast<uint16_t>(value);
-    auto store = std::make_shared<join_server::TablesStore>();
-    join_server::TcpServer server(port, std::move(store));
+    server_options.port = static_cast<uint16_t>(value);
+    const auto snapshot_path = options.snapshot_path;
+    auto store = std::make_shared<join_server::TablesStore>(options);
+    // Log records up to this one are already in the snapshot.
+    join_server::WriteAheadLog::Lsn snapshot_lsn = 0;
+    if (!snapshot_path.empty())
+    {
+      std::size_t rows = 0;
+      std::string error;
+      if (verify && !join_server::verify_snapshot(snapshot_path, error))
+        throw std::runtime_error(error);
+      if (!join_server::map_snapshot(*store, snapshot_path, rows, error, &snapshot_lsn))
+        throw std::runtime_error(error);
+      std::cout << "mapped " << rows << " rows from " << snapshot_path << std::endl;
+    }
+    if (!wal_path.empty())
+    {
+      std::size_t records = 0;
+      std::string error;
+      if (!join_server::WriteAheadLog::replay(wal_path, *store, records, error, snapshot_lsn))
+        throw std::runtime_error(error);
+      std::cout << "replayed " << records << " wal records from " << wal_path << std::endl;
+      store->attach_wal(std::make_unique<join_server::WriteAheadLog>(wal_path, durability));
+    }
+    // After the log is attached, so imported rows are as durable as inserts.
+    for (const auto &[table, path] : imports)
+    {
+      std::size_t rows = 0;
+      std::string error;
+      if (!join_server::import_csv(*store, table, path, 0, rows, error))
+        throw std::runtime_error(error);
+      std::cout << "imported " << rows << " rows into " << (table == join_server::TableId::A ? 'A' : 'B')
+                << " from " << path << std::endl;
+    }
+    join_server::TcpServer server(server_options, std::move(store));
     server.run();
   }
   catch (const std::exception &ex)
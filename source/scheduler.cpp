@@ -0,0 +1,101 @@
+#include "join_server/scheduler.hpp"
+
+#include <algorithm>
+
+namespace
+{
+
+constexpr std::size_t kWrite = static_cast<std::size_t>(join_server::TaskClass::Write);
+constexpr std::size_t kScan = static_cast<std::size_t>(join_server::TaskClass::Scan);
+// finished() notifies; the bound only keeps the wait on the inlined clock
+// wait, as in WorkerPool.
+constexpr std::chrono::hours kDrainBound{1};
+
+} // namespace
+
+namespace join_server
+{
+
+CommandScheduler::CommandScheduler(WorkerPool &workers, const SchedulerOptions &options)
+    : workers_(workers), max_running_(workers.size()),
+      max_scans_(options.max_scans != 0 ? options.max_scans : std::max<std::size_t>(1, workers.size() / 2)),
+      write_burst_(std::max<std::size_t>(1, options.write_burst))
+{
+}
+
+CommandScheduler::~CommandScheduler()
+{
+  std::unique_lock<std::mutex> lk(mtx_);
+  while (!drained_.wait_for(lk, kDrainBound, [this] { return idle(); }))
+  {
+  }
+}
+
+void CommandScheduler::submit(TaskClass task_class, Task task)
+{
+  std::lock_guard<std::mutex> lk(mtx_);
+  queues_[static_cast<std::size_t>(task_class)].push_back(Entry{std::move(task), Clock::now()});
+  dispatch();
+}
+
+void CommandScheduler::dispatch()
+{
+  while (running_[kWrite] + running_[kScan] < max_running_)
+  {
+    const bool write_ready = !queues_[kWrite].empty();
+    const bool scan_ready = !queues_[kScan].empty() && running_[kScan] < max_scans_;
+    std::size_t index = kWrite;
+    if (scan_ready && (!write_ready || writes_in_row_ >= write_burst_))
+      index = kScan;
+    else if (!write_ready)
+      return;
+    // Only writes that overtake a waiting scan count against the burst.
+    writes_in_row_ = index == kWrite && scan_ready ? writes_in_row_ + 1 : 0;
+
+    auto entry = std::move(queues_[index].front());
+    queues_[index].pop_front();
+    const auto waited = static_cast<std::uint64_t>(
+        std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - entry.queued).count());
+    auto &stats = stats_[index];
+    stats.wait_us_total += waited;
+    stats.wait_us_max = std::max(stats.wait_us_max, waited);
+    ++running_[index];
+
+    const auto task_class = static_cast<TaskClass>(index);
+    workers_.submit(
+        [this, task_class, task = std::move(entry.task)]
+        {
+          task();
+          finished(task_class);
+        });
+  }
+}
+
+void CommandScheduler::finished(TaskClass task_class)
+{
+  const auto index = static_cast<std::size_t>(task_class);
+  std::lock_guard<std::mutex> lk(mtx_);
+  --running_[index];
+  ++stats_[index].completed;
+  dispatch();
+  if (idle())
+    drained_.notify_all();
+}
+
+bool CommandScheduler::idle() const
+{
+  return queues_[kWrite].empty() && queues_[kScan].empty() && running_[kWrite] + running_[kScan] == 0;
+}
+
+SchedulerStats CommandScheduler::stats() const
+{
+  std::lock_guard<std::mutex> lk(mtx_);
+  SchedulerStats stats{stats_[kWrite], stats_[kScan]};
+  stats.write.queued = queues_[kWrite].size();
+  stats.write.running = running_[kWrite];
+  stats.scan.queued = queues_[kScan].size();
+  stats.scan.running = running_[kScan];
+  return stats;
+}
+
+} // namespace join_server
@@ -1,179 +1,211 @@
 #include "join_server/server.hpp"
 
-#include "join_server/command.hpp"
+#include "join_server/epoll_reactor.hpp"
+#include "join_server/session.hpp"
 #include "join_server/tables.hpp"
+#include "join_server/uring_reactor.hpp"
+#include "join_server/worker_pool.hpp"
 
 #include <arpa/inet.h>
 #include <cerrno>
 #include <cstring>
 #include <netinet/in.h>
+#include <pthread.h>
+#include <sched.h>
 #include <sys/socket.h>
 #include <unistd.h>
 
+#include <algorithm>
+#include <functional>
 #include <iostream>
 #include <memory>
 #include <stdexcept>
 #include <string>
 #include <thread>
+#include <vector>
 
 namespace
 {
 
-constexpr int kBacklog = 16;
-constexpr std::size_t kBufferSize = 4096;
+// Deep enough to absorb bursts of connects between two accept passes.
+constexpr int kBacklog = SOMAXCONN;
+
+// Pins the calling thread to the index-th CPU it is allowed to run on.
+void pin_to_cpu(std::size_t index)
+{
+  cpu_set_t allowed;
+  CPU_ZERO(&allowed);
+  if (::sched_getaffinity(0, sizeof(allowed), &allowed) != 0 || CPU_COUNT(&allowed) == 0)
+    return;
+  index %= static_cast<std::size_t>(CPU_COUNT(&allowed));
+  for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+  {
+    if (!CPU_ISSET(cpu, &allowed))
+      continue;
+    if (index > 0)
+    {
+      --index;
+      continue;
+    }
+    cpu_set_t target;
+    CPU_ZERO(&target);
+    CPU_SET(cpu, &target);
+    const int status = ::pthread_setaffinity_np(::pthread_self(), sizeof(target), &target);
+    if (status != 0)
+      std::cerr << "cannot pin reactor to CPU " << cpu << ": " << std::strerror(status) << std::endl;
+    return;
+  }
+}
 
 } // namespace
 
 namespace join_server
 {
 
-TcpServer::TcpServer(uint16_t port, std::shared_ptr<TablesStore> store)
-    : port_(port), store_(std::move(store))
+TcpServer::TcpServer(const ServerOptions &options, std::shared_ptr<TablesStore> store)
+    : options_(options), store_(std::move(store))
 {
   if (!store_)
     throw std::invalid_argument("TablesStore pointer must not be null");
 
-  listener_ = ::socket(AF_INET, SOCK_STREAM, 0);
-  if (listener_ < 0)
-    throw std::runtime_error(std::string("socket failed: ") + std::strerror(errno));
+  std::size_t count = 1;
+  if (options_.backend != IoBackend::Threads)
+    count = options_.reactors != 0 ? options_.reactors : std::max(1U, std::thread::hardware_concurrency());
+  for (std::size_t i = 0; i < count; ++i)
+    open_listener(count > 1);
+}
+
+TcpServer::~TcpServer()
+{
+  close_listeners();
+}
+
+void TcpServer::open_listener(bool reuse_port)
+{
+  const auto fail = [this](const char *what)
+  {
+    const auto err = std::string(what) + ": " + std::strerror(errno);
+    close_listeners();
+    throw std::runtime_error(err);
+  };
+
+  const int fd = ::socket(AF_INET, SOCK_STREAM, 0);
+  if (fd < 0)
+    fail("socket failed");
+  listeners_.push_back(fd);
 
   int opt = 1;
-  ::setsockopt(listener_, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+  ::setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+  if (reuse_port && ::setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt)) < 0)
+    fail("SO_REUSEPORT failed");
 
   sockaddr_in addr{};
   addr.sin_family = AF_INET;
   addr.sin_addr.s_addr = htonl(INADDR_ANY);
-  addr.sin_port = htons(port_);
+  addr.sin_port = htons(options_.port);
 
-  if (::bind(listener_, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) < 0)
-  {
-    const auto err = std::string("bind failed: ") + std::strerror(errno);
-    close_listener();
-    throw std::runtime_error(err);
-  }
+  if (::bind(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) < 0)
+    fail("bind failed");
 
-  if (::listen(listener_, kBacklog) < 0)
-  {
-    const auto err = std::string("listen failed: ") + std::strerror(errno);
-    close_listener();
-    throw std::runtime_error(err);
-  }
-}
+  if (::listen(fd, kBacklog) < 0)
+    fail("listen failed");
 
-TcpServer::~TcpServer()
-{
-  close_listener();
+  // With port 0 the other listeners have to join the port picked for the first.
+  socklen_t length = sizeof(addr);
+  if (options_.port == 0 && ::getsockname(fd, reinterpret_cast<sockaddr *>(&addr), &length) == 0)
+    options_.port = ntohs(addr.sin_port);
 }
 
-void TcpServer::close_listener()
+void TcpServer::close_listeners()
 {
-  if (listener_ >= 0)
+  for (const int fd : listeners_)
   {
-    ::close(listener_);
-    listener_ = -1;
+    if (fd >= 0)
+      ::close(fd);
   }
+  listeners_.clear();
 }
 
 void TcpServer::run()
 {
-  std::cout << "join_server listening on port " << port_ << std::endl;
-  for (;;)
-  {
-    sockaddr_in client_addr{};
-    socklen_t client_len = sizeof(client_addr);
-    int client_fd = ::accept(listener_, reinterpret_cast<sockaddr *>(&client_addr), &client_len);
-    if (client_fd < 0)
-    {
-      if (errno == EINTR)
-        continue;
-      std::cerr << "accept failed: " << std::strerror(errno) << std::endl;
-      break;
-    }
-
-    std::thread(&TcpServer::handle_client, this, client_fd).detach();
-  }
+  std::cout << "join_server listening on port " << options_.port << std::endl;
+  if (options_.backend == IoBackend::Threads)
+    run_threads();
+  else
+    run_reactors();
 }
 
-bool TcpServer::send_all(int client_fd, const std::string &data)
+void TcpServer::run_reactors()
 {
-  std::size_t total_sent = 0;
-  const char *buffer = data.data();
-  const std::size_t size = data.size();
+  // One pool serves every reactor, so a busy shard can use all the workers.
+  WorkerPool workers(options_.workers);
+  CommandScheduler scheduler(workers, options_.scheduler);
+  std::vector<std::thread> threads;
+  for (std::size_t i = 0; i < listeners_.size(); ++i)
+    threads.emplace_back(
+        [this, i, &scheduler]
+        {
+          if (options_.cpu_affinity)
+            pin_to_cpu(i);
+          try
+          {
+            run_reactor(listeners_[i], scheduler);
+          }
+          catch (const std::exception &e)
+          {
+            std::cerr << "reactor " << i << " failed: " << e.what() << std::endl;
+          }
+          // A reactor returns only when it fails. Once its listener is closed
+          // the kernel hands new connections to the other shards instead.
+          std::cerr << "reactor " << i << " stopped, closing its listener" << std::endl;
+          ::close(listeners_[i]);
+          listeners_[i] = -1;
+        });
+  for (auto &thread : threads)
+    thread.join();
+  throw std::runtime_error("every reactor has stopped");
+}
 
-  while (total_sent < size)
+void TcpServer::run_reactor(int listener, CommandScheduler &scheduler)
+{
+  std::unique_ptr<UringReactor> reactor;
+  if (options_.backend == IoBackend::Uring)
   {
-    const ssize_t sent = ::send(client_fd, buffer + total_sent, size - total_sent, 0);
-    if (sent < 0)
+    try
     {
-      if (errno == EINTR)
-        continue;
-      std::cerr << "send failed: " << std::strerror(errno) << std::endl;
-      return false;
+      reactor = std::make_unique<UringReactor>(listener, *store_, scheduler);
     }
-    total_sent += static_cast<std::size_t>(sent);
+    catch (const std::runtime_error &e)
+    {
+      std::cerr << "io_uring unavailable (" << e.what() << "), using epoll" << std::endl;
+    }
+  }
+  if (!reactor)
+  {
+    EpollReactor fallback(listener, *store_, scheduler);
+    fallback.run();
+    return;
   }
-  return true;
+  reactor->run();
 }
 
-void TcpServer::handle_client(int client_fd)
+void TcpServer::run_threads()
 {
-  CommandProcessor processor(*store_);
-  std::string buffer;
-  buffer.reserve(kBufferSize);
-  char chunk[kBufferSize];
-
-  bool running = true;
-  for (; running;)
+  for (;;)
   {
-    const ssize_t received = ::recv(client_fd, chunk, sizeof(chunk), 0);
-    if (received == 0)
-      break; // connection closed
-
-    if (received < 0)
+    sockaddr_in client_addr{};
+    socklen_t client_len = sizeof(client_addr);
+    int client_fd = ::accept(listeners_.front(), reinterpret_cast<sockaddr *>(&client_addr), &client_len);
+    if (client_fd < 0)
     {
       if (errno == EINTR)
         continue;
-      std::cerr << "recv failed: " << std::strerror(errno) << std::endl;
+      std::cerr << "accept failed: " << std::strerror(errno) << std::endl;
       break;
     }
 
-    buffer.append(chunk, static_cast<std::size_t>(received));
-
-    std::size_t processed = 0;
-    while (true)
-    {
-      const auto newline_pos = buffer.find('\n', processed);
-      if (newline_pos == std::string::npos)
-      {
-        if (processed > 0)
-          buffer.erase(0, processed);
-        break;
-      }
-
-      std::string line = buffer.substr(processed, newline_pos - processed);
-      if (!line.empty() && line.back() == '\r')
-        line.pop_back();
-
-      processed = newline_pos + 1;
-
-      const auto result = processor.execute(line);
-      std::string response;
-      response.reserve(result.lines.size() * 8);
-      for (const auto &entry : result.lines)
-      {
-        response.append(entry);
-        response.push_back('\n');
-      }
-
-      if (!send_all(client_fd, response))
-      {
-        running = false;
-        break;
-      }
-    }
+    std::thread(serve_blocking, client_fd, std::ref(*store_)).detach();
   }
-
-  ::close(client_fd);
 }
 
 } // namespace join_server
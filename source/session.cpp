@@ -0,0 +1,125 @@
+#include "join_server/session.hpp"
+
+#include "join_server/io_stats.hpp"
+
+#include <cerrno>
+#include <cstring>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <iostream>
+
+namespace
+{
+
+constexpr std::size_t kBufferSize = 4096;
+
+bool send_all(int fd, std::string_view data)
+{
+  while (!data.empty())
+  {
+    join_server::count_io_syscall();
+    const ssize_t sent = ::send(fd, data.data(), data.size(), MSG_NOSIGNAL);
+    if (sent < 0)
+    {
+      if (errno == EINTR)
+        continue;
+      std::cerr << "send failed: " << std::strerror(errno) << std::endl;
+      return false;
+    }
+    data.remove_prefix(static_cast<std::size_t>(sent));
+  }
+  return true;
+}
+
+} // namespace
+
+namespace join_server
+{
+
+Session::Session(TablesStore &store, const CommandScheduler *scheduler)
+    : text_(store, scheduler), binary_(store, text_)
+{
+}
+
+bool Session::run(std::string &input, ResponseBuffer &out, bool allow_scans)
+{
+  std::size_t processed = 0;
+  stopped_before_scan_ = false;
+  if (paused())
+  {
+    // The rest of the join is scan work as well.
+    stopped_before_scan_ = !allow_scans;
+    if (!allow_scans)
+      return true;
+    const bool done = text_.paused() ? text_.resume_join(out) : binary_.resume_join(out);
+    if (!done)
+      return true;
+  }
+
+  if (!text_.binary())
+  {
+    lines_.clear();
+    line_ends_.clear();
+    for (auto newline_pos = input.find('\n'); newline_pos != std::string::npos;
+         newline_pos = input.find('\n', line_ends_.back()))
+    {
+      const auto start = line_ends_.empty() ? 0 : line_ends_.back();
+      std::string_view line(input.data() + start, newline_pos - start);
+      if (!line.empty() && line.back() == '\r')
+        line.remove_suffix(1);
+      lines_.push_back(line);
+      line_ends_.push_back(newline_pos + 1);
+    }
+    // Whatever follows BINARY is already framed.
+    const auto done = text_.execute_batch(lines_, out, allow_scans);
+    processed = done == 0 ? 0 : line_ends_[done - 1];
+    stopped_before_scan_ = done < lines_.size() && !text_.binary() && !text_.paused();
+  }
+
+  bool framing_ok = true;
+  if (text_.binary() && !stopped_before_scan_ && !text_.paused())
+  {
+    std::size_t consumed = 0;
+    framing_ok = binary_.execute(std::string_view(input).substr(processed), out, consumed, allow_scans);
+    processed += consumed;
+    stopped_before_scan_ = binary_.stopped_before_scan();
+  }
+  input.erase(0, processed);
+  return framing_ok;
+}
+
+void serve_blocking(int fd, TablesStore &store)
+{
+  Session session(store);
+  ResponseBuffer response([fd](std::string_view data) { return send_all(fd, data); });
+  std::string buffer;
+  buffer.reserve(kBufferSize);
+  char chunk[kBufferSize];
+
+  for (;;)
+  {
+    count_io_syscall();
+    const ssize_t received = ::recv(fd, chunk, sizeof(chunk), 0);
+    if (received == 0)
+      break; // connection closed
+
+    if (received < 0)
+    {
+      if (errno == EINTR)
+        continue;
+      std::cerr << "recv failed: " << std::strerror(errno) << std::endl;
+      break;
+    }
+
+    buffer.append(chunk, static_cast<std::size_t>(received));
+    // All replies to this read go out together.
+    const bool open = session.run(buffer, response);
+    if (!response.flush() || !open)
+      break;
+  }
+
+  ::close(fd);
+}
+
+} // namespace join_server
@@ -0,0 +1,244 @@
+#include "join_server/set_ops.hpp"
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define JOIN_SERVER_X86_KERNELS 1
+#include <immintrin.h>
+#endif
+
+#include <algorithm>
+
+namespace
+{
+
+using join_server::IndexPair;
+
+// Above this size ratio a galloping search beats any linear merge.
+constexpr std::size_t kGallopRatio = 32;
+
+void push_pair(std::vector<IndexPair> &out, std::size_t i, std::size_t j)
+{
+  out.push_back(IndexPair{static_cast<std::uint32_t>(i), static_cast<std::uint32_t>(j)});
+}
+
+// Finds the first position in [from, size) with data[pos] >= key by doubling
+// the step and then binary searching inside the last step.
+std::size_t gallop(const int *data, std::size_t from, std::size_t size, int key)
+{
+  std::size_t step = 1;
+  std::size_t low = from;
+  std::size_t high = from;
+  while (high < size && data[high] < key)
+  {
+    low = high + 1;
+    high += step;
+    step *= 2;
+  }
+  high = std::min(high, size);
+  return static_cast<std::size_t>(std::lower_bound(data + low, data + high, key) - data);
+}
+
+void intersect_gallop(const int *small, std::size_t size_small, const int *large, std::size_t size_large,
+                      bool small_is_a, std::vector<IndexPair> &out)
+{
+  std::size_t j = 0;
+  for (std::size_t i = 0; i < size_small && j < size_large; ++i)
+  {
+    j = gallop(large, j, size_large, small[i]);
+    if (j < size_large && large[j] == small[i])
+    {
+      if (small_is_a)
+        push_pair(out, i, j);
+      else
+        push_pair(out, j, i);
+      ++j;
+    }
+  }
+}
+
+void intersect_scalar(const int *a, std::size_t size_a, const int *b, std::size_t size_b, std::size_t i,
+                      std::size_t j, std::vector<IndexPair> &out)
+{
+  while (i < size_a && j < size_b)
+  {
+    if (a[i] == b[j])
+    {
+      push_pair(out, i, j);
+      ++i;
+      ++j;
+      continue;
+    }
+    if (a[i] < b[j])
+      ++i;
+    else
+      ++j;
+  }
+}
+
+#ifdef JOIN_SERVER_X86_KERNELS
+
+// masks[r] has bit k set when a[i + k] == b[j + (k + r) % width]. Each key
+// of a block matches at most once, so the pairs are emitted in k order.
+void emit_block_matches(const int *masks, unsigned width, int any, std::size_t i, std::size_t j,
+                        std::vector<IndexPair> &out)
+{
+  unsigned partner[8];
+  for (unsigned r = 0; r < width; ++r)
+  {
+    for (unsigned bits = static_cast<unsigned>(masks[r]); bits != 0; bits &= bits - 1)
+    {
+      const auto k = static_cast<unsigned>(__builtin_ctz(bits));
+      partner[k] = (k + r) & (width - 1);
+    }
+  }
+  for (unsigned bits = static_cast<unsigned>(any); bits != 0; bits &= bits - 1)
+  {
+    const auto k = static_cast<unsigned>(__builtin_ctz(bits));
+    push_pair(out, i + k, j + partner[k]);
+  }
+}
+
+// Compares a block of 4 keys from each side against all 4 rotations of the
+// other block, then advances the block with the smaller maximum.
+void intersect_sse(const int *a, std::size_t size_a, const int *b, std::size_t size_b, std::vector<IndexPair> &out)
+{
+  std::size_t i = 0;
+  std::size_t j = 0;
+  while (i + 4 <= size_a && j + 4 <= size_b)
+  {
+    const __m128i va = _mm_loadu_si128(reinterpret_cast<const __m128i *>(a + i));
+    const __m128i vb = _mm_loadu_si128(reinterpret_cast<const __m128i *>(b + j));
+
+    int masks[4];
+    masks[0] = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(va, vb)));
+    masks[1] = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(va, _mm_shuffle_epi32(vb, _MM_SHUFFLE(0, 3, 2, 1)))));
+    masks[2] = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(va, _mm_shuffle_epi32(vb, _MM_SHUFFLE(1, 0, 3, 2)))));
+    masks[3] = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(va, _mm_shuffle_epi32(vb, _MM_SHUFFLE(2, 1, 0, 3)))));
+
+    const int any = masks[0] | masks[1] | masks[2] | masks[3];
+    if (any != 0)
+      emit_block_matches(masks, 4, any, i, j, out);
+
+    const int max_a = a[i + 3];
+    const int max_b = b[j + 3];
+    if (max_a <= max_b)
+      i += 4;
+    if (max_b <= max_a)
+      j += 4;
+  }
+  intersect_scalar(a, size_a, b, size_b, i, j, out);
+}
+
+__attribute__((target("avx2"))) void intersect_avx2(const int *a, std::size_t size_a, const int *b,
+                                                     std::size_t size_b, std::vector<IndexPair> &out)
+{
+  const __m256i rotations[8] = {
+      _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7), _mm256_setr_epi32(1, 2, 3, 4, 5, 6, 7, 0),
+      _mm256_setr_epi32(2, 3, 4, 5, 6, 7, 0, 1), _mm256_setr_epi32(3, 4, 5, 6, 7, 0, 1, 2),
+      _mm256_setr_epi32(4, 5, 6, 7, 0, 1, 2, 3), _mm256_setr_epi32(5, 6, 7, 0, 1, 2, 3, 4),
+      _mm256_setr_epi32(6, 7, 0, 1, 2, 3, 4, 5), _mm256_setr_epi32(7, 0, 1, 2, 3, 4, 5, 6)};
+
+  std::size_t i = 0;
+  std::size_t j = 0;
+  while (i + 8 <= size_a && j + 8 <= size_b)
+  {
+    const __m256i va = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(a + i));
+    const __m256i vb = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(b + j));
+
+    int masks[8];
+    int any = 0;
+    for (std::size_t r = 0; r < 8; ++r)
+    {
+      const __m256i rotated = _mm256_permutevar8x32_epi32(vb, rotations[r]);
+      masks[r] = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(va, rotated)));
+      any |= masks[r];
+    }
+
+    if (any != 0)
+      emit_block_matches(masks, 8, any, i, j, out);
+
+    const int max_a = a[i + 7];
+    const int max_b = b[j + 7];
+    if (max_a <= max_b)
+      i += 8;
+    if (max_b <= max_a)
+      j += 8;
+  }
+  intersect_scalar(a, size_a, b, size_b, i, j, out);
+}
+
+#endif
+
+join_server::SetKernel detect_kernel()
+{
+#ifdef JOIN_SERVER_X86_KERNELS
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2"))
+    return join_server::SetKernel::Avx2;
+  return join_server::SetKernel::Sse;
+#else
+  return join_server::SetKernel::Scalar;
+#endif
+}
+
+} // namespace
+
+namespace join_server
+{
+
+SetKernel best_set_kernel()
+{
+  static const SetKernel kernel = detect_kernel();
+  return kernel;
+}
+
+bool set_kernel_supported(SetKernel kernel)
+{
+  return static_cast<int>(kernel) <= static_cast<int>(best_set_kernel());
+}
+
+const char *set_kernel_name(SetKernel kernel)
+{
+  switch (kernel)
+  {
+  case SetKernel::Avx2:
+    return "avx2";
+  case SetKernel::Sse:
+    return "sse";
+  case SetKernel::Scalar:
+    break;
+  }
+  return "scalar";
+}
+
+void intersect_sorted(SetKernel kernel, const int *a, std::size_t size_a, const int *b, std::size_t size_b,
+                      std::vector<IndexPair> &out)
+{
+  if (size_a == 0 || size_b == 0)
+    return;
+  if (size_a * kGallopRatio < size_b)
+  {
+    intersect_gallop(a, size_a, b, size_b, true, out);
+    return;
+  }
+  if (size_b * kGallopRatio < size_a)
+  {
+    intersect_gallop(b, size_b, a, size_a, false, out);
+    return;
+  }
+
+#ifdef JOIN_SERVER_X86_KERNELS
+  if (kernel == SetKernel::Avx2 && set_kernel_supported(SetKernel::Avx2))
+  {
+    intersect_avx2(a, size_a, b, size_b, out);
+    return;
+  }
+  if (kernel != SetKernel::Scalar)
+  {
+    intersect_sse(a, size_a, b, size_b, out);
+    return;
+  }
+#endif
+  intersect_scalar(a, size_a, b, size_b, 0, 0, out);
+}
+
+} // namespace join_server
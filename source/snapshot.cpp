@@ -0,0 +1,378 @@
+#include "join_server/snapshot.hpp"
+
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <unordered_map>
+#include <vector>
+
+namespace
+{
+
+using join_server::TableId;
+
+constexpr char kMagic[8] = {'J', 'O', 'I', 'N', 'S', 'N', 'A', 'P'};
+constexpr std::uint32_t kVersion = 3;
+constexpr std::size_t kTables = 2;
+constexpr std::size_t kWriteBuffer = 1024 * 1024;
+
+// Offsets are from the start of the file; every section is 8-byte aligned.
+struct TableHeader
+{
+  std::uint64_t rows;
+  std::uint64_t ids;
+  std::uint64_t refs;
+  std::uint64_t blob;
+  std::uint64_t blob_size;
+};
+
+struct FileHeader
+{
+  char magic[8];
+  std::uint32_t version;
+  std::uint32_t tables;
+  TableHeader table[kTables];
+  std::uint64_t wal_lsn;
+  // Of every header byte before this field.
+  std::uint64_t checksum;
+};
+
+static_assert(sizeof(FileHeader) % 8 == 0, "sections must stay aligned");
+
+std::uint64_t header_checksum(const FileHeader &header)
+{
+  const auto *data = reinterpret_cast<const unsigned char *>(&header);
+  std::uint64_t hash = 14695981039346656037ULL;
+  for (std::size_t i = 0; i < offsetof(FileHeader, checksum); ++i)
+  {
+    hash ^= data[i];
+    hash *= 1099511628211ULL;
+  }
+  return hash;
+}
+
+std::uint64_t align8(std::uint64_t offset)
+{
+  return (offset + 7) & ~std::uint64_t{7};
+}
+
+std::string errno_message(const std::string &what)
+{
+  return what + ": " + std::strerror(errno);
+}
+
+class FileWriter
+{
+public:
+  explicit FileWriter(int fd) : fd_(fd) { buffer_.reserve(kWriteBuffer); }
+
+  void append(const void *data, std::size_t size)
+  {
+    if (buffer_.size() + size > kWriteBuffer)
+      flush();
+    if (size > kWriteBuffer)
+    {
+      write_all(static_cast<const char *>(data), size);
+      return;
+    }
+    buffer_.append(static_cast<const char *>(data), size);
+  }
+
+  void pad_to(std::uint64_t offset)
+  {
+    static const char zeros[8] = {};
+    append(zeros, static_cast<std::size_t>(offset - written()));
+  }
+
+  std::uint64_t written() const { return flushed_ + buffer_.size(); }
+
+  bool finish(std::string &error)
+  {
+    flush();
+    if (!failure_.empty())
+      error = failure_;
+    return failure_.empty();
+  }
+
+private:
+  void flush()
+  {
+    write_all(buffer_.data(), buffer_.size());
+    buffer_.clear();
+  }
+
+  void write_all(const char *data, std::size_t size)
+  {
+    flushed_ += size;
+    while (size > 0 && failure_.empty())
+    {
+      const ssize_t done = ::write(fd_, data, size);
+      if (done < 0 && errno == EINTR)
+        continue;
+      if (done < 0)
+      {
+        failure_ = errno_message("snapshot write failed");
+        return;
+      }
+      data += done;
+      size -= static_cast<std::size_t>(done);
+    }
+  }
+
+  int fd_;
+  std::string buffer_;
+  std::uint64_t flushed_{0};
+  std::string failure_;
+};
+
+// Writes the sections table by table, each in two passes over its rows: ids,
+// then value offsets, collecting the distinct values for the blob on the way.
+// The header goes in last, once the offsets are known.
+bool write_file(int fd, const join_server::SnapshotTable *(&tables)[kTables], std::uint64_t wal_lsn,
+                join_server::SnapshotProgress *progress, std::string &error)
+{
+  FileHeader header{};
+  std::memcpy(header.magic, kMagic, sizeof(kMagic));
+  header.version = kVersion;
+  header.tables = kTables;
+  header.wal_lsn = wal_lsn;
+
+  FileWriter out(fd);
+  const FileHeader placeholder{};
+  out.append(&placeholder, sizeof(placeholder));
+  std::string encoded;
+  for (std::size_t t = 0; t < kTables; ++t)
+  {
+    const auto &table = *tables[t];
+    auto &section = header.table[t];
+    section.rows = table.rows;
+    section.ids = out.written();
+    table.visit([&out](int id, std::string_view) { out.append(&id, sizeof(id)); });
+    out.pad_to(align8(out.written()));
+
+    section.refs = out.written();
+    std::unordered_map<std::string_view, std::uint64_t> offsets;
+    std::vector<std::string_view> distinct;
+    table.visit(
+        [&](int, std::string_view value)
+        {
+          const auto [it, inserted] = offsets.emplace(value, section.blob_size);
+          if (inserted)
+          {
+            distinct.push_back(value);
+            section.blob_size += join_server::ValueArena::encoded_size(value);
+          }
+          out.append(&it->second, sizeof(it->second));
+        });
+
+    section.blob = out.written();
+    for (const auto value : distinct)
+    {
+      encoded.resize(join_server::ValueArena::encoded_size(value));
+      join_server::ValueArena::encode(value, encoded.data());
+      out.append(encoded.data(), encoded.size());
+    }
+    out.pad_to(align8(out.written()));
+    if (progress != nullptr)
+      progress->rows_written.fetch_add(table.rows, std::memory_order_relaxed);
+  }
+  if (!out.finish(error))
+    return false;
+  header.checksum = header_checksum(header);
+
+  const auto *data = reinterpret_cast<const char *>(&header);
+  std::size_t done = 0;
+  while (done < sizeof(header))
+  {
+    const ssize_t written = ::pwrite(fd, data + done, sizeof(header) - done, static_cast<off_t>(done));
+    if (written < 0 && errno == EINTR)
+      continue;
+    if (written < 0)
+    {
+      error = errno_message("snapshot write failed");
+      return false;
+    }
+    done += static_cast<std::size_t>(written);
+  }
+  return true;
+}
+
+// Each column is bounded by the file before its size is computed, so a forged
+// row count cannot wrap the products around.
+bool valid_section(const TableHeader &section, std::uint64_t file_size)
+{
+  if (section.ids % 8 != 0 || section.refs % 8 != 0 || section.ids < sizeof(FileHeader) || section.ids > file_size ||
+      section.rows > (file_size - section.ids) / sizeof(int))
+    return false;
+  if (section.refs < section.ids + section.rows * sizeof(int) || section.refs > file_size ||
+      section.rows > (file_size - section.refs) / sizeof(std::uint64_t))
+    return false;
+  return section.blob >= section.refs + section.rows * sizeof(std::uint64_t) && section.blob <= file_size &&
+         section.blob_size <= file_size - section.blob;
+}
+
+// Ids strictly ascending and every value reference inside the blob. Reads
+// both columns once; the blob is only touched where the references point.
+// Linear in the rows, so only verify_snapshot() runs it.
+bool valid_rows(const TableHeader &section, const char *base)
+{
+  const auto count = static_cast<std::size_t>(section.rows);
+  const auto *ids = reinterpret_cast<const int *>(base + section.ids);
+  const auto *refs = reinterpret_cast<const join_server::ValueArena::Ref *>(base + section.refs);
+  const char *blob = base + section.blob;
+  const auto blob_size = static_cast<std::size_t>(section.blob_size);
+  for (std::size_t i = 0; i < count; ++i)
+  {
+    if ((i > 0 && ids[i - 1] >= ids[i]) || !join_server::ValueArena::encoded_within(blob, blob_size, refs[i]))
+      return false;
+  }
+  return true;
+}
+
+// Maps `path` and checks its header: O(1) in the size of the tables. A
+// missing file succeeds with a null `mapping`.
+bool open_snapshot(const std::string &path, std::shared_ptr<const void> &mapping, FileHeader &header,
+                   std::string &error)
+{
+  const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+  {
+    if (errno == ENOENT)
+      return true;
+    error = errno_message("cannot open snapshot " + path);
+    return false;
+  }
+
+  struct stat info = {};
+  if (::fstat(fd, &info) < 0 || static_cast<std::size_t>(info.st_size) < sizeof(FileHeader))
+  {
+    error = "snapshot " + path + " is truncated";
+    ::close(fd);
+    return false;
+  }
+
+  // Private writable mapping: pages stay shared with the page cache until
+  // something writes to them, which the tables never do.
+  const auto size = static_cast<std::size_t>(info.st_size);
+  void *addr = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  ::close(fd);
+  if (addr == MAP_FAILED)
+  {
+    error = errno_message("cannot map snapshot " + path);
+    return false;
+  }
+  std::shared_ptr<const void> mapped(addr, [size](const void *data) { ::munmap(const_cast<void *>(data), size); });
+
+  std::memcpy(&header, addr, sizeof(header));
+  if (std::memcmp(header.magic, kMagic, sizeof(kMagic)) != 0 || header.version != kVersion ||
+      header.tables != kTables || header.checksum != header_checksum(header) ||
+      !valid_section(header.table[0], size) || !valid_section(header.table[1], size))
+  {
+    error = "snapshot " + path + " is not a valid snapshot";
+    return false;
+  }
+  mapping = std::move(mapped);
+  return true;
+}
+
+} // namespace
+
+namespace join_server
+{
+
+bool write_snapshot(const SnapshotTable &table_a, const SnapshotTable &table_b, std::uint64_t wal_lsn,
+                    const std::string &path, std::string &error, SnapshotProgress *progress)
+{
+  if (progress != nullptr)
+    progress->rows_total.store(table_a.rows + table_b.rows, std::memory_order_relaxed);
+  const SnapshotTable *tables[kTables] = {&table_a, &table_b};
+
+  // A name of its own, so concurrent writers never share a half-written file.
+  std::string temp = path + ".XXXXXX";
+  const int fd = ::mkostemp(temp.data(), O_CLOEXEC);
+  if (fd < 0)
+  {
+    error = errno_message("cannot create " + temp);
+    return false;
+  }
+
+  // mkostemp creates the file readable by its owner only.
+  bool ok = true;
+  if (::fchmod(fd, 0644) < 0)
+  {
+    error = errno_message("cannot chmod " + temp);
+    ok = false;
+  }
+  ok = ok && write_file(fd, tables, wal_lsn, progress, error);
+  if (ok && ::fsync(fd) < 0)
+  {
+    error = errno_message("snapshot sync failed");
+    ok = false;
+  }
+  ::close(fd);
+  if (ok && ::rename(temp.c_str(), path.c_str()) < 0)
+  {
+    error = errno_message("cannot replace " + path);
+    ok = false;
+  }
+  if (!ok)
+    ::unlink(temp.c_str());
+  return ok;
+}
+
+bool map_snapshot(TablesStore &store, const std::string &path, std::size_t &rows, std::string &error,
+                  std::uint64_t *wal_lsn)
+{
+  rows = 0;
+  std::shared_ptr<const void> mapping;
+  FileHeader header{};
+  if (!open_snapshot(path, mapping, header, error))
+    return false;
+  if (mapping == nullptr)
+    return true;
+
+  const auto *base = static_cast<const char *>(mapping.get());
+  for (std::size_t t = 0; t < kTables; ++t)
+  {
+    const auto &section = header.table[t];
+    const auto count = static_cast<std::size_t>(section.rows);
+    const auto blob_size = static_cast<std::size_t>(section.blob_size);
+    auto arena = std::make_shared<ValueArena>(base + section.blob, blob_size, mapping);
+    auto run = std::make_shared<FlatTable::Run>();
+    run->keys = IdColumn::view(reinterpret_cast<const int *>(base + section.ids), count, mapping);
+    run->values = RefColumn(reinterpret_cast<const ValueArena::Ref *>(base + section.refs), count, mapping);
+    run->arena = arena;
+    store.restore(t == 0 ? TableId::A : TableId::B, std::move(arena), std::move(run));
+    rows += count;
+  }
+  if (wal_lsn != nullptr)
+    *wal_lsn = header.wal_lsn;
+  return true;
+}
+
+bool verify_snapshot(const std::string &path, std::string &error)
+{
+  std::shared_ptr<const void> mapping;
+  FileHeader header{};
+  if (!open_snapshot(path, mapping, header, error))
+    return false;
+  if (mapping == nullptr)
+    return true;
+
+  const auto *base = static_cast<const char *>(mapping.get());
+  if (!valid_rows(header.table[0], base) || !valid_rows(header.table[1], base))
+  {
+    error = "snapshot " + path + " is corrupt";
+    return false;
+  }
+  return true;
+}
+
+} // namespace join_server
@@ -1,41 +1,344 @@
 #include "join_server/tables.hpp"
 
+#include "join_server/flat_join.hpp"
+#include "join_server/join_views.hpp"
+#include "join_server/snapshot.hpp"
+#include "join_server/wal.hpp"
+
+#include <algorithm>
+#include <limits>
+
+namespace
+{
+
+// Ids decoded per step while a snapshot streams a flat run.
+constexpr std::size_t kSnapshotWindow = 1024;
+
+join_server::StoreOptions options_for(join_server::StorageEngine engine)
+{
+  join_server::StoreOptions options;
+  options.engine = engine;
+  return options;
+}
+
+// Snapshot writer input over rows collected with TablesStore::rows() or an
+// equivalent, which must outlive it.
+join_server::SnapshotTable result_table(join_server::TableId table, const join_server::JoinResult &result)
+{
+  return join_server::SnapshotTable{result.size(), [table, &result](const join_server::SnapshotTable::Visitor &visit)
+                                    {
+                                      for (const auto &row : result)
+                                        visit(row.id, table == join_server::TableId::A ? row.from_a : row.from_b);
+                                    }};
+}
+
+} // namespace
 
 namespace join_server
 {
 
-TablesStore::TablesStore() = default;
+TablesStore::TablesStore(StoreOptions options)
+    : engine_(options.engine),
+      join_threads_(std::max<std::size_t>(1, options.join_threads)),
+      snapshot_path_(std::move(options.snapshot_path)),
+      import_dir_(std::move(options.import_dir)),
+      arena_a_(std::make_shared<ValueArena>()),
+      arena_b_(std::make_shared<ValueArena>()),
+      flat_a_(options.compress_ids),
+      flat_b_(options.compress_ids),
+      views_(options.materialized_views ? std::make_unique<JoinViews>() : nullptr),
+      saver_(snapshot_path_.empty() ? nullptr : std::make_unique<BackgroundSaver>())
+{
+}
+
+TablesStore::TablesStore(StorageEngine engine) : TablesStore(options_for(engine)) {}
 
-bool TablesStore::insert(TableId table, int id, const std::string &value, std::string &error)
+TablesStore::~TablesStore() = default;
+
+void TablesStore::attach_wal(std::unique_ptr<WriteAheadLog> wal)
 {
-  std::lock_guard<std::mutex> lk(mtx_);
-  auto &target = table_ref(table);
-  const auto [it, inserted] = target.emplace(id, value);
-  if (!inserted)
+  wal_ = std::move(wal);
+}
+
+bool TablesStore::insert(TableId table, int id, std::string_view value, std::string &error)
+{
+  std::unique_lock<std::mutex> lk;
+  if (engine_ == StorageEngine::Map || views_ || wal_)
+    lk = std::unique_lock<std::mutex>(mutex_ref(table));
+
+  if (wal_ && !wal_->healthy(error))
+    return false;
+  if (!insert_row(table, id, value))
   {
     error = "duplicate " + std::to_string(id);
     return false;
   }
+  if (!wal_)
+    return true;
+
+  // Wait for the log outside the table lock so writers share a sync.
+  const auto lsn = wal_->append_insert(table, id, value);
+  if (lk.owns_lock())
+    lk.unlock();
+  return wal_->commit(lsn, error);
+}
+
+void TablesStore::insert_batch(const std::vector<InsertRow> &rows, std::vector<std::string> &errors)
+{
+  errors.assign(rows.size(), std::string());
+  if (engine_ == StorageEngine::Flat && !views_ && !wal_)
+  {
+    insert_flat_batch(rows, errors);
+    return;
+  }
+
+  bool uses[2] = {false, false};
+  for (const auto &row : rows)
+    uses[row.table == TableId::A ? 0 : 1] = true;
+
+  // Both locks, in A, B order, cover the whole batch.
+  std::unique_lock<std::mutex> lk_a;
+  std::unique_lock<std::mutex> lk_b;
+  if (uses[0])
+    lk_a = std::unique_lock<std::mutex>(mtx_a_);
+  if (uses[1])
+    lk_b = std::unique_lock<std::mutex>(mtx_b_);
+
+  std::string error;
+  if (wal_ && !wal_->healthy(error))
+  {
+    errors.assign(rows.size(), error);
+    return;
+  }
+
+  WriteAheadLog::Lsn lsn{};
+  bool logged = false;
+  for (std::size_t i = 0; i < rows.size(); ++i)
+  {
+    const auto &row = rows[i];
+    if (!insert_row(row.table, row.id, row.value))
+    {
+      errors[i] = "duplicate " + std::to_string(row.id);
+      continue;
+    }
+    if (wal_)
+    {
+      lsn = wal_->append_insert(row.table, row.id, row.value);
+      logged = true;
+    }
+  }
+  if (!logged)
+    return;
+
+  if (lk_a.owns_lock())
+    lk_a.unlock();
+  if (lk_b.owns_lock())
+    lk_b.unlock();
+  if (wal_->commit(lsn, error))
+    return;
+  for (auto &row_error : errors)
+  {
+    if (row_error.empty())
+      row_error = error;
+  }
+}
+
+void TablesStore::insert_flat_batch(const std::vector<InsertRow> &rows, std::vector<std::string> &errors)
+{
+  // Nothing else needs the store locks here, so each table takes its own
+  // writer lock once for its share of the batch.
+  std::vector<FlatTable::Row> share;
+  std::vector<std::size_t> positions;
+  std::vector<bool> inserted;
+  for (const auto table : {TableId::A, TableId::B})
+  {
+    share.clear();
+    positions.clear();
+    for (std::size_t i = 0; i < rows.size(); ++i)
+    {
+      if (rows[i].table != table)
+        continue;
+      share.push_back(FlatTable::Row{rows[i].id, rows[i].value});
+      positions.push_back(i);
+    }
+    if (share.empty())
+      continue;
+    flat_ref(table).insert_many(share, inserted);
+    for (std::size_t i = 0; i < share.size(); ++i)
+    {
+      if (!inserted[i])
+        errors[positions[i]] = "duplicate " + std::to_string(share[i].id);
+    }
+  }
+}
+
+bool TablesStore::insert_row(TableId table, int id, std::string_view value)
+{
+  std::string_view stored;
+  bool inserted = false;
+  if (engine_ == StorageEngine::Flat)
+  {
+    inserted = flat_ref(table).insert(id, value, &stored);
+  }
+  else
+  {
+    auto &target = table_ref(table);
+    const auto it = target.lower_bound(id);
+    inserted = it == target.end() || it->first != id;
+    if (inserted)
+    {
+      const auto &arena = arena_ref(table);
+      const auto ref = arena->intern(value);
+      target.emplace_hint(it, id, ref);
+      stored = arena->get(ref);
+    }
+  }
+  if (!inserted)
+    return false;
+
+  if (views_)
+  {
+    std::shared_ptr<const void> owner = engine_ == StorageEngine::Flat ? flat_ref(table).arena() : arena_ref(table);
+    views_->on_insert(table, id, stored, std::move(owner));
+  }
   return true;
 }
 
-void TablesStore::truncate(TableId table)
+bool TablesStore::load(TableId table, std::vector<FlatTable::Row> rows, std::string &error)
 {
-  std::lock_guard<std::mutex> lk(mtx_);
-  table_ref(table).clear();
+  FlatTable::sort_rows(rows);
+  const auto repeat = std::adjacent_find(rows.begin(), rows.end(),
+                                         [](const FlatTable::Row &lhs, const FlatTable::Row &rhs)
+                                         { return lhs.id == rhs.id; });
+  if (repeat != rows.end())
+  {
+    error = "duplicate " + std::to_string(repeat->id);
+    return false;
+  }
+  if (rows.empty())
+    return true;
+
+  std::unique_lock<std::mutex> lk;
+  if (engine_ == StorageEngine::Map || views_ || wal_)
+    lk = std::unique_lock<std::mutex>(mutex_ref(table));
+
+  if (wal_ && !wal_->healthy(error))
+    return false;
+  int duplicate = 0;
+  bool loaded = true;
+  if (engine_ == StorageEngine::Flat)
+  {
+    loaded = flat_ref(table).insert_sorted(rows, duplicate);
+  }
+  else
+  {
+    // Both passes walk the map alongside the sorted rows, so every insert
+    // lands next to its hint.
+    auto &target = table_ref(table);
+    auto it = target.lower_bound(rows.front().id);
+    for (const auto &row : rows)
+    {
+      while (it != target.end() && it->first < row.id)
+        ++it;
+      if (it != target.end() && it->first == row.id)
+      {
+        duplicate = row.id;
+        loaded = false;
+        break;
+      }
+    }
+    if (loaded)
+    {
+      const auto &arena = arena_ref(table);
+      auto hint = target.lower_bound(rows.front().id);
+      for (const auto &row : rows)
+      {
+        while (hint != target.end() && hint->first < row.id)
+          ++hint;
+        hint = std::next(target.emplace_hint(hint, row.id, arena->intern(row.value)));
+      }
+    }
+  }
+  if (!loaded)
+  {
+    error = "duplicate " + std::to_string(duplicate);
+    return false;
+  }
+
+  if (views_)
+  {
+    if (engine_ == StorageEngine::Flat)
+    {
+      const auto run = flat_ref(table).snapshot();
+      for (const auto &row : rows)
+        views_->on_insert(table, row.id, run->value(run->keys.lower_bound(row.id)), run->arena);
+    }
+    else
+    {
+      const auto &arena = arena_ref(table);
+      const auto &target = table_ref(table);
+      for (const auto &row : rows)
+        views_->on_insert(table, row.id, arena->get(target.find(row.id)->second), arena);
+    }
+  }
+  if (!wal_)
+    return true;
+
+  WriteAheadLog::Lsn lsn{};
+  for (const auto &row : rows)
+    lsn = wal_->append_insert(table, row.id, row.value);
+  lk.unlock();
+  return wal_->commit(lsn, error);
 }
 
-std::vector<DataRow> TablesStore::intersection() const
+bool TablesStore::truncate(TableId table, std::string &error)
 {
-  std::lock_guard<std::mutex> lk(mtx_);
-  std::vector<DataRow> rows;
+  std::unique_lock<std::mutex> lk;
+  if (engine_ == StorageEngine::Map || views_ || wal_)
+    lk = std::unique_lock<std::mutex>(mutex_ref(table));
+
+  if (wal_ && !wal_->healthy(error))
+    return false;
+  if (engine_ == StorageEngine::Flat)
+  {
+    flat_ref(table).clear();
+  }
+  else
+  {
+    table_ref(table).clear();
+    arena_ref(table) = std::make_shared<ValueArena>();
+  }
+
+  if (views_)
+    views_->on_truncate(table);
+  if (!wal_)
+    return true;
+
+  const auto lsn = wal_->append_truncate(table);
+  lk.unlock();
+  return wal_->commit(lsn, error);
+}
+
+JoinResult TablesStore::intersection() const
+{
+  if (views_)
+    return views_->intersection();
+  if (engine_ == StorageEngine::Flat)
+    return flat_join(JoinKind::Intersection);
+
+  // Both locks are always taken in A, B order.
+  std::lock_guard<std::mutex> lk_a(mtx_a_);
+  std::lock_guard<std::mutex> lk_b(mtx_b_);
+  JoinResult result;
+  result.owners = {arena_a_, arena_b_};
+  auto &rows = result.rows;
   auto it_a = table_a_.begin();
   auto it_b = table_b_.begin();
   while (it_a != table_a_.end() && it_b != table_b_.end())
   {
     if (it_a->first == it_b->first)
     {
-      rows.push_back(DataRow{it_a->first, it_a->second, it_b->second});
+      rows.push_back(DataRow{it_a->first, arena_a_->get(it_a->second), arena_b_->get(it_b->second)});
       ++it_a;
       ++it_b;
       continue;
@@ -49,26 +352,35 @@ std::vector<DataRow> TablesStore::intersection() const
       ++it_b;
     }
   }
-  return rows;
+  return result;
 }
 
-std::vector<DataRow> TablesStore::symmetric_difference() const
+JoinResult TablesStore::symmetric_difference() const
 {
-  std::lock_guard<std::mutex> lk(mtx_);
-  std::vector<DataRow> rows;
+  if (views_)
+    return views_->symmetric_difference();
+  if (engine_ == StorageEngine::Flat)
+    return flat_join(JoinKind::SymmetricDifference);
+
+  // Both locks are always taken in A, B order.
+  std::lock_guard<std::mutex> lk_a(mtx_a_);
+  std::lock_guard<std::mutex> lk_b(mtx_b_);
+  JoinResult result;
+  result.owners = {arena_a_, arena_b_};
+  auto &rows = result.rows;
   auto it_a = table_a_.begin();
   auto it_b = table_b_.begin();
   while (it_a != table_a_.end() || it_b != table_b_.end())
   {
     if (it_b == table_b_.end() || (it_a != table_a_.end() && it_a->first < it_b->first))
     {
-      rows.push_back(DataRow{it_a->first, it_a->second, {}});
+      rows.push_back(DataRow{it_a->first, arena_a_->get(it_a->second), {}});
       ++it_a;
       continue;
     }
     if (it_a == table_a_.end() || it_b->first < it_a->first)
     {
-      rows.push_back(DataRow{it_b->first, {}, it_b->second});
+      rows.push_back(DataRow{it_b->first, {}, arena_b_->get(it_b->second)});
       ++it_b;
       continue;
     }
@@ -77,7 +389,302 @@ std::vector<DataRow> TablesStore::symmetric_difference() const
     ++it_a;
     ++it_b;
   }
-  return rows;
+  return result;
+}
+
+bool TablesStore::visit_join(JoinKind kind, std::size_t chunk_rows, const RowSink &sink) const
+{
+  if (engine_ == StorageEngine::Flat && !views_)
+  {
+    const auto run_a = flat_a_.snapshot();
+    const auto run_b = flat_b_.snapshot();
+    return visit_runs(kind, *run_a, *run_b, join_threads_, chunk_rows, sink);
+  }
+
+  // Map tables and views have no immutable version to scan, so they are
+  // paged like a cursor and the locks are only held while a chunk is built.
+  chunk_rows = std::max<std::size_t>(1, chunk_rows);
+  int from = std::numeric_limits<int>::min();
+  for (;;)
+  {
+    JoinResult batch;
+    const bool more = join_batch(kind, from, chunk_rows, batch);
+    if (!batch.rows.empty() && !sink(batch.rows.data(), batch.size()))
+      return false;
+    if (!more)
+      return true;
+    from = batch.rows.back().id + 1;
+  }
+}
+
+bool TablesStore::join_batch(JoinKind kind, int from, std::size_t limit, JoinResult &batch) const
+{
+  if (views_)
+    return views_->batch(kind, from, limit, batch);
+  if (engine_ == StorageEngine::Flat)
+  {
+    const auto run_a = flat_a_.snapshot();
+    const auto run_b = flat_b_.snapshot();
+    batch.owners = {run_a, run_b};
+    return join_runs_from(kind, *run_a, *run_b, from, limit, batch.rows);
+  }
+
+  std::lock_guard<std::mutex> lk_a(mtx_a_);
+  std::lock_guard<std::mutex> lk_b(mtx_b_);
+  batch.owners = {arena_a_, arena_b_};
+  const bool intersection = kind == JoinKind::Intersection;
+  auto it_a = table_a_.lower_bound(from);
+  auto it_b = table_b_.lower_bound(from);
+  while (batch.size() < limit && (it_a != table_a_.end() || it_b != table_b_.end()))
+  {
+    if (it_a != table_a_.end() && it_b != table_b_.end() && it_a->first == it_b->first)
+    {
+      if (intersection)
+        batch.rows.push_back(DataRow{it_a->first, arena_a_->get(it_a->second), arena_b_->get(it_b->second)});
+      ++it_a;
+      ++it_b;
+      continue;
+    }
+    if (intersection && (it_a == table_a_.end() || it_b == table_b_.end()))
+      break;
+    if (it_b == table_b_.end() || (it_a != table_a_.end() && it_a->first < it_b->first))
+    {
+      if (!intersection)
+        batch.rows.push_back(DataRow{it_a->first, arena_a_->get(it_a->second), {}});
+      ++it_a;
+    }
+    else
+    {
+      if (!intersection)
+        batch.rows.push_back(DataRow{it_b->first, {}, arena_b_->get(it_b->second)});
+      ++it_b;
+    }
+  }
+  if (intersection)
+    return it_a != table_a_.end() && it_b != table_b_.end();
+  return it_a != table_a_.end() || it_b != table_b_.end();
+}
+
+JoinResult TablesStore::rows(TableId table) const
+{
+  if (engine_ == StorageEngine::Flat)
+    return run_rows(table, (table == TableId::A ? flat_a_ : flat_b_).snapshot());
+
+  std::lock_guard<std::mutex> lk(mutex_ref(table));
+  return map_rows(table);
+}
+
+JoinResult TablesStore::run_rows(TableId table, const FlatTable::Snapshot &run)
+{
+  JoinResult result;
+  result.owners = {run};
+  result.rows.reserve(run->keys.size());
+  const auto ids = run->keys.to_vector();
+  for (std::size_t i = 0; i < ids.size(); ++i)
+  {
+    const auto value = run->value(i);
+    result.rows.push_back(table == TableId::A ? DataRow{ids[i], value, {}} : DataRow{ids[i], {}, value});
+  }
+  return result;
+}
+
+JoinResult TablesStore::map_rows(TableId table) const
+{
+  const auto &arena = table == TableId::A ? arena_a_ : arena_b_;
+  JoinResult result;
+  result.owners = {arena};
+  for (const auto &[id, ref] : table_ref(table))
+  {
+    const auto value = arena->get(ref);
+    result.rows.push_back(table == TableId::A ? DataRow{id, value, {}} : DataRow{id, {}, value});
+  }
+  return result;
+}
+
+SnapshotTable TablesStore::snapshot_table(TableId table, FlatTable::Snapshot run) const
+{
+  if (run)
+  {
+    return SnapshotTable{run->keys.size(), [run](const SnapshotTable::Visitor &visit)
+                         {
+                           std::vector<int> scratch;
+                           const int *ids = nullptr;
+                           std::size_t pos = 0;
+                           while (pos < run->keys.size())
+                           {
+                             const std::size_t count = run->keys.window(pos, kSnapshotWindow, ids, scratch);
+                             for (std::size_t i = 0; i < count; ++i)
+                               visit(ids[i], run->value(pos + i));
+                             pos += count;
+                           }
+                         }};
+  }
+
+  const auto &rows = table_ref(table);
+  const auto &arena = table == TableId::A ? arena_a_ : arena_b_;
+  return SnapshotTable{rows.size(), [&rows, &arena](const SnapshotTable::Visitor &visit)
+                       {
+                         for (const auto &[id, ref] : rows)
+                           visit(id, arena->get(ref));
+                       }};
+}
+
+void TablesStore::restore(TableId table, std::shared_ptr<ValueArena> arena, FlatTable::Snapshot run)
+{
+  std::lock_guard<std::mutex> lk(mutex_ref(table));
+  if (views_)
+    views_->on_truncate(table);
+
+  std::shared_ptr<const void> owner = arena;
+  if (engine_ == StorageEngine::Flat)
+  {
+    flat_ref(table).reset(std::move(arena), run);
+    if (!views_)
+      return;
+  }
+  else
+  {
+    table_ref(table).clear();
+    arena_ref(table) = std::make_shared<ValueArena>();
+    owner = arena_ref(table);
+  }
+
+  auto &target = table_ref(table);
+  const auto &own = arena_ref(table);
+  const auto ids = run->keys.to_vector();
+  for (std::size_t i = 0; i < ids.size(); ++i)
+  {
+    auto value = run->value(i);
+    if (engine_ == StorageEngine::Map)
+    {
+      const auto ref = own->intern(value);
+      target.emplace_hint(target.end(), ids[i], ref);
+      value = own->get(ref);
+    }
+    if (views_)
+      views_->on_insert(table, ids[i], value, owner);
+  }
+}
+
+bool TablesStore::save_snapshot(std::string &error) const
+{
+  if (snapshot_path_.empty())
+  {
+    error = "snapshots are disabled";
+    return false;
+  }
+  std::lock_guard<std::mutex> save(save_mtx_);
+  if (saver_->stats().in_progress)
+  {
+    error = "background save in progress";
+    return false;
+  }
+
+  // Under both locks the tables hold exactly the changes logged so far, so
+  // the log can drop those records once the file is durable. Flat runs are
+  // folded first, which makes pinning them under the locks cheap; map rows
+  // are copied, so writers only wait for the copy.
+  const bool flat = engine_ == StorageEngine::Flat;
+  if (flat)
+  {
+    flat_a_.snapshot();
+    flat_b_.snapshot();
+  }
+  FlatTable::Snapshot run_a;
+  FlatTable::Snapshot run_b;
+  JoinResult rows_a;
+  JoinResult rows_b;
+  WriteAheadLog::Position position;
+  {
+    std::lock_guard<std::mutex> lk_a(mtx_a_);
+    std::lock_guard<std::mutex> lk_b(mtx_b_);
+    if (flat)
+    {
+      run_a = flat_a_.snapshot();
+      run_b = flat_b_.snapshot();
+    }
+    else
+    {
+      rows_a = map_rows(TableId::A);
+      rows_b = map_rows(TableId::B);
+    }
+    if (wal_)
+      position = wal_->position();
+  }
+  const auto table_a = flat ? snapshot_table(TableId::A, run_a) : result_table(TableId::A, rows_a);
+  const auto table_b = flat ? snapshot_table(TableId::B, run_b) : result_table(TableId::B, rows_b);
+  if (!write_snapshot(table_a, table_b, position.lsn, snapshot_path_, error))
+    return false;
+  return !wal_ || wal_->checkpoint(position, error);
+}
+
+bool TablesStore::background_save(std::string &error)
+{
+  if (!saver_)
+  {
+    error = "snapshots are disabled";
+    return false;
+  }
+  std::unique_lock<std::mutex> save(save_mtx_, std::try_to_lock);
+  if (!save.owns_lock())
+  {
+    error = "snapshot in progress";
+    return false;
+  }
+
+  // Holding both locks across fork() gives the child a consistent image of
+  // the map tables and of the log position. Flat runs are immutable, so they
+  // are folded before writers are paused and pinned under the locks, and the
+  // child never touches the atomics behind FlatTable::snapshot(). The child
+  // streams rows from its copy-on-write image without collecting them.
+  const bool flat = engine_ == StorageEngine::Flat;
+  if (flat)
+  {
+    flat_a_.snapshot();
+    flat_b_.snapshot();
+  }
+  const auto paused = BackgroundSaver::Clock::now();
+  std::lock_guard<std::mutex> lk_a(mtx_a_);
+  std::lock_guard<std::mutex> lk_b(mtx_b_);
+  FlatTable::Snapshot run_a;
+  FlatTable::Snapshot run_b;
+  if (flat)
+  {
+    run_a = flat_a_.snapshot();
+    run_b = flat_b_.snapshot();
+  }
+  WriteAheadLog::Position position;
+  if (wal_)
+    position = wal_->position();
+  return saver_->start(
+      [&](SnapshotProgress &progress)
+      {
+        std::string child_error;
+        return write_snapshot(snapshot_table(TableId::A, run_a), snapshot_table(TableId::B, run_b), position.lsn,
+                              snapshot_path_, child_error, &progress);
+      },
+      [this, position]
+      {
+        std::string checkpoint_error;
+        return !wal_ || wal_->checkpoint(position, checkpoint_error);
+      },
+      paused, error);
+}
+
+BackgroundSaveStats TablesStore::background_save_stats() const
+{
+  return saver_ ? saver_->stats() : BackgroundSaveStats{};
+}
+
+JoinResult TablesStore::flat_join(JoinKind kind) const
+{
+  const auto run_a = flat_a_.snapshot();
+  const auto run_b = flat_b_.snapshot();
+
+  JoinResult result;
+  result.owners = {run_a, run_b};
+  join_runs(kind, *run_a, *run_b, join_threads_, result.rows);
+  return result;
 }
 
 TablesStore::Table &TablesStore::table_ref(TableId table)
@@ -90,4 +697,19 @@ const TablesStore::Table &TablesStore::table_ref(TableId table) const
   return table == TableId::A ? table_a_ : table_b_;
 }
 
+std::shared_ptr<ValueArena> &TablesStore::arena_ref(TableId table)
+{
+  return table == TableId::A ? arena_a_ : arena_b_;
+}
+
+std::mutex &TablesStore::mutex_ref(TableId table) const
+{
+  return table == TableId::A ? mtx_a_ : mtx_b_;
+}
+
+FlatTable &TablesStore::flat_ref(TableId table)
+{
+  return table == TableId::A ? flat_a_ : flat_b_;
+}
+
 } // namespace join_server
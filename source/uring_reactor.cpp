@@ -0,0 +1,736 @@
+#include "join_server/uring_reactor.hpp"
+
+#include "join_server/io_stats.hpp"
+
+#include <cerrno>
+#include <cstring>
+#include <linux/io_uring.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <iostream>
+#include <stdexcept>
+#include <thread>
+
+namespace
+{
+
+constexpr unsigned kRingEntries = 1024;
+constexpr unsigned kBufferCount = 512;
+constexpr std::size_t kBufferSize = 16 * 1024;
+constexpr std::uint16_t kBufferGroup = 1;
+// Received input a connection may queue before its receive is cancelled;
+// it is re-armed once the worker has taken the input.
+constexpr std::size_t kMaxBufferedInput = 1024 * 1024;
+// Replies the reactor has not taken for sending yet. Past kParkOutput a
+// connection runs no more commands until they have been taken, and a join
+// pauses between chunks; past kMaxQueuedOutput, which only a single huge
+// non-join reply reaches, or once a send has made no progress for
+// kStallTimeout, the connection is closed.
+constexpr std::size_t kParkOutput = 256 * 1024;
+constexpr std::size_t kMaxQueuedOutput = 64 * 1024 * 1024;
+constexpr std::chrono::seconds kStallTimeout{30};
+// How often the reactor looks for stalled sends.
+const __kernel_timespec kSweepInterval{1, 0};
+
+// Low bits of user_data name the operation, the rest the connection.
+enum Op : std::uint64_t
+{
+  kAccept = 1,
+  kReceive = 2,
+  kSend = 3,
+  kWake = 4,
+  kCancel = 5,
+  kProvide = 6,
+  kProbe = 7,
+  kSweep = 8
+};
+constexpr unsigned kOpBits = 4;
+
+std::uint64_t tag(std::uint64_t id, Op op)
+{
+  return id << kOpBits | op;
+}
+
+std::string errno_message(const std::string &what)
+{
+  return what + ": " + std::strerror(errno);
+}
+
+} // namespace
+
+namespace join_server
+{
+
+// Submission and completion queues of one io_uring instance.
+class UringReactor::Ring
+{
+public:
+  explicit Ring(unsigned entries)
+  {
+    io_uring_params params{};
+    params.flags = IORING_SETUP_CQSIZE;
+    // Multishot requests complete many times per submission.
+    params.cq_entries = entries * 4;
+    fd_ = static_cast<int>(::syscall(__NR_io_uring_setup, entries, &params));
+    if (fd_ < 0)
+      throw std::runtime_error(errno_message("io_uring_setup failed"));
+    if ((params.features & IORING_FEAT_SINGLE_MMAP) == 0 || (params.features & IORING_FEAT_NODROP) == 0)
+    {
+      ::close(fd_);
+      throw std::runtime_error("io_uring lacks single mmap or overflow-safe completions");
+    }
+
+    ring_bytes_ = std::max<std::size_t>(params.sq_off.array + params.sq_entries * sizeof(unsigned),
+                                        params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe));
+    sqe_bytes_ = params.sq_entries * sizeof(io_uring_sqe);
+    ring_ = ::mmap(nullptr, ring_bytes_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_SQ_RING);
+    void *sqes = ::mmap(nullptr, sqe_bytes_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_SQES);
+    if (ring_ == MAP_FAILED || sqes == MAP_FAILED)
+    {
+      const auto err = errno_message("cannot map io_uring");
+      if (ring_ != MAP_FAILED)
+        ::munmap(ring_, ring_bytes_);
+      if (sqes != MAP_FAILED)
+        ::munmap(sqes, sqe_bytes_);
+      ::close(fd_);
+      throw std::runtime_error(err);
+    }
+
+    auto *base = static_cast<char *>(ring_);
+    sq_head_ = reinterpret_cast<unsigned *>(base + params.sq_off.head);
+    sq_tail_ = reinterpret_cast<unsigned *>(base + params.sq_off.tail);
+    sq_mask_ = *reinterpret_cast<unsigned *>(base + params.sq_off.ring_mask);
+    sq_array_ = reinterpret_cast<unsigned *>(base + params.sq_off.array);
+    cq_head_ = reinterpret_cast<unsigned *>(base + params.cq_off.head);
+    cq_tail_ = reinterpret_cast<unsigned *>(base + params.cq_off.tail);
+    cq_mask_ = *reinterpret_cast<unsigned *>(base + params.cq_off.ring_mask);
+    cqes_ = reinterpret_cast<io_uring_cqe *>(base + params.cq_off.cqes);
+    sqes_ = static_cast<io_uring_sqe *>(sqes);
+    entries_ = params.sq_entries;
+    tail_ = *sq_tail_;
+    submitted_ = tail_;
+  }
+
+  ~Ring()
+  {
+    ::munmap(sqes_, sqe_bytes_);
+    ::munmap(ring_, ring_bytes_);
+    ::close(fd_);
+  }
+
+  Ring(const Ring &) = delete;
+  Ring &operator=(const Ring &) = delete;
+
+  int fd() const { return fd_; }
+
+  // Next free submission entry, zeroed; submits the queue first if full.
+  io_uring_sqe &next()
+  {
+    if (tail_ - __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE) >= entries_)
+      enter(0);
+    const unsigned index = tail_ & sq_mask_;
+    auto &entry = sqes_[index];
+    std::memset(&entry, 0, sizeof(entry));
+    sq_array_[index] = index;
+    ++tail_;
+    return entry;
+  }
+
+  // Submits everything queued and waits for `wait` completions. Returns a
+  // negative errno on failure.
+  int enter(unsigned wait)
+  {
+    __atomic_store_n(sq_tail_, tail_, __ATOMIC_RELEASE);
+    count_io_syscall();
+    const long done = ::syscall(__NR_io_uring_enter, fd_, tail_ - submitted_, wait,
+                                wait > 0 ? IORING_ENTER_GETEVENTS : 0, nullptr, 0);
+    if (done < 0)
+      return -errno;
+    submitted_ += static_cast<unsigned>(done);
+    return 0;
+  }
+
+  template <typename Handler>
+  void reap(Handler &&handle)
+  {
+    unsigned head = *cq_head_;
+    const unsigned tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+    for (; head != tail; ++head)
+    {
+      const io_uring_cqe cqe = cqes_[head & cq_mask_];
+      __atomic_store_n(cq_head_, head + 1, __ATOMIC_RELEASE);
+      handle(cqe);
+    }
+  }
+
+private:
+  int fd_{-1};
+  void *ring_{nullptr};
+  std::size_t ring_bytes_{0};
+  std::size_t sqe_bytes_{0};
+  unsigned *sq_head_{nullptr};
+  unsigned *sq_tail_{nullptr};
+  unsigned sq_mask_{0};
+  unsigned *sq_array_{nullptr};
+  unsigned *cq_head_{nullptr};
+  unsigned *cq_tail_{nullptr};
+  unsigned cq_mask_{0};
+  io_uring_cqe *cqes_{nullptr};
+  io_uring_sqe *sqes_{nullptr};
+  unsigned entries_{0};
+  // Local tail, and how far the kernel has consumed it.
+  unsigned tail_{0};
+  unsigned submitted_{0};
+};
+
+struct UringReactor::Connection
+{
+  Connection(std::uint64_t key, int socket, TablesStore &store, const CommandScheduler &scheduler)
+      : id(key), fd(socket), session(store, &scheduler)
+  {
+  }
+  ~Connection() { ::close(fd); }
+
+  const std::uint64_t id;
+  const int fd;
+  Session session;
+
+  // Shared between the reactor and the worker task; guards what follows.
+  std::mutex mtx;
+  std::string input;
+  std::string output;
+  bool scheduled{false};
+  bool throttled{false};
+  bool eof{false};
+  // The task gave up its worker until `output` is taken, then `resume` runs.
+  bool parked{false};
+  TaskClass resume{TaskClass::Write};
+  // The worker is done with the connection: close it once replies are out.
+  bool finished{false};
+  // A send failed or stalled; further replies are dropped.
+  bool broken{false};
+
+  // Owned by the scheduled worker.
+  std::string pending;
+
+  // Reactor thread only.
+  std::string sending;
+  std::size_t sent{0};
+  bool send_in_flight{false};
+  // When the send in flight was submitted.
+  std::chrono::steady_clock::time_point send_started;
+  bool receive_armed{false};
+  bool shut_down{false};
+};
+
+UringReactor::UringReactor(int listener, TablesStore &store, CommandScheduler &scheduler)
+    : listener_(listener), store_(store), scheduler_(scheduler)
+{
+  ring_ = std::make_unique<Ring>(kRingEntries);
+  buffers_.reset(new char[kBufferCount * kBufferSize]);
+  provide_buffers(0, kBufferCount);
+  std::string error;
+  if (!probe_multishot_receive(error))
+    throw std::runtime_error(error);
+
+  wake_fd_ = ::eventfd(0, EFD_CLOEXEC);
+  if (wake_fd_ < 0)
+    throw std::runtime_error(errno_message("eventfd failed"));
+}
+
+bool UringReactor::probe_multishot_receive(std::string &error)
+{
+  // A multishot receive on a socket pair with data waiting must complete
+  // with more to come; kernels without the flag reject it or run it once.
+  int pair[2];
+  if (::socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, pair) < 0)
+  {
+    error = errno_message("socketpair failed");
+    return false;
+  }
+  const char byte = 0;
+  bool works = false;
+  bool answered = false;
+  bool more = true;
+  if (::write(pair[1], &byte, 1) != 1)
+  {
+    error = errno_message("cannot probe io_uring");
+    more = false;
+  }
+  else
+  {
+    auto &sqe = ring_->next();
+    sqe.opcode = IORING_OP_RECV;
+    sqe.fd = pair[0];
+    sqe.ioprio = IORING_RECV_MULTISHOT;
+    sqe.flags = IOSQE_BUFFER_SELECT;
+    sqe.buf_group = kBufferGroup;
+    sqe.user_data = tag(0, kProbe);
+  }
+  while (more)
+  {
+    const int status = ring_->enter(1);
+    if (status < 0 && status != -EINTR)
+    {
+      error = std::string("io_uring_enter failed: ") + std::strerror(-status);
+      break;
+    }
+    ring_->reap(
+        [&](const io_uring_cqe &cqe)
+        {
+          if (static_cast<Op>(cqe.user_data & ((1U << kOpBits) - 1)) != kProbe)
+            return;
+          if ((cqe.flags & IORING_CQE_F_BUFFER) != 0)
+            provide_buffers(static_cast<std::uint16_t>(cqe.flags >> IORING_CQE_BUFFER_SHIFT), 1);
+          more = (cqe.flags & IORING_CQE_F_MORE) != 0;
+          if (!answered)
+          {
+            answered = true;
+            works = cqe.res == 1 && more;
+            // The peer going away ends the receive.
+            ::shutdown(pair[1], SHUT_RDWR);
+          }
+        });
+  }
+  ::close(pair[0]);
+  ::close(pair[1]);
+  if (answered && !works)
+    error = "io_uring cannot run multishot receives (Linux 6.0 or newer needed)";
+  return works;
+}
+
+UringReactor::~UringReactor()
+{
+  stopping_.store(true);
+  while (tasks_.load() != 0)
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  // Closing the ring cancels whatever is still armed before the buffers go.
+  ring_.reset();
+  connections_.clear();
+  ::close(wake_fd_);
+}
+
+void UringReactor::stop()
+{
+  stopping_.store(true);
+  const std::uint64_t one = 1;
+  while (::write(wake_fd_, &one, sizeof(one)) < 0 && errno == EINTR)
+  {
+  }
+}
+
+void UringReactor::run()
+{
+  arm_accept();
+  arm_wake();
+  arm_sweep();
+  while (!stopping_.load())
+  {
+    const int status = ring_->enter(1);
+    if (status < 0 && status != -EINTR && status != -EBUSY)
+    {
+      std::cerr << "io_uring_enter failed: " << std::strerror(-status) << std::endl;
+      return;
+    }
+
+    ring_->reap(
+        [this](const io_uring_cqe &cqe)
+        {
+          const auto op = static_cast<Op>(cqe.user_data & ((1U << kOpBits) - 1));
+          if (op == kAccept)
+          {
+            on_accept(cqe.res, cqe.flags);
+            return;
+          }
+          if (op == kWake)
+          {
+            on_wake();
+            return;
+          }
+          if (op == kSweep)
+          {
+            close_stalled();
+            return;
+          }
+          if (op == kCancel || op == kProvide)
+            return;
+
+          const auto it = connections_.find(cqe.user_data >> kOpBits);
+          if (it == connections_.end())
+            return;
+          const auto connection = it->second;
+          if (op == kReceive)
+            on_receive(*connection, cqe.res, cqe.flags);
+          else
+            on_send(*connection, cqe.res);
+          maybe_close(*connection);
+        });
+  }
+}
+
+void UringReactor::arm_accept()
+{
+  auto &sqe = ring_->next();
+  sqe.opcode = IORING_OP_ACCEPT;
+  sqe.fd = listener_;
+  sqe.ioprio = IORING_ACCEPT_MULTISHOT;
+  sqe.accept_flags = SOCK_CLOEXEC;
+  sqe.user_data = tag(0, kAccept);
+}
+
+void UringReactor::arm_wake()
+{
+  auto &sqe = ring_->next();
+  sqe.opcode = IORING_OP_READ;
+  sqe.fd = wake_fd_;
+  sqe.addr = reinterpret_cast<std::uint64_t>(&wake_value_);
+  sqe.len = sizeof(wake_value_);
+  sqe.user_data = tag(0, kWake);
+}
+
+void UringReactor::arm_sweep()
+{
+  auto &sqe = ring_->next();
+  sqe.opcode = IORING_OP_TIMEOUT;
+  sqe.addr = reinterpret_cast<std::uint64_t>(&kSweepInterval);
+  sqe.len = 1;
+  sqe.user_data = tag(0, kSweep);
+}
+
+void UringReactor::arm_receive(Connection &connection)
+{
+  auto &sqe = ring_->next();
+  sqe.opcode = IORING_OP_RECV;
+  sqe.fd = connection.fd;
+  sqe.ioprio = IORING_RECV_MULTISHOT;
+  sqe.flags = IOSQE_BUFFER_SELECT;
+  sqe.buf_group = kBufferGroup;
+  sqe.user_data = tag(connection.id, kReceive);
+  connection.receive_armed = true;
+}
+
+void UringReactor::on_accept(int result, std::uint32_t flags)
+{
+  if (result >= 0)
+  {
+    auto connection = std::make_shared<Connection>(next_id_++, result, store_, scheduler_);
+    arm_receive(*connection);
+    connections_.emplace(connection->id, std::move(connection));
+  }
+  else if (result != -EINTR && result != -ECONNABORTED)
+  {
+    std::cerr << "accept failed: " << std::strerror(-result) << std::endl;
+  }
+  if ((flags & IORING_CQE_F_MORE) == 0 && !stopping_.load())
+    arm_accept();
+}
+
+void UringReactor::on_receive(Connection &connection, int result, std::uint32_t flags)
+{
+  const bool more = (flags & IORING_CQE_F_MORE) != 0;
+  if (!more)
+    connection.receive_armed = false;
+
+  bool start_task = false;
+  bool cancel = false;
+  bool rearm = false;
+  {
+    std::lock_guard<std::mutex> lk(connection.mtx);
+    if (result > 0 && (flags & IORING_CQE_F_BUFFER) != 0)
+    {
+      const auto id = static_cast<std::uint16_t>(flags >> IORING_CQE_BUFFER_SHIFT);
+      connection.input.append(buffers_.get() + std::size_t{id} * kBufferSize, static_cast<std::size_t>(result));
+      provide_buffers(id, 1);
+      if (connection.input.size() >= kMaxBufferedInput && !connection.throttled)
+      {
+        connection.throttled = true;
+        cancel = more;
+      }
+    }
+    else if (result != -ENOBUFS && result != -ECANCELED)
+    {
+      // End of stream or a socket error.
+      connection.eof = true;
+    }
+    rearm = !more && !connection.eof && !connection.throttled && !connection.finished;
+    if (!connection.scheduled && !connection.finished && (!connection.input.empty() || connection.eof))
+    {
+      connection.scheduled = true;
+      start_task = true;
+    }
+  }
+
+  if (rearm)
+    arm_receive(connection);
+  if (cancel)
+  {
+    auto &sqe = ring_->next();
+    sqe.opcode = IORING_OP_ASYNC_CANCEL;
+    sqe.addr = tag(connection.id, kReceive);
+    sqe.user_data = tag(connection.id, kCancel);
+  }
+  if (start_task)
+  {
+    tasks_.fetch_add(1);
+    schedule(connections_.at(connection.id), TaskClass::Write);
+  }
+}
+
+void UringReactor::on_send(Connection &connection, int result)
+{
+  connection.send_in_flight = false;
+  if (result < 0)
+  {
+    connection.sending.clear();
+    connection.sent = 0;
+    std::lock_guard<std::mutex> lk(connection.mtx);
+    break_locked(connection);
+    return;
+  }
+  connection.sent += static_cast<std::size_t>(result);
+  start_send(connection);
+}
+
+void UringReactor::break_locked(Connection &connection)
+{
+  connection.broken = true;
+  connection.output.clear();
+  // A running task fails its next reply and finishes; otherwise nothing
+  // else will.
+  if (!connection.scheduled || connection.parked)
+  {
+    connection.parked = false;
+    connection.finished = true;
+  }
+}
+
+void UringReactor::close_stalled()
+{
+  if (stopping_.load())
+    return;
+  const auto now = std::chrono::steady_clock::now();
+  for (const auto &entry : connections_)
+  {
+    auto &connection = *entry.second;
+    if (!connection.send_in_flight || now - connection.send_started < kStallTimeout || connection.shut_down)
+      continue;
+    {
+      std::lock_guard<std::mutex> lk(connection.mtx);
+      break_locked(connection);
+    }
+    // Fails the send in flight and ends the receive; maybe_close() follows.
+    count_io_syscall();
+    ::shutdown(connection.fd, SHUT_RDWR);
+    connection.shut_down = true;
+  }
+  arm_sweep();
+}
+
+void UringReactor::on_wake()
+{
+  if (stopping_.load())
+    return;
+  {
+    std::lock_guard<std::mutex> lk(ready_mtx_);
+    ready_swap_.swap(ready_);
+  }
+  for (const auto id : ready_swap_)
+  {
+    const auto it = connections_.find(id);
+    if (it == connections_.end())
+      continue;
+    auto &connection = *it->second;
+    start_send(connection);
+    bool resume = false;
+    {
+      std::lock_guard<std::mutex> lk(connection.mtx);
+      resume = !connection.receive_armed && !connection.throttled && !connection.eof && !connection.finished;
+    }
+    if (resume)
+      arm_receive(connection);
+    maybe_close(connection);
+  }
+  ready_swap_.clear();
+  arm_wake();
+}
+
+void UringReactor::start_send(Connection &connection)
+{
+  if (connection.send_in_flight)
+    return;
+  if (connection.sent == connection.sending.size())
+  {
+    connection.sending.clear();
+    connection.sent = 0;
+    std::lock_guard<std::mutex> lk(connection.mtx);
+    if (connection.output.empty())
+      return;
+    connection.sending.swap(connection.output);
+    if (connection.parked)
+    {
+      connection.parked = false;
+      tasks_.fetch_add(1);
+      schedule(connections_.at(connection.id), connection.resume);
+    }
+  }
+
+  auto &sqe = ring_->next();
+  sqe.opcode = IORING_OP_SEND;
+  sqe.fd = connection.fd;
+  sqe.addr = reinterpret_cast<std::uint64_t>(connection.sending.data() + connection.sent);
+  sqe.len = static_cast<std::uint32_t>(connection.sending.size() - connection.sent);
+  sqe.msg_flags = MSG_NOSIGNAL;
+  sqe.user_data = tag(connection.id, kSend);
+  connection.send_in_flight = true;
+  connection.send_started = std::chrono::steady_clock::now();
+}
+
+void UringReactor::maybe_close(Connection &connection)
+{
+  if (connection.send_in_flight)
+    return;
+  {
+    std::lock_guard<std::mutex> lk(connection.mtx);
+    if (!connection.finished || !connection.output.empty())
+      return;
+  }
+  if (connection.receive_armed)
+  {
+    // Ends the armed receive; the connection goes with its last completion.
+    if (!connection.shut_down)
+    {
+      count_io_syscall();
+      ::shutdown(connection.fd, SHUT_RDWR);
+      connection.shut_down = true;
+    }
+    return;
+  }
+  connections_.erase(connection.id);
+}
+
+void UringReactor::provide_buffers(std::uint16_t first, unsigned count)
+{
+  // Goes out with the next io_uring_enter, ahead of any receive re-armed there.
+  auto &sqe = ring_->next();
+  sqe.opcode = IORING_OP_PROVIDE_BUFFERS;
+  sqe.fd = static_cast<int>(count);
+  sqe.addr = reinterpret_cast<std::uint64_t>(buffers_.get() + std::size_t{first} * kBufferSize);
+  sqe.len = static_cast<std::uint32_t>(kBufferSize);
+  sqe.off = first;
+  sqe.buf_group = kBufferGroup;
+  sqe.user_data = tag(0, kProvide);
+}
+
+void UringReactor::schedule(const std::shared_ptr<Connection> &connection, TaskClass task_class)
+{
+  scheduler_.submit(task_class, [this, connection, task_class] { process(connection, task_class); });
+}
+
+void UringReactor::process(const std::shared_ptr<Connection> &connection, TaskClass task_class)
+{
+  auto &conn = *connection;
+  ResponseBuffer out([this, &conn](std::string_view data) { return queue_reply(conn, data); },
+                     [&conn]
+                     {
+                       std::lock_guard<std::mutex> lk(conn.mtx);
+                       return conn.output.size() > kParkOutput;
+                     });
+  bool open = true;
+  bool finished = false;
+  // A scan task first runs the join a write task stopped in front of.
+  bool run_pending = task_class == TaskClass::Scan;
+  for (;;)
+  {
+    bool resume = false;
+    {
+      std::lock_guard<std::mutex> lk(conn.mtx);
+      if (open && conn.input.empty() && !conn.eof && !run_pending)
+      {
+        conn.scheduled = false;
+        if (conn.pending.empty())
+          conn.pending.shrink_to_fit();
+        break;
+      }
+      if (!open || (conn.input.empty() && !run_pending))
+      {
+        conn.finished = true;
+        finished = true;
+        break;
+      }
+      run_pending = false;
+      conn.pending.append(conn.input);
+      conn.input.clear();
+      if (conn.input.capacity() > kBufferSize)
+        conn.input.shrink_to_fit();
+      resume = conn.throttled;
+      conn.throttled = false;
+    }
+    if (resume)
+      notify(conn.id);
+    open = conn.session.run(conn.pending, out, task_class == TaskClass::Scan);
+    open = out.flush() && open;
+    if (!open)
+      continue;
+    // Joins go through the scan queue, paused ones too; the slot is given
+    // back right after.
+    const auto next =
+        conn.session.stopped_before_scan() || conn.session.paused() ? TaskClass::Scan : TaskClass::Write;
+    {
+      // A client that does not read its replies holds up its own commands,
+      // not a worker; the reactor resumes them once it takes the output.
+      std::lock_guard<std::mutex> lk(conn.mtx);
+      if (conn.output.size() > kParkOutput)
+      {
+        conn.parked = true;
+        conn.resume = next;
+        tasks_.fetch_sub(1);
+        return;
+      }
+    }
+    if (next == TaskClass::Scan || task_class == TaskClass::Scan)
+    {
+      schedule(connection, next);
+      return;
+    }
+  }
+  // Queued replies have already woken the reactor; closing needs its own word.
+  if (finished)
+    notify(conn.id);
+  tasks_.fetch_sub(1);
+}
+
+bool UringReactor::queue_reply(Connection &connection, std::string_view data)
+{
+  {
+    std::lock_guard<std::mutex> lk(connection.mtx);
+    if (connection.broken || stopping_.load() || connection.output.size() + data.size() > kMaxQueuedOutput)
+      return false;
+    connection.output.append(data);
+  }
+  notify(connection.id);
+  return true;
+}
+
+void UringReactor::notify(std::uint64_t id)
+{
+  bool wake = false;
+  {
+    std::lock_guard<std::mutex> lk(ready_mtx_);
+    wake = ready_.empty();
+    ready_.push_back(id);
+  }
+  if (!wake)
+    return;
+  const std::uint64_t one = 1;
+  count_io_syscall();
+  while (::write(wake_fd_, &one, sizeof(one)) < 0 && errno == EINTR)
+  {
+  }
+}
+
+} // namespace join_server
@@ -0,0 +1,198 @@
+#include "join_server/value_arena.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <functional>
+#include <stdexcept>
+
+namespace
+{
+
+using Ref = join_server::ValueArena::Ref;
+
+constexpr unsigned kOffsetBits = 40;
+constexpr Ref kOffsetMask = (Ref{1} << kOffsetBits) - 1;
+
+constexpr std::size_t kPageBits = 12;
+constexpr std::size_t kPageSize = std::size_t{1} << kPageBits;
+constexpr std::size_t kDirectoryPages = 1024;
+
+constexpr std::size_t kFirstChunkSize = 64 * 1024;
+constexpr std::size_t kMaxChunkSize = 1024 * 1024;
+constexpr std::size_t kMaxVarintBytes = 10;
+
+constexpr Ref kEmptySlot = ~Ref{0};
+constexpr std::size_t kInitialIndexSize = 1024;
+
+std::size_t encode_varint(std::size_t value, char *out)
+{
+  std::size_t written = 0;
+  while (value >= 0x80)
+  {
+    out[written++] = static_cast<char>((value & 0x7F) | 0x80);
+    value >>= 7;
+  }
+  out[written++] = static_cast<char>(value);
+  return written;
+}
+
+std::size_t hash_value(std::string_view value)
+{
+  return std::hash<std::string_view>{}(value);
+}
+
+} // namespace
+
+namespace join_server
+{
+
+ValueArena::ValueArena()
+    : directory_(std::make_unique<std::unique_ptr<char *[]>[]>(kDirectoryPages)),
+      index_(kInitialIndexSize, kEmptySlot)
+{
+}
+
+ValueArena::ValueArena(const char *data, std::size_t size, std::shared_ptr<const void> owner) : ValueArena()
+{
+  directory_[0] = std::make_unique<char *[]>(kPageSize);
+  // Only ever read through get(); appends go to chunks allocated later.
+  directory_[0][0] = const_cast<char *>(data);
+  external_ = std::move(owner);
+  adopted_ = data;
+  adopted_size_ = size;
+  chunk_count_ = 1;
+  // Looks like a full half-size chunk, so the next append opens a normal one.
+  chunk_size_ = kFirstChunkSize / 2;
+  chunk_used_ = chunk_size_;
+}
+
+ValueArena::~ValueArena() = default;
+
+ValueArena::Ref ValueArena::intern(std::string_view value)
+{
+  const std::size_t mask = index_.size() - 1;
+  std::size_t slot = hash_value(value) & mask;
+  while (index_[slot] != kEmptySlot)
+  {
+    if (get(index_[slot]) == value)
+      return index_[slot];
+    slot = (slot + 1) & mask;
+  }
+
+  const Ref ref = append(value);
+  index_[slot] = ref;
+  ++distinct_;
+  if (distinct_ * 2 > index_.size())
+    grow_index();
+  return ref;
+}
+
+std::string_view ValueArena::get(Ref ref) const
+{
+  // Adopted bytes come from a file that was not scanned when it was loaded.
+  if (adopted_ != nullptr && (ref >> kOffsetBits) == 0 && !encoded_within(adopted_, adopted_size_, ref))
+    return {};
+  const char *data = chunk(static_cast<std::size_t>(ref >> kOffsetBits)) + (ref & kOffsetMask);
+  std::size_t size = 0;
+  unsigned shift = 0;
+  for (;;)
+  {
+    const auto byte = static_cast<unsigned char>(*data++);
+    size |= static_cast<std::size_t>(byte & 0x7F) << shift;
+    if ((byte & 0x80) == 0)
+      break;
+    shift += 7;
+  }
+  return {data, size};
+}
+
+std::size_t ValueArena::encoded_size(std::string_view value)
+{
+  char header[kMaxVarintBytes];
+  return encode_varint(value.size(), header) + value.size();
+}
+
+void ValueArena::encode(std::string_view value, char *out)
+{
+  const std::size_t header = encode_varint(value.size(), out);
+  std::memcpy(out + header, value.data(), value.size());
+}
+
+bool ValueArena::encoded_within(const char *data, std::size_t size, Ref ref)
+{
+  if (ref >= size)
+    return false;
+  std::size_t pos = static_cast<std::size_t>(ref);
+  std::size_t length = 0;
+  for (unsigned shift = 0; shift < 7 * kMaxVarintBytes; shift += 7)
+  {
+    if (pos == size)
+      return false;
+    const auto byte = static_cast<unsigned char>(data[pos++]);
+    length |= static_cast<std::size_t>(byte & 0x7F) << shift;
+    if ((byte & 0x80) == 0)
+      return length <= size - pos;
+  }
+  return false;
+}
+
+ValueArena::Ref ValueArena::append(std::string_view value)
+{
+  const std::size_t needed = value.size() + kMaxVarintBytes;
+  if (chunk_count_ == 0 || chunk_used_ + needed > chunk_size_)
+  {
+    // Oversized values get a chunk of their own.
+    chunk_size_ = std::min(kMaxChunkSize, chunk_count_ == 0 ? kFirstChunkSize : chunk_size_ * 2);
+    add_chunk(std::max(chunk_size_, needed));
+  }
+
+  const std::size_t index = chunk_count_ - 1;
+  char *out = chunk(index) + chunk_used_;
+  const std::size_t header = encode_varint(value.size(), out);
+  std::memcpy(out + header, value.data(), value.size());
+
+  const Ref ref = (static_cast<Ref>(index) << kOffsetBits) | static_cast<Ref>(chunk_used_);
+  chunk_used_ += header + value.size();
+  return ref;
+}
+
+char *ValueArena::chunk(std::size_t index) const
+{
+  return directory_[index >> kPageBits][index & (kPageSize - 1)];
+}
+
+void ValueArena::add_chunk(std::size_t size)
+{
+  const std::size_t index = chunk_count_;
+  if (index >= kDirectoryPages * kPageSize)
+    throw std::length_error("value arena exhausted");
+
+  auto &page = directory_[index >> kPageBits];
+  if (!page)
+    page = std::make_unique<char *[]>(kPageSize);
+
+  owned_.emplace_back(new char[size]); // left uninitialized on purpose
+  page[index & (kPageSize - 1)] = owned_.back().get();
+  reserved_bytes_ += size;
+  chunk_size_ = size;
+  chunk_used_ = 0;
+  ++chunk_count_;
+}
+
+void ValueArena::grow_index()
+{
+  std::vector<Ref> index(index_.size() * 2, kEmptySlot);
+  const std::size_t mask = index.size() - 1;
+  for (const Ref ref : index_)
+  {
+    if (ref == kEmptySlot)
+      continue;
+    std::size_t slot = hash_value(get(ref)) & mask;
+    while (index[slot] != kEmptySlot)
+      slot = (slot + 1) & mask;
+    index[slot] = ref;
+  }
+  index_ = std::move(index);
+}
+
+} // namespace join_server
@@ -0,0 +1,454 @@
+#include "join_server/wal.hpp"
+
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <stdexcept>
+
+namespace
+{
+
+using join_server::TableId;
+
+enum class Op : std::uint8_t
+{
+  Insert = 1,
+  Truncate = 2
+};
+
+// File layout: magic, u64 number of the record the file starts after, then
+// the records. Record layout: u32 payload size, u32 checksum of the payload,
+// then the payload: u8 op, u8 table, i32 id, value bytes. Integers are stored
+// in host byte order; the log is not meant to move between machines.
+constexpr char kMagic[8] = {'J', 'O', 'I', 'N', 'W', 'A', 'L', '1'};
+constexpr std::size_t kFileHeaderSize = 16;
+constexpr std::size_t kHeaderSize = 8;
+constexpr std::size_t kFixedPayload = 6;
+
+std::uint32_t checksum(const char *data, std::size_t size)
+{
+  std::uint32_t hash = 2166136261U;
+  for (std::size_t i = 0; i < size; ++i)
+  {
+    hash ^= static_cast<unsigned char>(data[i]);
+    hash *= 16777619U;
+  }
+  return hash;
+}
+
+std::string encode(Op op, TableId table, int id, std::string_view value)
+{
+  const auto payload = static_cast<std::uint32_t>(kFixedPayload + value.size());
+  std::string record(kHeaderSize + payload, '\0');
+  char *out = record.data();
+  out[kHeaderSize] = static_cast<char>(op);
+  out[kHeaderSize + 1] = static_cast<char>(table == TableId::A ? 0 : 1);
+  std::memcpy(out + kHeaderSize + 2, &id, sizeof(id));
+  if (!value.empty())
+    std::memcpy(out + kHeaderSize + kFixedPayload, value.data(), value.size());
+
+  const std::uint32_t sum = checksum(out + kHeaderSize, payload);
+  std::memcpy(out, &payload, sizeof(payload));
+  std::memcpy(out + 4, &sum, sizeof(sum));
+  return record;
+}
+
+std::string encode_file_header(std::uint64_t base)
+{
+  std::string header(kFileHeaderSize, '\0');
+  std::memcpy(header.data(), kMagic, sizeof(kMagic));
+  std::memcpy(header.data() + sizeof(kMagic), &base, sizeof(base));
+  return header;
+}
+
+struct Record
+{
+  Op op;
+  TableId table;
+  int id;
+  std::string_view value;
+  std::size_t size;
+};
+
+// Decodes the record at `pos`; false if none is there or it is torn.
+bool read_record(const std::string &data, std::size_t pos, Record &record)
+{
+  if (data.size() - pos < kHeaderSize)
+    return false;
+  std::uint32_t payload = 0;
+  std::uint32_t sum = 0;
+  std::memcpy(&payload, data.data() + pos, sizeof(payload));
+  std::memcpy(&sum, data.data() + pos + 4, sizeof(sum));
+  const char *body = data.data() + pos + kHeaderSize;
+  if (payload < kFixedPayload || data.size() - pos - kHeaderSize < payload || checksum(body, payload) != sum)
+    return false;
+
+  record.op = static_cast<Op>(body[0]);
+  record.table = body[1] == 0 ? TableId::A : TableId::B;
+  std::memcpy(&record.id, body + 2, sizeof(record.id));
+  record.value = std::string_view(body + kFixedPayload, payload - kFixedPayload);
+  record.size = kHeaderSize + payload;
+  return true;
+}
+
+std::string errno_message(const char *what)
+{
+  return std::string(what) + ": " + std::strerror(errno);
+}
+
+bool write_fd(int fd, const std::string &data, std::string &error)
+{
+  std::size_t written = 0;
+  while (written < data.size())
+  {
+    const ssize_t done = ::write(fd, data.data() + written, data.size() - written);
+    if (done < 0)
+    {
+      if (errno == EINTR)
+        continue;
+      error = errno_message("wal write failed");
+      return false;
+    }
+    written += static_cast<std::size_t>(done);
+  }
+  return true;
+}
+
+bool read_file(int fd, std::string &data, std::string &error)
+{
+  struct stat info = {};
+  if (::fstat(fd, &info) < 0)
+  {
+    error = errno_message("wal stat failed");
+    return false;
+  }
+  data.resize(static_cast<std::size_t>(info.st_size));
+  std::size_t done = 0;
+  while (done < data.size())
+  {
+    const ssize_t got = ::read(fd, data.data() + done, data.size() - done);
+    if (got < 0 && errno == EINTR)
+      continue;
+    if (got <= 0)
+    {
+      error = errno_message("wal read failed");
+      return false;
+    }
+    done += static_cast<std::size_t>(got);
+  }
+  return true;
+}
+
+// Appends bytes [from, to) of the records in the log open at `fd` to `data`.
+bool read_at(int fd, std::uint64_t from, std::uint64_t to, std::string &data, std::string &error)
+{
+  std::size_t done = data.size();
+  data.resize(done + static_cast<std::size_t>(to - from));
+  // Byte `done` of `data` is at offset `shift + done` of the file.
+  const std::uint64_t shift = kFileHeaderSize + from - done;
+  while (done < data.size())
+  {
+    const ssize_t got = ::pread(fd, data.data() + done, data.size() - done, static_cast<off_t>(shift + done));
+    if (got < 0 && errno == EINTR)
+      continue;
+    if (got <= 0)
+    {
+      error = errno_message("wal read failed");
+      return false;
+    }
+    done += static_cast<std::size_t>(got);
+  }
+  return true;
+}
+
+} // namespace
+
+namespace join_server
+{
+
+WriteAheadLog::WriteAheadLog(const std::string &path, Durability durability) : path_(path), durability_(durability)
+{
+  fd_ = ::open(path.c_str(), O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+  if (fd_ < 0)
+    throw std::runtime_error(errno_message(("cannot open wal " + path).c_str()));
+
+  std::string data;
+  std::string error;
+  if (!read_file(fd_, data, error) ||
+      (!data.empty() && (data.size() < kFileHeaderSize || std::memcmp(data.data(), kMagic, sizeof(kMagic)) != 0)))
+  {
+    ::close(fd_);
+    throw std::runtime_error(error.empty() ? "wal " + path + " is not a log" : error);
+  }
+  // A write error here fails the first commit, like any other.
+  if (data.empty())
+  {
+    write_all(encode_file_header(0), failure_);
+    return;
+  }
+
+  std::memcpy(&base_, data.data() + sizeof(kMagic), sizeof(base_));
+  appended_ = base_;
+  Record record{};
+  for (std::size_t pos = kFileHeaderSize; read_record(data, pos, record); pos += record.size)
+    ++appended_;
+  durable_ = appended_;
+  size_ = data.size() - kFileHeaderSize;
+}
+
+WriteAheadLog::~WriteAheadLog()
+{
+  std::string error;
+  {
+    std::lock_guard<std::mutex> lk(mtx_);
+    if (!pending_.empty() && failure_.empty())
+      write_all(pending_, error);
+  }
+  ::close(fd_);
+}
+
+WriteAheadLog::Lsn WriteAheadLog::append_insert(TableId table, int id, std::string_view value)
+{
+  return append(encode(Op::Insert, table, id, value));
+}
+
+WriteAheadLog::Lsn WriteAheadLog::append_truncate(TableId table)
+{
+  return append(encode(Op::Truncate, table, 0, {}));
+}
+
+WriteAheadLog::Lsn WriteAheadLog::append(const std::string &record)
+{
+  std::lock_guard<std::mutex> lk(mtx_);
+  const Lsn lsn = ++appended_;
+  size_ += record.size();
+  if (durability_ != Durability::EveryOp)
+  {
+    pending_ += record;
+    return lsn;
+  }
+
+  if (failure_.empty() && write_all(record, failure_))
+  {
+    if (::fdatasync(fd_) < 0)
+      failure_ = errno_message("wal sync failed");
+    ++syncs_;
+  }
+  durable_ = lsn;
+  return lsn;
+}
+
+bool WriteAheadLog::commit(Lsn lsn, std::string &error)
+{
+  std::unique_lock<std::mutex> lk(mtx_);
+  if (durable_ < lsn && failure_.empty())
+  {
+    lk.unlock();
+    std::lock_guard<std::mutex> flush(flush_mtx_);
+    lk.lock();
+    if (durable_ < lsn && failure_.empty())
+    {
+      // Take everything queued so far, including records of writers that
+      // are still waiting behind us, and sync it once for all of them.
+      std::string batch;
+      batch.swap(pending_);
+      const Lsn upto = appended_;
+      lk.unlock();
+
+      std::string failure;
+      bool ok = write_all(batch, failure);
+      if (ok && durability_ == Durability::Batch && ::fdatasync(fd_) < 0)
+      {
+        failure = errno_message("wal sync failed");
+        ok = false;
+      }
+
+      lk.lock();
+      if (ok)
+        durable_ = upto;
+      else
+        failure_ = failure;
+      if (ok && durability_ == Durability::Batch)
+        ++syncs_;
+    }
+  }
+
+  if (!failure_.empty())
+  {
+    error = failure_;
+    return false;
+  }
+  return true;
+}
+
+bool WriteAheadLog::healthy(std::string &error) const
+{
+  std::lock_guard<std::mutex> lk(mtx_);
+  if (failure_.empty())
+    return true;
+  error = failure_;
+  return false;
+}
+
+WriteAheadLog::Position WriteAheadLog::position() const
+{
+  std::lock_guard<std::mutex> lk(mtx_);
+  return Position{appended_, dropped_ + size_};
+}
+
+bool WriteAheadLog::checkpoint(const Position &position, std::string &error)
+{
+  std::lock_guard<std::mutex> serial(checkpoint_mtx_);
+  // Bytes of records on file after the header. With flush_mtx_ held no
+  // commit is between taking its batch and writing it.
+  std::uint64_t written = 0;
+  {
+    std::lock_guard<std::mutex> flush(flush_mtx_);
+    std::lock_guard<std::mutex> lk(mtx_);
+    if (!failure_.empty())
+    {
+      error = failure_;
+      return false;
+    }
+    if (position.lsn <= base_)
+      return true; // a later snapshot got here first
+    written = size_ - pending_.size();
+  }
+
+  // Bytes up to `written` never change and fd_ is only replaced by a
+  // checkpoint, so the bulk of the copy and its sync run without the locks.
+  const std::uint64_t skip = position.offset - dropped_;
+  std::string data = encode_file_header(position.lsn);
+  if (!read_at(fd_, skip, written, data, error))
+    return false;
+
+  const std::string temp = path_ + ".tmp";
+  const int fd = ::open(temp.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0644);
+  if (fd < 0)
+  {
+    error = errno_message(("cannot create " + temp).c_str());
+    return false;
+  }
+  bool ok = write_fd(fd, data, error);
+  if (ok && ::fsync(fd) < 0)
+  {
+    error = errno_message("wal sync failed");
+    ok = false;
+  }
+
+  // Commits write to fd_ under flush_mtx_, so both locks are needed to carry
+  // over the records written since and swap the file.
+  std::lock_guard<std::mutex> flush(flush_mtx_);
+  std::lock_guard<std::mutex> lk(mtx_);
+  if (ok && !failure_.empty())
+  {
+    error = failure_;
+    ok = false;
+  }
+  data.clear();
+  ok = ok && read_at(fd_, written, size_ - pending_.size(), data, error) && write_fd(fd, data, error);
+  // Those records may have been acknowledged as durable already.
+  if (ok && !data.empty() && durability_ != Durability::None && ::fsync(fd) < 0)
+  {
+    error = errno_message("wal sync failed");
+    ok = false;
+  }
+  if (ok && ::rename(temp.c_str(), path_.c_str()) < 0)
+  {
+    error = errno_message(("cannot replace " + path_).c_str());
+    ok = false;
+  }
+  if (!ok)
+  {
+    ::close(fd);
+    ::unlink(temp.c_str());
+    return false;
+  }
+
+  ::close(fd_);
+  fd_ = fd;
+  base_ = position.lsn;
+  dropped_ = position.offset;
+  size_ -= skip;
+  return true;
+}
+
+std::uint64_t WriteAheadLog::syncs() const
+{
+  std::lock_guard<std::mutex> lk(mtx_);
+  return syncs_;
+}
+
+bool WriteAheadLog::write_all(const std::string &data, std::string &error)
+{
+  return write_fd(fd_, data, error);
+}
+
+bool WriteAheadLog::replay(const std::string &path, TablesStore &store, std::size_t &records, std::string &error,
+                           Lsn after)
+{
+  records = 0;
+  const int fd = ::open(path.c_str(), O_RDWR | O_CLOEXEC);
+  if (fd < 0)
+  {
+    if (errno == ENOENT)
+      return true;
+    error = errno_message(("cannot open wal " + path).c_str());
+    return false;
+  }
+
+  std::string data;
+  bool ok = read_file(fd, data, error);
+  // A header cut short belongs to a log that never got a record.
+  std::size_t pos = 0;
+  Lsn lsn = 0;
+  if (ok && data.size() >= kFileHeaderSize)
+  {
+    if (std::memcmp(data.data(), kMagic, sizeof(kMagic)) != 0)
+    {
+      error = "wal " + path + " is not a log";
+      ok = false;
+    }
+    std::memcpy(&lsn, data.data() + sizeof(kMagic), sizeof(lsn));
+    if (ok && lsn > after)
+    {
+      error = "wal " + path + " starts after record " + std::to_string(lsn) + ", but the snapshot only holds " +
+              std::to_string(after);
+      ok = false;
+    }
+    pos = kFileHeaderSize;
+  }
+
+  Record record{};
+  while (ok && read_record(data, pos, record))
+  {
+    if (++lsn > after)
+    {
+      std::string failure;
+      const bool applied = record.op == Op::Insert ? store.insert(record.table, record.id, record.value, failure)
+                                                   : store.truncate(record.table, failure);
+      if (!applied)
+      {
+        error = "wal record " + std::to_string(lsn) + " does not apply: " + failure;
+        ok = false;
+        break;
+      }
+      ++records;
+    }
+    pos += record.size;
+  }
+
+  // Whatever follows the last intact record is a write that never finished.
+  if (ok && pos < data.size() && ::ftruncate(fd, static_cast<off_t>(pos)) < 0)
+  {
+    error = errno_message("wal truncate failed");
+    ok = false;
+  }
+  ::close(fd);
+  return ok;
+}
+
+} // namespace join_server
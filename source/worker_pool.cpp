@@ -0,0 +1,125 @@
+#include "join_server/worker_pool.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <random>
+
+namespace
+{
+
+// Longest an idle worker sleeps before looking at the deques again.
+constexpr std::chrono::hours kIdleBound{1};
+
+// Pool and deque of the worker running on this thread, if any.
+thread_local const void *current_pool = nullptr;
+thread_local std::size_t current_queue = 0;
+
+} // namespace
+
+namespace join_server
+{
+
+WorkerPool::WorkerPool(std::size_t threads)
+{
+  if (threads == 0)
+    threads = std::max(1U, std::thread::hardware_concurrency());
+  queues_.reserve(threads);
+  for (std::size_t i = 0; i < threads; ++i)
+    queues_.push_back(std::make_unique<Queue>());
+  threads_.reserve(threads);
+  for (std::size_t i = 0; i < threads; ++i)
+    threads_.emplace_back(&WorkerPool::work, this, i);
+}
+
+WorkerPool::~WorkerPool()
+{
+  {
+    std::lock_guard<std::mutex> lk(idle_mtx_);
+    stopping_ = true;
+  }
+  ready_.notify_all();
+  for (auto &thread : threads_)
+    thread.join();
+}
+
+void WorkerPool::submit(Task task)
+{
+  const std::size_t index =
+      current_pool == this ? current_queue : next_queue_.fetch_add(1, std::memory_order_relaxed) % queues_.size();
+  // Counted before it is visible, so a worker never takes more than is pending.
+  pending_.fetch_add(1);
+  {
+    std::lock_guard<std::mutex> lk(queues_[index]->mtx);
+    queues_[index]->tasks.push_back(std::move(task));
+  }
+  // Any idle worker will do: if the task is not in its deque, it steals it.
+  if (idle_.load() != 0)
+  {
+    std::lock_guard<std::mutex> lk(idle_mtx_);
+    ready_.notify_one();
+  }
+}
+
+bool WorkerPool::pop(std::size_t index, Task &task)
+{
+  auto &queue = *queues_[index];
+  std::lock_guard<std::mutex> lk(queue.mtx);
+  if (queue.tasks.empty())
+    return false;
+  task = std::move(queue.tasks.front());
+  queue.tasks.pop_front();
+  pending_.fetch_sub(1);
+  return true;
+}
+
+bool WorkerPool::steal(std::size_t victim, Task &task)
+{
+  // The newest task, away from the end its owner works on.
+  auto &queue = *queues_[victim];
+  std::lock_guard<std::mutex> lk(queue.mtx);
+  if (queue.tasks.empty())
+    return false;
+  task = std::move(queue.tasks.back());
+  queue.tasks.pop_back();
+  pending_.fetch_sub(1);
+  steals_.fetch_add(1, std::memory_order_relaxed);
+  return true;
+}
+
+void WorkerPool::work(std::size_t index)
+{
+  current_pool = this;
+  current_queue = index;
+  std::minstd_rand random(static_cast<std::minstd_rand::result_type>(index + 1));
+  const std::size_t count = queues_.size();
+  Task task;
+  for (;;)
+  {
+    bool found = pop(index, task);
+    const std::size_t start = random() % count;
+    for (std::size_t i = 0; !found && i < count; ++i)
+    {
+      const std::size_t victim = (start + i) % count;
+      found = victim != index && steal(victim, task);
+    }
+    if (found)
+    {
+      task();
+      task = nullptr;
+      continue;
+    }
+
+    std::unique_lock<std::mutex> lk(idle_mtx_);
+    // Announced before pending_ is checked, so submit() either sees this
+    // worker idle and notifies under idle_mtx_, or the worker sees the task.
+    idle_.fetch_add(1);
+    // Every submit() and the shutdown notify; the bound only keeps the wait
+    // on the inlined clock wait, which older libstdc++ runtimes also provide.
+    ready_.wait_for(lk, kIdleBound, [this] { return pending_.load() != 0 || stopping_; });
+    idle_.fetch_sub(1);
+    if (stopping_ && pending_.load() == 0)
+      return;
+  }
+}
+
+} // namespace join_server
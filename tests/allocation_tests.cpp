@@ -0,0 +1,72 @@
+#include <gtest/gtest.h>
+
+#include "join_server/command.hpp"
+#include "join_server/tables.hpp"
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+using join_server::CommandProcessor;
+using join_server::TableId;
+using join_server::TablesStore;
+
+namespace
+{
+
+std::atomic<std::size_t> allocations{0};
+
+} // namespace
+
+// Counts heap allocations so tests can check that a code path makes none.
+// This replaces the allocator of the whole executable, which is why these
+// tests are not part of join_server_tests.
+void *operator new(std::size_t size)
+{
+  allocations.fetch_add(1, std::memory_order_relaxed);
+  if (void *memory = std::malloc(size == 0 ? 1 : size))
+    return memory;
+  throw std::bad_alloc();
+}
+
+void operator delete(void *memory) noexcept
+{
+  std::free(memory);
+}
+
+void operator delete(void *memory, std::size_t) noexcept
+{
+  std::free(memory);
+}
+
+TEST(AllocationSuite, JoinRepliesDoNotAllocatePerRow)
+{
+  TablesStore store(join_server::StorageEngine::Flat);
+  CommandProcessor processor(store);
+  std::string error;
+  for (int i = 0; i < 50000; ++i)
+  {
+    ASSERT_TRUE(store.insert(TableId::A, i * 2, "left", error));
+    ASSERT_TRUE(store.insert(TableId::B, i * 3, "right", error));
+  }
+
+  std::size_t bytes = 0;
+  join_server::ResponseBuffer out(
+      [&bytes](std::string_view data)
+      {
+        bytes += data.size();
+        return true;
+      });
+  // The first join folds the insert buffers and sizes the reply buffer.
+  processor.execute("INTERSECTION", out);
+  processor.execute("SYMMETRIC_DIFFERENCE", out);
+  ASSERT_TRUE(out.flush());
+
+  const auto before = allocations.load();
+  processor.execute("INTERSECTION", out);
+  processor.execute("SYMMETRIC_DIFFERENCE", out);
+  ASSERT_TRUE(out.flush());
+  // 16667 + 66666 rows; a handful of allocations per join is the budget.
+  EXPECT_LT(allocations.load() - before, 16U);
+  EXPECT_GT(bytes, 1000000U);
+}
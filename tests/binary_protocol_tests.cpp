@@ -0,0 +1,196 @@
+#include <gtest/gtest.h>
+
+#include "join_server/binary_protocol.hpp"
+#include "join_server/command.hpp"
+#include "join_server/tables.hpp"
+
+#include <string>
+#include <vector>
+
+using join_server::TableId;
+namespace binary = join_server::binary;
+
+namespace
+{
+
+// Decodes every frame of `data`; rows are flattened into "id,a,b" lines.
+std::vector<std::string> decode_all(std::string_view data)
+{
+  std::vector<std::string> out;
+  binary::Reply reply;
+  while (binary::decode_reply(data, reply))
+  {
+    if (reply.status == binary::Status::Rows)
+    {
+      for (const auto &row : reply.rows)
+        out.push_back(std::to_string(row.id) + "," + std::string(row.from_a) + "," + std::string(row.from_b));
+    }
+    else
+    {
+      out.push_back((reply.status == binary::Status::Ok ? "OK " : "ERR ") + std::string(reply.text));
+    }
+  }
+  EXPECT_TRUE(data.empty());
+  return out;
+}
+
+} // namespace
+
+TEST(BinaryProtocolSuite, JoinRowsMatchTextReplies)
+{
+  join_server::TablesStore store;
+  std::string error;
+  for (int i = -3000; i < 3000; ++i)
+  {
+    if (i % 2 == 0)
+    {
+      ASSERT_TRUE(store.insert(TableId::A, i * 1000, i % 5 == 0 ? "" : "a" + std::to_string(i), error));
+    }
+    if (i % 3 == 0)
+    {
+      ASSERT_TRUE(store.insert(TableId::B, i * 1000, "b", error));
+    }
+  }
+  ASSERT_TRUE(store.insert(TableId::A, 2147483647, "max", error));
+  ASSERT_TRUE(store.insert(TableId::B, -2147483647 - 1, "min", error));
+
+  join_server::CommandProcessor text(store);
+  join_server::BinaryProcessor processor(store, text);
+  for (const auto kind : {join_server::JoinKind::Intersection, join_server::JoinKind::SymmetricDifference})
+  {
+    std::string request;
+    binary::encode_join(request, kind);
+    join_server::ResponseBuffer out;
+    std::size_t consumed = 0;
+    ASSERT_TRUE(processor.execute(request, out, consumed));
+    EXPECT_EQ(request.size(), consumed);
+
+    auto expected = text.execute(kind == join_server::JoinKind::Intersection ? "INTERSECTION" : "SYMMETRIC_DIFFERENCE")
+                        .lines;
+    expected.back() = "OK ";
+    EXPECT_EQ(expected, decode_all(out.data()));
+  }
+}
+
+TEST(BinaryProtocolSuite, RequestsReplyInOrder)
+{
+  join_server::TablesStore store;
+  join_server::CommandProcessor text(store);
+  join_server::BinaryProcessor processor(store, text);
+
+  std::string request;
+  binary::encode_insert(request, TableId::A, 1, "one");
+  binary::encode_insert(request, TableId::A, 1, "again");
+  binary::encode_insert(request, TableId::B, 1, "uno");
+  binary::encode_text(request, "INTERSECTION");
+  binary::encode_truncate(request, TableId::B);
+  binary::encode_text(request, "FETCH");
+  // Unknown opcode, bad table, empty value.
+  request += std::string("\x01\x00\x00\x00\x09", 5);
+  request += std::string("\x02\x00\x00\x00\x02\x07", 6);
+  binary::encode_insert(request, TableId::A, 2, "");
+  binary::encode_join(request, join_server::JoinKind::SymmetricDifference);
+  // Half of the next frame stays in the input.
+  std::string partial;
+  binary::encode_insert(partial, TableId::A, 3, "three");
+  request += partial.substr(0, 7);
+
+  join_server::ResponseBuffer out;
+  std::size_t consumed = 0;
+  ASSERT_TRUE(processor.execute(request, out, consumed));
+  EXPECT_EQ(request.size() - 7, consumed);
+  EXPECT_EQ((std::vector<std::string>{"OK ", "ERR duplicate 1", "OK ", "1,one,uno", "OK ", "OK ",
+                                      "ERR wrong command format", "ERR unknown opcode",
+                                      "ERR wrong frame format", "ERR wrong frame format", "1,one,", "OK "}),
+            decode_all(out.data()));
+
+  std::string huge("\xff\xff\xff\x7f", 4);
+  join_server::ResponseBuffer rejected;
+  EXPECT_FALSE(processor.execute(huge, rejected, consumed));
+  EXPECT_EQ(std::vector<std::string>{"ERR frame too long"}, decode_all(rejected.data()));
+}
+
+TEST(BinaryProtocolSuite, BinaryCommandEndsTextBatch)
+{
+  join_server::TablesStore store;
+  join_server::CommandProcessor processor(store);
+  join_server::ResponseBuffer out;
+  EXPECT_EQ(2U, processor.execute_batch({"INSERT A 1 one", "binary", "INSERT A 2 two"}, out));
+  EXPECT_TRUE(processor.binary());
+  EXPECT_EQ("OK\nOK\n", out.data());
+
+  join_server::TablesStore other;
+  join_server::CommandProcessor plain(other);
+  EXPECT_EQ(std::vector<std::string>{"ERR wrong command format"}, plain.execute("BINARY now").lines);
+  EXPECT_FALSE(plain.binary());
+}
+
+TEST(BinaryProtocolSuite, StopsInFrontOfJoinsWhenScansWait)
+{
+  join_server::TablesStore store;
+  join_server::CommandProcessor text(store);
+  join_server::BinaryProcessor processor(store, text);
+
+  std::string writes;
+  binary::encode_insert(writes, TableId::A, 1, "one");
+  binary::encode_insert(writes, TableId::B, 1, "uno");
+  std::string request = writes;
+  binary::encode_text(request, "open_intersection");
+  binary::encode_join(request, join_server::JoinKind::Intersection);
+
+  join_server::ResponseBuffer out;
+  std::size_t consumed = 0;
+  ASSERT_TRUE(processor.execute(request, out, consumed, false));
+  EXPECT_TRUE(processor.stopped_before_scan());
+  EXPECT_EQ(writes.size(), consumed);
+  EXPECT_EQ((std::vector<std::string>{"OK ", "OK "}), decode_all(out.data()));
+
+  join_server::ResponseBuffer rest;
+  ASSERT_TRUE(processor.execute(std::string_view(request).substr(consumed), rest, consumed));
+  EXPECT_FALSE(processor.stopped_before_scan());
+  EXPECT_EQ((std::vector<std::string>{"OK ", "1,one,uno", "OK "}), decode_all(rest.data()));
+
+  // A TEXT reply keeps its lines but not the closing OK.
+  std::string fetch;
+  binary::encode_text(fetch, "FETCH 10");
+  join_server::ResponseBuffer fetched;
+  ASSERT_TRUE(processor.execute(fetch, fetched, consumed));
+  EXPECT_EQ(std::vector<std::string>{"OK 1,one,uno\nEND"}, decode_all(fetched.data()));
+}
+
+TEST(BinaryProtocolSuite, JoinPausesWhileReaderIsBehind)
+{
+  join_server::TablesStore store;
+  std::string error;
+  for (int i = 0; i < 3000; ++i)
+  {
+    ASSERT_TRUE(store.insert(TableId::A, i, "a", error));
+    ASSERT_TRUE(store.insert(TableId::B, i, "b", error));
+  }
+
+  join_server::CommandProcessor text(store);
+  join_server::BinaryProcessor processor(store, text);
+  std::string request;
+  binary::encode_join(request, join_server::JoinKind::Intersection);
+  binary::encode_text(request, "INSERT A 3000 late");
+
+  bool behind = true;
+  join_server::ResponseBuffer out({}, [&behind] { return behind; });
+  std::size_t consumed = 0;
+  ASSERT_TRUE(processor.execute(request, out, consumed));
+  EXPECT_TRUE(processor.paused());
+  EXPECT_LT(consumed, request.size());
+  EXPECT_FALSE(processor.resume_join(out));
+
+  behind = false;
+  EXPECT_TRUE(processor.resume_join(out));
+  EXPECT_FALSE(processor.paused());
+  std::size_t rest = 0;
+  ASSERT_TRUE(processor.execute(std::string_view(request).substr(consumed), out, rest));
+  EXPECT_EQ(request.size(), consumed + rest);
+
+  auto expected = text.execute("INTERSECTION").lines;
+  expected.back() = "OK ";
+  expected.push_back("OK ");
+  EXPECT_EQ(expected, decode_all(out.data()));
+}
@@ -134,3 +134,188 @@ TEST(CommandProcessorSuite, InvalidId)
   ASSERT_FALSE(result.success);
   ASSERT_EQ("ERR invalid id abc", result.lines.front());
 }
+
+TEST(CommandProcessorSuite, StreamedResponseMatchesLines)
+{
+  TablesStore store;
+  CommandProcessor processor(store);
+  for (int i = 0; i < 20000; ++i)
+  {
+    ASSERT_TRUE(processor.execute("INSERT A " + std::to_string(i) + " left" + std::to_string(i)).success);
+    if (i % 3 == 0)
+    {
+      ASSERT_TRUE(processor.execute("INSERT B " + std::to_string(i) + " right").success);
+    }
+  }
+
+  for (const std::string command : {"INTERSECTION", "symmetric_difference", "INSERT A 1 again", "INTERSECTION x"})
+  {
+    std::string expected;
+    for (const auto &line : processor.execute(command).lines)
+      expected += line + "\n";
+
+    std::string streamed;
+    std::size_t writes = 0;
+    join_server::ResponseBuffer out(
+        [&](std::string_view data)
+        {
+          ++writes;
+          streamed.append(data);
+          return true;
+        });
+    processor.execute(command, out);
+    EXPECT_TRUE(out.flush());
+    EXPECT_EQ(expected, streamed) << command;
+    if (command == "INTERSECTION")
+    {
+      EXPECT_GT(writes, 1U);
+    }
+  }
+
+  std::size_t writes = 0;
+  join_server::ResponseBuffer failing(
+      [&](std::string_view)
+      {
+        ++writes;
+        return false;
+      });
+  processor.execute("INTERSECTION", failing);
+  EXPECT_TRUE(failing.failed());
+  EXPECT_FALSE(failing.flush());
+  EXPECT_EQ(1U, writes);
+}
+
+TEST(CommandProcessorSuite, CursorFetchesJoinInBatches)
+{
+  TablesStore store;
+  CommandProcessor processor(store);
+  CommandProcessor reader(store);
+  for (int i = 0; i < 10; ++i)
+  {
+    ASSERT_TRUE(processor.execute("INSERT A " + std::to_string(i) + " a" + std::to_string(i)).success);
+    ASSERT_TRUE(processor.execute("INSERT B " + std::to_string(i * 2) + " b").success);
+  }
+
+  EXPECT_EQ(std::vector<std::string>{"ERR no open cursor"}, reader.execute("FETCH 2").lines);
+  ASSERT_TRUE(reader.execute("OPEN_INTERSECTION").success);
+  EXPECT_EQ((std::vector<std::string>{"0,a0,b", "2,a2,b", "OK"}), reader.execute("FETCH 2").lines);
+
+  // Rows behind the cursor are not revisited, rows ahead of it show up.
+  ASSERT_TRUE(processor.execute("INSERT A 10 late").success);
+  ASSERT_TRUE(processor.execute("TRUNCATE B").success);
+  ASSERT_TRUE(processor.execute("INSERT B 1 early").success);
+  ASSERT_TRUE(processor.execute("INSERT B 10 b").success);
+  EXPECT_EQ((std::vector<std::string>{"10,late,b", "END", "OK"}), reader.execute("FETCH 5").lines);
+  EXPECT_EQ(std::vector<std::string>{"ERR no open cursor"}, reader.execute("FETCH 5").lines);
+
+  ASSERT_TRUE(reader.execute("OPEN_SYMMETRIC_DIFFERENCE").success);
+  EXPECT_EQ((std::vector<std::string>{"0,a0,", "OK"}), reader.execute("FETCH 1").lines);
+  EXPECT_EQ(std::vector<std::string>{"OK"}, reader.execute("CLOSE").lines);
+  EXPECT_EQ(std::vector<std::string>{"ERR no open cursor"}, reader.execute("CLOSE").lines);
+  EXPECT_EQ(std::vector<std::string>{"ERR invalid count 0"}, reader.execute("FETCH 0").lines);
+  EXPECT_EQ(std::vector<std::string>{"ERR wrong command format"}, reader.execute("FETCH").lines);
+}
+
+TEST(CommandProcessorSuite, LoadReadsBlockOfRows)
+{
+  TablesStore store;
+  CommandProcessor processor(store);
+  ASSERT_TRUE(processor.execute("INSERT B 2 two").success);
+
+  const auto started = processor.execute("LOAD A 3");
+  EXPECT_TRUE(started.success);
+  EXPECT_TRUE(started.lines.empty());
+  EXPECT_TRUE(processor.execute("3 three").lines.empty());
+  // A row that looks like a command is still a row of the block.
+  EXPECT_TRUE(processor.execute("INTERSECTION").lines.empty());
+  EXPECT_EQ(std::vector<std::string>{"ERR wrong row format"}, processor.execute("2 two").lines);
+  EXPECT_TRUE(processor.execute("INTERSECTION").lines == std::vector<std::string>{"OK"});
+
+  ASSERT_TRUE(processor.execute("LOAD a 2").lines.empty());
+  join_server::ResponseBuffer out;
+  EXPECT_TRUE(processor.execute("2   two words ", out));
+  EXPECT_TRUE(out.data().empty());
+  EXPECT_EQ(std::vector<std::string>{"OK"}, processor.execute("-5 minus").lines);
+  EXPECT_EQ((std::vector<std::string>{"2,two words,two", "OK"}), processor.execute("INTERSECTION").lines);
+
+  EXPECT_EQ(std::vector<std::string>{"OK"}, processor.execute("LOAD B 0").lines);
+  EXPECT_EQ(std::vector<std::string>{"ERR invalid count -1"}, processor.execute("LOAD B -1").lines);
+  ASSERT_TRUE(processor.execute("LOAD B 1").lines.empty());
+  EXPECT_EQ(std::vector<std::string>{"ERR duplicate 2"}, processor.execute("2 again").lines);
+}
+
+TEST(CommandProcessorSuite, BatchRepliesMatchSingleCommands)
+{
+  const std::vector<std::string_view> script = {
+      "INSERT A 1 one", "INSERT B 1 uno",   "INSERT A 1 again", "INSERT A x bad", "INSERT A 2 two",
+      "INSERT C 3 no",  "INSERT B 2",       "INTERSECTION",     "INSERT B 2 dos", "LOAD A 1",
+      "INSERT A 3 row", "INSERT A 3 three", "TRUNCATE B",       "insert b 3 tres", "SYMMETRIC_DIFFERENCE"};
+
+  TablesStore single_store;
+  CommandProcessor single(single_store);
+  join_server::ResponseBuffer expected;
+  for (const auto line : script)
+    single.execute(line, expected);
+
+  TablesStore batch_store;
+  CommandProcessor batch(batch_store);
+  join_server::ResponseBuffer actual;
+  batch.execute_batch(script, actual);
+  EXPECT_EQ(expected.data(), actual.data());
+}
+
+TEST(CommandProcessorSuite, BatchStopsInFrontOfJoinsWhenScansWait)
+{
+  EXPECT_TRUE(join_server::is_scan_command(" intersection"));
+  EXPECT_TRUE(join_server::is_scan_command("FETCH 10"));
+  EXPECT_TRUE(join_server::is_scan_command("OPEN_SYMMETRIC_DIFFERENCE"));
+  EXPECT_FALSE(join_server::is_scan_command("INSERT A 1 INTERSECTION"));
+  EXPECT_FALSE(join_server::is_scan_command("STATS"));
+
+  TablesStore store;
+  CommandProcessor processor(store);
+  join_server::ResponseBuffer out;
+  const std::vector<std::string_view> script = {"INSERT A 1 one", "INSERT B 1 uno", "INTERSECTION", "INSERT A 2 two"};
+  EXPECT_EQ(2U, processor.execute_batch(script, out, false));
+  EXPECT_EQ("OK\nOK\n", out.data());
+
+  // Rows of a LOAD block are never taken for commands.
+  join_server::ResponseBuffer load;
+  EXPECT_EQ(3U, processor.execute_batch({"LOAD B 2", "2 FETCH", "3 dos"}, load, false));
+  EXPECT_EQ("OK\n", load.data());
+}
+
+TEST(CommandProcessorSuite, JoinPausesWhileReaderIsBehind)
+{
+  TablesStore store;
+  CommandProcessor processor(store);
+  for (int i = 0; i < 5000; ++i)
+  {
+    ASSERT_TRUE(processor.execute("INSERT A " + std::to_string(i) + " a").success);
+    ASSERT_TRUE(processor.execute("INSERT B " + std::to_string(i) + " b").success);
+  }
+
+  bool behind = true;
+  join_server::ResponseBuffer out({}, [&behind] { return behind; });
+  const std::vector<std::string_view> script = {"INTERSECTION", "INSERT A 5000 late"};
+  EXPECT_EQ(1U, processor.execute_batch(script, out));
+  EXPECT_TRUE(processor.paused());
+  const auto first = out.data().size();
+  EXPECT_GT(first, 0U);
+  EXPECT_FALSE(processor.resume_join(out));
+  EXPECT_GT(out.data().size(), first);
+
+  // Rows ahead of the pause still make it into the reply.
+  std::string error;
+  ASSERT_TRUE(store.insert(TableId::A, 6000, "a", error));
+  ASSERT_TRUE(store.insert(TableId::B, 6000, "b", error));
+  behind = false;
+  EXPECT_TRUE(processor.resume_join(out));
+  EXPECT_FALSE(processor.paused());
+  EXPECT_EQ(1U, processor.execute_batch({script[1]}, out));
+
+  std::string expected;
+  for (const auto &line : CommandProcessor(store).execute("INTERSECTION").lines)
+    expected += line + "\n";
+  EXPECT_EQ(expected + "OK\n", out.data());
+}
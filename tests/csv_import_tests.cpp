@@ -0,0 +1,134 @@
+#include <gtest/gtest.h>
+
+#include "join_server/command.hpp"
+#include "join_server/csv_import.hpp"
+#include "join_server/tables.hpp"
+
+#include <cstdio>
+#include <sys/stat.h>
+#include <fstream>
+#include <string>
+#include <vector>
+
+using join_server::TableId;
+
+namespace
+{
+
+std::string write_file(const std::string &name, const std::string &contents)
+{
+  const auto path = testing::TempDir() + name;
+  std::ofstream out(path, std::ios::binary | std::ios::trunc);
+  out << contents;
+  return path;
+}
+
+} // namespace
+
+TEST(CsvImportSuite, SplitsLargeFileAcrossThreads)
+{
+  // ~5 MiB of rows in scrambled order, so several workers each sort a part.
+  std::string contents;
+  join_server::TablesStore reference;
+  std::string error;
+  for (int i = 0; i < 300000; ++i)
+  {
+    const int id = static_cast<int>((i * 7919LL) % 300000) - 1000;
+    const auto value = "value" + std::to_string(i % 977);
+    contents += std::to_string(id) + "," + value + (i % 10 == 0 ? "\r\n" : "\n");
+    ASSERT_TRUE(reference.insert(TableId::A, id, value, error));
+    if (i % 3 == 0)
+    {
+      ASSERT_TRUE(reference.insert(TableId::B, id, "b", error));
+    }
+  }
+  const auto path = write_file("import_large.csv", contents);
+
+  for (const std::size_t threads : {1U, 4U})
+  {
+    join_server::TablesStore store;
+    std::size_t rows = 0;
+    ASSERT_TRUE(join_server::import_csv(store, TableId::A, path, threads, rows, error)) << error;
+    EXPECT_EQ(300000U, rows);
+    for (const auto &row : reference.intersection())
+      ASSERT_TRUE(store.insert(TableId::B, row.id, "b", error));
+
+    const auto expected = reference.intersection();
+    const auto actual = store.intersection();
+    ASSERT_EQ(expected.size(), actual.size());
+    for (std::size_t i = 0; i < expected.size(); ++i)
+    {
+      ASSERT_EQ(expected[i].id, actual[i].id);
+      ASSERT_EQ(expected[i].from_a, actual[i].from_a);
+    }
+  }
+  std::remove(path.c_str());
+}
+
+TEST(CsvImportSuite, ReportsBadLinesAndDuplicates)
+{
+  join_server::TablesStore store;
+  std::string error;
+  std::size_t rows = 0;
+  ASSERT_TRUE(store.insert(TableId::A, 5, "five", error));
+
+  const auto bad_id = write_file("import_bad_id.csv", "1,one\n\n2x,two\n");
+  EXPECT_FALSE(join_server::import_csv(store, TableId::A, bad_id, 1, rows, error));
+  EXPECT_EQ(bad_id + ":3: invalid id", error);
+
+  const auto bad_row = write_file("import_bad_row.csv", "1,one\n2\n");
+  EXPECT_FALSE(join_server::import_csv(store, TableId::A, bad_row, 1, rows, error));
+  EXPECT_EQ(bad_row + ":2: wrong row format", error);
+
+  const auto existing = write_file("import_existing.csv", "1,one\n5,again\n");
+  EXPECT_FALSE(join_server::import_csv(store, TableId::A, existing, 1, rows, error));
+  EXPECT_EQ("duplicate 5", error);
+  EXPECT_EQ(1U, store.rows(TableId::A).size());
+
+  EXPECT_FALSE(join_server::import_csv(store, TableId::A, testing::TempDir() + "import_missing.csv", 1, rows,
+                                       error));
+  EXPECT_FALSE(error.empty());
+
+  const auto empty = write_file("import_empty.csv", "");
+  EXPECT_TRUE(join_server::import_csv(store, TableId::B, empty, 1, rows, error));
+  EXPECT_EQ(0U, rows);
+}
+
+TEST(CsvImportSuite, ImportCommandLoadsTable)
+{
+  join_server::StoreOptions options;
+  options.import_dir = testing::TempDir();
+  join_server::TablesStore store(options);
+  join_server::CommandProcessor processor(store);
+  write_file("import_command.csv", "3,violation\n0,lean\n");
+  EXPECT_EQ(std::vector<std::string>{"OK"}, processor.execute("IMPORT a import_command.csv").lines);
+  ASSERT_TRUE(processor.execute("INSERT B 3 proposal").success);
+  EXPECT_EQ((std::vector<std::string>{"3,violation,proposal", "OK"}), processor.execute("INTERSECTION").lines);
+  EXPECT_EQ(std::vector<std::string>{"ERR duplicate 0"}, processor.execute("IMPORT A import_command.csv").lines);
+  EXPECT_EQ(std::vector<std::string>{"ERR wrong command format"}, processor.execute("IMPORT A").lines);
+}
+
+TEST(CsvImportSuite, ImportCommandStaysInImportDirectory)
+{
+  join_server::TablesStore disabled;
+  join_server::CommandProcessor rejecting(disabled);
+  const auto path = write_file("import_outside.csv", "1,secret\n");
+  EXPECT_EQ(std::vector<std::string>{"ERR IMPORT is disabled"}, rejecting.execute("IMPORT A " + path).lines);
+
+  join_server::StoreOptions options;
+  options.import_dir = testing::TempDir() + "import_dir";
+  ::mkdir(options.import_dir.c_str(), 0755);
+  join_server::TablesStore store(options);
+  join_server::CommandProcessor processor(store);
+  for (const std::string &name : {path, std::string("../import_outside.csv"), std::string("missing.csv")})
+  {
+    const auto output = processor.execute("IMPORT A " + name);
+    ASSERT_EQ(1U, output.lines.size());
+    EXPECT_EQ(0U, output.lines.front().rfind("ERR cannot open " + name + ": ", 0)) << output.lines.front();
+  }
+
+  // Errors name the line, never its contents.
+  write_file("import_dir/bad.csv", "secret,value\n");
+  EXPECT_EQ(std::vector<std::string>{"ERR bad.csv:1: invalid id"}, processor.execute("IMPORT A bad.csv").lines);
+  EXPECT_TRUE(store.rows(TableId::A).empty());
+}
@@ -0,0 +1,190 @@
+#include <gtest/gtest.h>
+
+#include "join_server/flat_table.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+TEST(FlatTableSuite, SnapshotIsSorted)
+{
+  join_server::FlatTable table;
+
+  ASSERT_TRUE(table.insert(5, "precision"));
+  ASSERT_TRUE(table.insert(1, "sweater"));
+  ASSERT_TRUE(table.insert(3, "violation"));
+  ASSERT_EQ(3U, table.snapshot()->keys.size());
+  ASSERT_TRUE(table.insert(2, "frank"));
+  ASSERT_TRUE(table.insert(0, "lean"));
+
+  const auto run = table.snapshot();
+  const std::vector<int> expected_keys{0, 1, 2, 3, 5};
+  const std::vector<std::string> expected_values{"lean", "sweater", "frank", "violation", "precision"};
+  EXPECT_EQ(expected_keys, run->keys.to_vector());
+  for (std::size_t i = 0; i < expected_values.size(); ++i)
+    EXPECT_EQ(expected_values[i], run->value(i));
+}
+
+TEST(FlatTableSuite, RejectsDuplicatesInSortedAndPendingRows)
+{
+  join_server::FlatTable table;
+
+  ASSERT_TRUE(table.insert(1, "sweater"));
+  EXPECT_FALSE(table.insert(1, "coat"));
+
+  table.snapshot();
+  EXPECT_FALSE(table.insert(1, "coat"));
+  EXPECT_EQ(1U, table.size());
+}
+
+TEST(FlatTableSuite, InsertManyReportsEachRow)
+{
+  join_server::FlatTable table;
+  ASSERT_TRUE(table.insert(1, "sweater"));
+  table.snapshot();
+
+  // Enough rows to grow the insert buffer in the middle of the batch.
+  std::vector<join_server::FlatTable::Row> rows = {{1, "coat"}, {2, "hat"}, {2, "scarf"}};
+  for (int id = 3; id < 5000; ++id)
+    rows.push_back({id, "sock"});
+  std::vector<bool> inserted;
+  table.insert_many(rows, inserted);
+  ASSERT_EQ(rows.size(), inserted.size());
+  EXPECT_FALSE(inserted[0]);
+  EXPECT_TRUE(inserted[1]);
+  EXPECT_FALSE(inserted[2]);
+  EXPECT_EQ(4999U, table.size());
+
+  const auto run = table.snapshot();
+  ASSERT_EQ(4999U, run->keys.size());
+  EXPECT_EQ("sweater", run->value(0));
+  EXPECT_EQ("hat", run->value(1));
+  EXPECT_EQ("sock", run->value(4998));
+}
+
+TEST(FlatTableSuite, MergesLargeUnorderedInsertStream)
+{
+  join_server::FlatTable table;
+
+  constexpr int kRows = 10000;
+  for (int i = 0; i < kRows; ++i)
+    ASSERT_TRUE(table.insert((i * 7919) % kRows, std::to_string(i)));
+  EXPECT_FALSE(table.insert(0, "again"));
+
+  const auto run = table.snapshot();
+  ASSERT_EQ(static_cast<std::size_t>(kRows), run->keys.size());
+  for (int i = 0; i < kRows; ++i)
+    EXPECT_EQ(i, run->keys.at(static_cast<std::size_t>(i)));
+}
+
+TEST(FlatTableSuite, WritesWithoutReadersKeepTheBufferSmall)
+{
+  join_server::FlatTable table;
+
+  constexpr int kRows = 200000;
+  std::vector<join_server::FlatTable::Row> batch;
+  for (int i = 0; i < kRows; ++i)
+  {
+    if (i % 2 == 0)
+      ASSERT_TRUE(table.insert((i * 7919) % kRows, "x"));
+    else
+      batch.push_back(join_server::FlatTable::Row{(i * 7919) % kRows, "y"});
+  }
+  EXPECT_LE(table.buffered(), table.size() / 4);
+
+  std::vector<bool> inserted;
+  table.insert_many(batch, inserted);
+  EXPECT_EQ(static_cast<std::size_t>(kRows), table.size());
+  EXPECT_LE(table.buffered(), table.size() / 4);
+  EXPECT_FALSE(table.insert(0, "again"));
+
+  const auto run = table.snapshot();
+  ASSERT_EQ(static_cast<std::size_t>(kRows), run->keys.size());
+  for (int i = 0; i < kRows; ++i)
+    ASSERT_EQ(i, run->keys.at(static_cast<std::size_t>(i)));
+}
+
+TEST(FlatTableSuite, ClearDropsPendingRows)
+{
+  join_server::FlatTable table;
+
+  ASSERT_TRUE(table.insert(1, "sweater"));
+  table.snapshot();
+  ASSERT_TRUE(table.insert(2, "frank"));
+  table.clear();
+
+  EXPECT_EQ(0U, table.size());
+  EXPECT_TRUE(table.insert(1, "sweater"));
+}
+
+TEST(FlatTableSuite, SnapshotIsNotAffectedByLaterWrites)
+{
+  join_server::FlatTable table;
+
+  ASSERT_TRUE(table.insert(1, "sweater"));
+  const auto before = table.snapshot();
+
+  ASSERT_TRUE(table.insert(0, "lean"));
+  table.clear();
+  ASSERT_TRUE(table.insert(7, "wonder"));
+
+  ASSERT_EQ(1U, before->keys.size());
+  EXPECT_EQ(1, before->keys.at(0));
+  EXPECT_EQ("sweater", before->value(0));
+
+  const auto after = table.snapshot();
+  ASSERT_EQ(1U, after->keys.size());
+  EXPECT_EQ(7, after->keys.at(0));
+}
+
+TEST(FlatTableSuite, ConcurrentReadersSeeSortedPrefixes)
+{
+  join_server::FlatTable table;
+  constexpr int kRows = 20000;
+  std::atomic<bool> done{false};
+
+  std::thread writer([&table, &done]
+                     {
+                       for (int i = kRows - 1; i >= 0; --i)
+                         table.insert(i, std::to_string(i));
+                       done = true; });
+
+  bool ok = true;
+  while (!done)
+  {
+    const auto run = table.snapshot();
+    const auto keys = run->keys.to_vector();
+    ok = ok && std::is_sorted(keys.begin(), keys.end()) && run->keys.size() == run->values.size();
+  }
+  writer.join();
+
+  EXPECT_TRUE(ok);
+  EXPECT_EQ(static_cast<std::size_t>(kRows), table.snapshot()->keys.size());
+}
+
+TEST(FlatTableSuite, RepeatedValuesShareStorage)
+{
+  join_server::FlatTable table;
+
+  for (int i = 0; i < 1000; ++i)
+    ASSERT_TRUE(table.insert(i, i % 2 == 0 ? "even" : "odd"));
+
+  const auto run = table.snapshot();
+  EXPECT_EQ(2U, run->arena->distinct());
+  EXPECT_EQ(run->value(0).data(), run->value(998).data());
+  EXPECT_EQ("odd", run->value(999));
+}
+
+TEST(FlatTableSuite, ClearKeepsSnapshotValuesAlive)
+{
+  join_server::FlatTable table;
+
+  ASSERT_TRUE(table.insert(1, "sweater"));
+  const auto before = table.snapshot();
+  const auto old_arena = table.arena();
+  table.clear();
+
+  EXPECT_NE(old_arena, table.arena());
+  EXPECT_EQ("sweater", before->value(0));
+}
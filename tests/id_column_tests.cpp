@@ -0,0 +1,212 @@
+#include <gtest/gtest.h>
+
+#include "join_server/flat_table.hpp"
+#include "join_server/id_column.hpp"
+#include "join_server/tables.hpp"
+
+#include <climits>
+#include <random>
+#include <string>
+#include <vector>
+
+using join_server::IdColumn;
+
+namespace
+{
+
+std::vector<int> sparse_ids(std::size_t count, unsigned seed)
+{
+  std::mt19937 rng(seed);
+  std::uniform_int_distribution<int> step(1, 1000);
+  std::vector<int> ids;
+  int id = -100000;
+  for (std::size_t i = 0; i < count; ++i)
+  {
+    id += step(rng);
+    ids.push_back(id);
+  }
+  return ids;
+}
+
+} // namespace
+
+TEST(IdColumnSuite, PackedColumnDecodesEveryId)
+{
+  auto ids = sparse_ids(1000, 1);
+  ids.push_back(INT_MAX);
+  ids.insert(ids.begin(), INT_MIN);
+  const auto column = IdColumn::pack(ids);
+
+  ASSERT_TRUE(column.packed());
+  ASSERT_EQ(ids.size(), column.size());
+  EXPECT_EQ(ids, column.to_vector());
+  for (std::size_t i = 0; i < ids.size(); i += 37)
+    EXPECT_EQ(ids[i], column.at(i));
+}
+
+TEST(IdColumnSuite, PackedLookupsMatchPlainColumn)
+{
+  const auto ids = sparse_ids(5000, 2);
+  const IdColumn plain(ids);
+  const auto packed = IdColumn::pack(ids);
+
+  for (int key = ids.front() - 5; key <= ids.back() + 5; key += 97)
+  {
+    EXPECT_EQ(plain.lower_bound(key), packed.lower_bound(key));
+    EXPECT_EQ(plain.contains(key), packed.contains(key));
+  }
+  EXPECT_TRUE(packed.contains(ids[1234]));
+}
+
+TEST(IdColumnSuite, WindowsCrossBlockBoundaries)
+{
+  const auto ids = sparse_ids(1000, 3);
+  const auto column = IdColumn::pack(ids);
+
+  std::vector<int> scratch;
+  const int *data = nullptr;
+  const std::size_t count = column.window(100, 300, data, scratch);
+  ASSERT_EQ(300U, count);
+  EXPECT_EQ(std::vector<int>(ids.begin() + 100, ids.begin() + 400), std::vector<int>(data, data + count));
+  EXPECT_EQ(0U, column.window(ids.size(), 10, data, scratch));
+}
+
+TEST(IdColumnSuite, DenseIdsPackToAFewBitsPerRow)
+{
+  std::vector<int> ids(100000);
+  for (std::size_t i = 0; i < ids.size(); ++i)
+    ids[i] = static_cast<int>(i * 2);
+
+  const auto column = IdColumn::pack(ids);
+  EXPECT_LT(column.memory_bytes() * 8, IdColumn(ids).memory_bytes());
+  EXPECT_EQ(ids, column.to_vector());
+}
+
+TEST(IdColumnSuite, BitmapColumnMatchesPlainColumn)
+{
+  std::vector<int> ids;
+  for (int id = -700; id < 5000; ++id)
+    if (id % 3 != 0)
+      ids.push_back(id);
+  const IdColumn plain(ids);
+  const auto bitmap = IdColumn::bitmap(ids);
+
+  ASSERT_EQ(IdColumn::Encoding::Bitmap, bitmap.encoding());
+  EXPECT_EQ(ids, bitmap.to_vector());
+  for (std::size_t i = 0; i < ids.size(); i += 41)
+    EXPECT_EQ(ids[i], bitmap.at(i));
+  for (int key = -800; key < 5100; key += 7)
+  {
+    EXPECT_EQ(plain.lower_bound(key), bitmap.lower_bound(key));
+    EXPECT_EQ(plain.contains(key), bitmap.contains(key));
+  }
+
+  std::vector<int> scratch;
+  const int *data = nullptr;
+  ASSERT_EQ(500U, bitmap.window(1000, 500, data, scratch));
+  EXPECT_EQ(std::vector<int>(ids.begin() + 1000, ids.begin() + 1500), std::vector<int>(data, data + 500));
+}
+
+TEST(IdColumnSuite, FlatTableKeepsDenseRunsAsBitmaps)
+{
+  join_server::FlatTable dense;
+  join_server::FlatTable sparse;
+  for (int i = 0; i < 10000; ++i)
+  {
+    dense.insert(i * 2, "v");
+    sparse.insert(i * 100, "v");
+  }
+
+  EXPECT_EQ(IdColumn::Encoding::Bitmap, dense.snapshot()->keys.encoding());
+  EXPECT_EQ(IdColumn::Encoding::Plain, sparse.snapshot()->keys.encoding());
+  EXPECT_FALSE(dense.insert(500, "again"));
+  EXPECT_TRUE(dense.insert(501, "new"));
+}
+
+TEST(IdColumnSuite, DenseTablesJoinLikeMapEngine)
+{
+  join_server::TablesStore map_store(join_server::StorageEngine::Map);
+  join_server::StoreOptions threaded;
+  threaded.engine = join_server::StorageEngine::Flat;
+  threaded.join_threads = 4;
+  join_server::TablesStore flat_store(join_server::StorageEngine::Flat);
+  join_server::TablesStore parallel_store(threaded);
+
+  std::string error;
+  for (int i = -1000; i < 300000; ++i)
+  {
+    for (auto *store : {&map_store, &flat_store, &parallel_store})
+    {
+      if (i % 7 != 0)
+      {
+        ASSERT_TRUE(store->insert(join_server::TableId::A, i, "a" + std::to_string(i), error));
+      }
+      if (i % 5 != 0 && i > 1000)
+      {
+        ASSERT_TRUE(store->insert(join_server::TableId::B, i, "b" + std::to_string(i), error));
+      }
+    }
+  }
+  EXPECT_FALSE(flat_store.insert(join_server::TableId::A, 1, "again", error));
+
+  for (auto *store : {&flat_store, &parallel_store})
+  {
+    const auto expected_intersection = map_store.intersection();
+    const auto intersection = store->intersection();
+    ASSERT_EQ(expected_intersection.size(), intersection.size());
+    for (std::size_t i = 0; i < intersection.size(); ++i)
+    {
+      EXPECT_EQ(expected_intersection[i].id, intersection[i].id);
+      EXPECT_EQ(expected_intersection[i].from_a, intersection[i].from_a);
+      EXPECT_EQ(expected_intersection[i].from_b, intersection[i].from_b);
+    }
+
+    const auto expected_difference = map_store.symmetric_difference();
+    const auto difference = store->symmetric_difference();
+    ASSERT_EQ(expected_difference.size(), difference.size());
+    for (std::size_t i = 0; i < difference.size(); ++i)
+    {
+      EXPECT_EQ(expected_difference[i].id, difference[i].id);
+      EXPECT_EQ(expected_difference[i].from_a, difference[i].from_a);
+      EXPECT_EQ(expected_difference[i].from_b, difference[i].from_b);
+    }
+  }
+}
+
+TEST(IdColumnSuite, CompressedStoreJoinsLikePlainStore)
+{
+  join_server::StoreOptions compressed;
+  compressed.engine = join_server::StorageEngine::Flat;
+  compressed.compress_ids = true;
+  join_server::TablesStore packed_store(compressed);
+  join_server::TablesStore plain_store(join_server::StorageEngine::Flat);
+
+  std::string error;
+  for (int i = 0; i < 150000; ++i)
+  {
+    if (i % 3 != 0)
+    {
+      ASSERT_TRUE(packed_store.insert(join_server::TableId::A, i * 10, "a" + std::to_string(i), error));
+      ASSERT_TRUE(plain_store.insert(join_server::TableId::A, i * 10, "a" + std::to_string(i), error));
+    }
+    if (i % 5 != 0)
+    {
+      ASSERT_TRUE(packed_store.insert(join_server::TableId::B, i * 20, "b" + std::to_string(i), error));
+      ASSERT_TRUE(plain_store.insert(join_server::TableId::B, i * 20, "b" + std::to_string(i), error));
+    }
+  }
+  EXPECT_FALSE(packed_store.insert(join_server::TableId::A, 10, "again", error));
+
+  const auto expect_same = [](const join_server::JoinResult &lhs, const join_server::JoinResult &rhs)
+  {
+    ASSERT_EQ(lhs.size(), rhs.size());
+    for (std::size_t i = 0; i < lhs.size(); ++i)
+    {
+      EXPECT_EQ(lhs[i].id, rhs[i].id);
+      EXPECT_EQ(lhs[i].from_a, rhs[i].from_a);
+      EXPECT_EQ(lhs[i].from_b, rhs[i].from_b);
+    }
+  };
+  expect_same(plain_store.intersection(), packed_store.intersection());
+  expect_same(plain_store.symmetric_difference(), packed_store.symmetric_difference());
+}
@@ -0,0 +1,86 @@
+#include <gtest/gtest.h>
+
+#include "join_server/join_views.hpp"
+
+#include <random>
+
+using join_server::JoinViews;
+using join_server::TableId;
+
+TEST(JoinViewsSuite, MatchingInsertMovesRowIntoIntersection)
+{
+  JoinViews views;
+
+  views.on_insert(TableId::A, 3, "violation", nullptr);
+  ASSERT_EQ(1U, views.symmetric_difference().size());
+  EXPECT_TRUE(views.intersection().empty());
+
+  views.on_insert(TableId::B, 3, "proposal", nullptr);
+  EXPECT_TRUE(views.symmetric_difference().empty());
+
+  const auto rows = views.intersection();
+  ASSERT_EQ(1U, rows.size());
+  EXPECT_EQ(3, rows[0].id);
+  EXPECT_EQ("violation", rows[0].from_a);
+  EXPECT_EQ("proposal", rows[0].from_b);
+}
+
+TEST(JoinViewsSuite, TruncateReturnsOtherSideToDifference)
+{
+  JoinViews views;
+
+  views.on_insert(TableId::A, 1, "sweater", nullptr);
+  views.on_insert(TableId::A, 5, "precision", nullptr);
+  views.on_insert(TableId::B, 5, "lake", nullptr);
+  views.on_insert(TableId::B, 6, "flour", nullptr);
+
+  views.on_truncate(TableId::A);
+
+  EXPECT_TRUE(views.intersection().empty());
+  const auto rows = views.symmetric_difference();
+  ASSERT_EQ(2U, rows.size());
+  EXPECT_EQ(5, rows[0].id);
+  EXPECT_TRUE(rows[0].from_a.empty());
+  EXPECT_EQ("lake", rows[0].from_b);
+  EXPECT_EQ(6, rows[1].id);
+  EXPECT_EQ("flour", rows[1].from_b);
+}
+
+TEST(JoinViewsSuite, StoreWithViewsMatchesComputedJoins)
+{
+  join_server::StoreOptions options;
+  options.materialized_views = true;
+  join_server::TablesStore with_views(options);
+  join_server::TablesStore plain;
+
+  std::mt19937 rng(7);
+  std::uniform_int_distribution<int> id_dist(0, 2000);
+  std::uniform_int_distribution<int> op_dist(0, 200);
+  std::string error;
+  for (int i = 0; i < 20000; ++i)
+  {
+    const auto table = (i % 2 == 0) ? TableId::A : TableId::B;
+    if (op_dist(rng) == 0)
+    {
+      ASSERT_TRUE(with_views.truncate(table, error));
+      ASSERT_TRUE(plain.truncate(table, error));
+      continue;
+    }
+    const int id = id_dist(rng);
+    const auto value = std::to_string(i);
+    ASSERT_EQ(plain.insert(table, id, value, error), with_views.insert(table, id, value, error));
+  }
+
+  const auto compare = [](const join_server::JoinResult &expected, const join_server::JoinResult &actual)
+  {
+    ASSERT_EQ(expected.size(), actual.size());
+    for (std::size_t i = 0; i < expected.size(); ++i)
+    {
+      EXPECT_EQ(expected[i].id, actual[i].id);
+      EXPECT_EQ(expected[i].from_a, actual[i].from_a);
+      EXPECT_EQ(expected[i].from_b, actual[i].from_b);
+    }
+  };
+  compare(plain.intersection(), with_views.intersection());
+  compare(plain.symmetric_difference(), with_views.symmetric_difference());
+}
@@ -0,0 +1,359 @@
+#include <gtest/gtest.h>
+
+#include "join_server/epoll_reactor.hpp"
+#include "join_server/scheduler.hpp"
+#include "join_server/tables.hpp"
+#include "join_server/uring_reactor.hpp"
+#include "join_server/worker_pool.hpp"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <atomic>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace
+{
+
+// Binds `port`, or picks one when it is zero.
+int listen_on_loopback(uint16_t &port, bool reuse_port = false)
+{
+  const int fd = ::socket(AF_INET, SOCK_STREAM, 0);
+  int opt = 1;
+  if (reuse_port)
+    ::setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt));
+  sockaddr_in addr{};
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  addr.sin_port = htons(port);
+  socklen_t length = sizeof(addr);
+  if (fd < 0 || ::bind(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) < 0 || ::listen(fd, SOMAXCONN) < 0 ||
+      ::getsockname(fd, reinterpret_cast<sockaddr *>(&addr), &length) < 0)
+    return -1;
+  port = ntohs(addr.sin_port);
+  return fd;
+}
+
+int connect_to(uint16_t port)
+{
+  const int fd = ::socket(AF_INET, SOCK_STREAM, 0);
+  sockaddr_in addr{};
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  addr.sin_port = htons(port);
+  if (fd >= 0 && ::connect(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) < 0)
+  {
+    ::close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+void send_text(int fd, const std::string &text)
+{
+  ASSERT_EQ(static_cast<ssize_t>(text.size()), ::send(fd, text.data(), text.size(), MSG_NOSIGNAL));
+}
+
+// Reads until `lines` newlines have arrived.
+std::string read_lines(int fd, std::size_t lines)
+{
+  std::string out;
+  char chunk[4096];
+  std::size_t seen = 0;
+  while (seen < lines)
+  {
+    const ssize_t received = ::recv(fd, chunk, sizeof(chunk), 0);
+    if (received <= 0)
+      break;
+    out.append(chunk, static_cast<std::size_t>(received));
+    seen += static_cast<std::size_t>(std::count(chunk, chunk + received, '\n'));
+  }
+  return out;
+}
+
+template <typename Reactor>
+class ReactorFixture : public testing::Test
+{
+protected:
+  void SetUp() override
+  {
+    listener_ = listen_on_loopback(port_);
+    ASSERT_GE(listener_, 0);
+    try
+    {
+      reactor_ = std::make_unique<Reactor>(listener_, store_, scheduler_);
+    }
+    catch (const std::runtime_error &e)
+    {
+      GTEST_SKIP() << e.what();
+    }
+    loop_ = std::thread([this] { reactor_->run(); });
+  }
+
+  void TearDown() override
+  {
+    if (reactor_)
+    {
+      reactor_->stop();
+      loop_.join();
+      reactor_.reset();
+    }
+    ::close(listener_);
+  }
+
+  join_server::TablesStore store_;
+  join_server::WorkerPool workers_{2};
+  join_server::CommandScheduler scheduler_{workers_};
+  uint16_t port_{0};
+  int listener_{-1};
+  std::unique_ptr<Reactor> reactor_;
+  std::thread loop_;
+};
+
+using Reactors = testing::Types<join_server::EpollReactor, join_server::UringReactor>;
+TYPED_TEST_SUITE(ReactorFixture, Reactors);
+
+} // namespace
+
+TEST(WorkerPoolSuite, RunsEveryTaskBeforeShutdown)
+{
+  std::atomic<int> done{0};
+  {
+    join_server::WorkerPool pool(3);
+    EXPECT_EQ(3U, pool.size());
+    for (int i = 0; i < 1000; ++i)
+      pool.submit([&done] { done.fetch_add(1); });
+  }
+  EXPECT_EQ(1000, done.load());
+}
+
+TEST(WorkerPoolSuite, IdleWorkersStealFromBusyOne)
+{
+  // Half of the short tasks are dealt to the worker stuck in the long one.
+  std::atomic<bool> release{false};
+  std::atomic<int> done{0};
+  join_server::WorkerPool pool(2);
+  pool.submit(
+      [&release]
+      {
+        while (!release.load())
+          std::this_thread::sleep_for(std::chrono::milliseconds(1));
+      });
+  for (int i = 0; i < 100; ++i)
+    pool.submit([&done] { done.fetch_add(1); });
+
+  const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+  while (done.load() < 100 && std::chrono::steady_clock::now() < deadline)
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  EXPECT_EQ(100, done.load());
+  EXPECT_GT(pool.steals(), 0U);
+  release.store(true);
+}
+
+TEST(WorkerPoolSuite, KeepsTasksSubmittedByWorkers)
+{
+  std::atomic<int> done{0};
+  {
+    join_server::WorkerPool pool(4);
+    for (int i = 0; i < 100; ++i)
+      pool.submit(
+          [&pool, &done]
+          {
+            for (int j = 0; j < 10; ++j)
+              pool.submit([&done] { done.fetch_add(1); });
+          });
+  }
+  EXPECT_EQ(1000, done.load());
+}
+
+TYPED_TEST(ReactorFixture, RepliesInOrderAcrossSplitReads)
+{
+  const int client = connect_to(this->port_);
+  ASSERT_GE(client, 0);
+  send_text(client, "INSERT A 1 one\nINS");
+  send_text(client, "ERT B 1 uno\nINSERT A 1 again\r\n");
+  send_text(client, "INTERSECTION\n");
+  EXPECT_EQ("OK\nOK\nERR duplicate 1\n1,one,uno\nOK\n", read_lines(client, 5));
+  ::close(client);
+}
+
+TYPED_TEST(ReactorFixture, ServesManyConnectionsWithFewThreads)
+{
+  // Idle connections take no worker; active ones are still served.
+  std::vector<int> idle;
+  for (int i = 0; i < 200; ++i)
+  {
+    idle.push_back(connect_to(this->port_));
+    ASSERT_GE(idle.back(), 0);
+  }
+
+  std::vector<std::thread> clients;
+  std::atomic<int> correct{0};
+  for (int c = 0; c < 8; ++c)
+  {
+    clients.emplace_back(
+        [this, c, &correct]
+        {
+          const int fd = connect_to(this->port_);
+          std::string request;
+          std::string expected;
+          for (int i = 0; i < 500; ++i)
+          {
+            request += "INSERT A " + std::to_string(c * 1000 + i) + " v\n";
+            expected += "OK\n";
+          }
+          if (::send(fd, request.data(), request.size(), MSG_NOSIGNAL) == static_cast<ssize_t>(request.size()) &&
+              read_lines(fd, 500) == expected)
+            correct.fetch_add(1);
+          ::close(fd);
+        });
+  }
+  for (auto &client : clients)
+    client.join();
+  EXPECT_EQ(8, correct.load());
+
+  const int last = idle.back();
+  send_text(last, "SYMMETRIC_DIFFERENCE\n");
+  const auto reply = read_lines(last, 4001);
+  EXPECT_EQ(4001, std::count(reply.begin(), reply.end(), '\n'));
+  EXPECT_EQ("OK\n", reply.substr(reply.size() - 3));
+  for (const int fd : idle)
+    ::close(fd);
+}
+
+TYPED_TEST(ReactorFixture, StreamsLargeRepliesToSlowReader)
+{
+  std::string error;
+  for (int i = 0; i < 200000; ++i)
+    ASSERT_TRUE(this->store_.insert(join_server::TableId::A, i, "a value long enough to fill buffers", error));
+
+  // Several megabytes of reply, read only after the server has had to wait.
+  const int client = connect_to(this->port_);
+  send_text(client, "SYMMETRIC_DIFFERENCE\nINSERT B 1 b\n");
+  std::this_thread::sleep_for(std::chrono::milliseconds(200));
+  const auto reply = read_lines(client, 200002);
+  EXPECT_EQ(200002, std::count(reply.begin(), reply.end(), '\n'));
+  EXPECT_EQ("OK\nOK\n", reply.substr(reply.size() - 6));
+  ::close(client);
+}
+
+TYPED_TEST(ReactorFixture, JoinRepliesAboveQueueLimitReachSlowReader)
+{
+  // Some 75 MiB of INTERSECTION, more than a connection may queue.
+  constexpr int kRows = 240000;
+  const std::string a(150, 'a');
+  const std::string b(150, 'b');
+  std::string error;
+  for (int i = 0; i < kRows; ++i)
+  {
+    ASSERT_TRUE(this->store_.insert(join_server::TableId::A, i, a, error));
+    ASSERT_TRUE(this->store_.insert(join_server::TableId::B, i, b, error));
+  }
+
+  const int client = connect_to(this->port_);
+  timeval timeout{10, 0};
+  ::setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+  send_text(client, "INTERSECTION\nINSERT A " + std::to_string(kRows) + " a\n");
+  std::this_thread::sleep_for(std::chrono::milliseconds(500));
+  const auto reply = read_lines(client, kRows + 2);
+  EXPECT_EQ(kRows + 2, std::count(reply.begin(), reply.end(), '\n'));
+  EXPECT_EQ("0," + a + "," + b + "\n", reply.substr(0, a.size() + b.size() + 4));
+  EXPECT_EQ("OK\nOK\n", reply.substr(reply.size() - 6));
+  ::close(client);
+}
+
+TYPED_TEST(ReactorFixture, ClientsThatDoNotReadKeepNoWorker)
+{
+  // Replies of some 20 MiB, beyond what loopback socket buffers take.
+  const std::string value(100, 'v');
+  std::string error;
+  for (int i = 0; i < 200000; ++i)
+    ASSERT_TRUE(this->store_.insert(join_server::TableId::A, i, value, error));
+
+  uint16_t port = 0;
+  const int listener = listen_on_loopback(port);
+  ASSERT_GE(listener, 0);
+  join_server::WorkerPool workers(2);
+  join_server::SchedulerOptions options;
+  options.max_scans = 2;
+  {
+    join_server::CommandScheduler scheduler(workers, options);
+    TypeParam reactor(listener, this->store_, scheduler);
+    std::thread loop([&reactor] { reactor.run(); });
+
+    // One such reply for every worker.
+    std::vector<int> stuck;
+    for (int i = 0; i < 2; ++i)
+    {
+      stuck.push_back(connect_to(port));
+      send_text(stuck.back(), "SYMMETRIC_DIFFERENCE\n");
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+
+    const int client = connect_to(port);
+    timeval timeout{5, 0};
+    ::setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    send_text(client, "INSERT B 1 b\n");
+    EXPECT_EQ("OK\n", read_lines(client, 1));
+    ::close(client);
+
+    // The queued replies still arrive whole.
+    for (const int fd : stuck)
+    {
+      const auto reply = read_lines(fd, 200001);
+      EXPECT_EQ(200001, std::count(reply.begin(), reply.end(), '\n'));
+      ::close(fd);
+    }
+    reactor.stop();
+    loop.join();
+  }
+  ::close(listener);
+}
+
+TYPED_TEST(ReactorFixture, ShardsOnePortAcrossReactors)
+{
+  // Two reactors with SO_REUSEPORT listeners on one port share the store and the workers.
+  uint16_t port = 0;
+  const int first = listen_on_loopback(port, true);
+  const int second = listen_on_loopback(port, true);
+  ASSERT_GE(first, 0);
+  ASSERT_GE(second, 0);
+  {
+    TypeParam left(first, this->store_, this->scheduler_);
+    TypeParam right(second, this->store_, this->scheduler_);
+    std::thread left_loop([&left] { left.run(); });
+    std::thread right_loop([&right] { right.run(); });
+
+    int served = 0;
+    for (int i = 0; i < 32; ++i)
+    {
+      const int client = connect_to(port);
+      send_text(client, "INSERT A " + std::to_string(i) + " v\n");
+      served += read_lines(client, 1) == "OK\n" ? 1 : 0;
+      ::close(client);
+    }
+    EXPECT_EQ(32, served);
+
+    const int client = connect_to(port);
+    send_text(client, "SYMMETRIC_DIFFERENCE\n");
+    const auto reply = read_lines(client, 33);
+    EXPECT_EQ(33, std::count(reply.begin(), reply.end(), '\n'));
+    ::close(client);
+
+    left.stop();
+    right.stop();
+    left_loop.join();
+    right_loop.join();
+  }
+  ::close(first);
+  ::close(second);
+}
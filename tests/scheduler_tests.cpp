@@ -0,0 +1,129 @@
+#include <gtest/gtest.h>
+
+#include "join_server/command.hpp"
+#include "join_server/scheduler.hpp"
+#include "join_server/tables.hpp"
+#include "join_server/worker_pool.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+using join_server::CommandScheduler;
+using join_server::SchedulerOptions;
+using join_server::TaskClass;
+using join_server::WorkerPool;
+
+namespace
+{
+
+void wait_until(const std::atomic<bool> &flag)
+{
+  while (!flag.load())
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+}
+
+} // namespace
+
+TEST(SchedulerSuite, WritesOvertakeScansForABoundedBurst)
+{
+  WorkerPool pool(1);
+  SchedulerOptions options;
+  options.write_burst = 2;
+  std::vector<std::string> order;
+  std::mutex order_mtx;
+  const auto record = [&order, &order_mtx](std::string name)
+  {
+    return [&order, &order_mtx, name]
+    {
+      std::lock_guard<std::mutex> lk(order_mtx);
+      order.push_back(name);
+    };
+  };
+  {
+    CommandScheduler scheduler(pool, options);
+    // Holds the only worker while the queues fill up.
+    std::atomic<bool> started{false};
+    std::atomic<bool> release{false};
+    scheduler.submit(TaskClass::Write,
+                     [&started, &release]
+                     {
+                       started.store(true);
+                       wait_until(release);
+                     });
+    wait_until(started);
+
+    scheduler.submit(TaskClass::Scan, record("scan1"));
+    scheduler.submit(TaskClass::Scan, record("scan2"));
+    for (int i = 1; i <= 5; ++i)
+      scheduler.submit(TaskClass::Write, record("write" + std::to_string(i)));
+    EXPECT_EQ(2U, scheduler.stats().scan.queued);
+    EXPECT_EQ(5U, scheduler.stats().write.queued);
+    release.store(true);
+  }
+  const std::vector<std::string> expected = {"write1", "write2", "scan1", "write3", "write4", "scan2", "write5"};
+  EXPECT_EQ(expected, order);
+}
+
+TEST(SchedulerSuite, LimitsConcurrentScansButNotWrites)
+{
+  WorkerPool pool(4);
+  SchedulerOptions options;
+  options.max_scans = 2;
+  std::atomic<int> scans{0};
+  std::atomic<int> most_scans{0};
+  std::atomic<bool> release{false};
+  std::atomic<bool> write_done{false};
+  {
+    CommandScheduler scheduler(pool, options);
+    for (int i = 0; i < 6; ++i)
+      scheduler.submit(TaskClass::Scan,
+                       [&]
+                       {
+                         const int now = scans.fetch_add(1) + 1;
+                         int seen = most_scans.load();
+                         while (now > seen && !most_scans.compare_exchange_weak(seen, now))
+                         {
+                         }
+                         wait_until(release);
+                         scans.fetch_sub(1);
+                       });
+    // Two workers stay free for writes while the scans are held.
+    scheduler.submit(TaskClass::Write, [&write_done] { write_done.store(true); });
+    wait_until(write_done);
+    const auto stats = scheduler.stats();
+    EXPECT_EQ(2U, stats.scan.running);
+    EXPECT_EQ(4U, stats.scan.queued);
+    EXPECT_EQ(1U, stats.write.completed);
+    release.store(true);
+  }
+  EXPECT_EQ(2, most_scans.load());
+}
+
+TEST(SchedulerSuite, StatsReportsQueuesPerClass)
+{
+  WorkerPool pool(1);
+  CommandScheduler scheduler(pool);
+  std::atomic<int> done{0};
+  scheduler.submit(TaskClass::Write, [&done] { done.fetch_add(1); });
+  scheduler.submit(TaskClass::Scan, [&done] { done.fetch_add(1); });
+  while (done.load() < 2 || scheduler.stats().scan.completed == 0)
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+  join_server::TablesStore store;
+  join_server::CommandProcessor processor(store, &scheduler);
+  const auto output = processor.execute("STATS");
+  ASSERT_TRUE(output.success);
+  const auto has = [&output](const std::string &line)
+  { return std::find(output.lines.begin(), output.lines.end(), line) != output.lines.end(); };
+  EXPECT_TRUE(has("sched_write_queued 0"));
+  EXPECT_TRUE(has("sched_write_completed 1"));
+  EXPECT_TRUE(has("sched_scan_running 0"));
+  EXPECT_TRUE(has("sched_scan_completed 1"));
+  EXPECT_EQ(1, std::count_if(output.lines.begin(), output.lines.end(),
+                             [](const std::string &line) { return line.rfind("sched_scan_wait_us_max ", 0) == 0; }));
+}
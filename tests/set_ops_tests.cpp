@@ -0,0 +1,119 @@
+#include <gtest/gtest.h>
+
+#include "join_server/set_ops.hpp"
+
+#include <algorithm>
+#include <random>
+#include <vector>
+
+using join_server::IndexPair;
+using join_server::SetKernel;
+
+namespace
+{
+
+std::vector<int> sorted_sample(std::mt19937 &rng, std::size_t size, int min_key, int max_key)
+{
+  std::uniform_int_distribution<int> dist(min_key, max_key);
+  std::vector<int> keys(size);
+  for (auto &key : keys)
+    key = dist(rng);
+  std::sort(keys.begin(), keys.end());
+  keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+  return keys;
+}
+
+std::vector<IndexPair> reference_intersection(const std::vector<int> &a, const std::vector<int> &b)
+{
+  std::vector<IndexPair> out;
+  std::size_t i = 0;
+  std::size_t j = 0;
+  while (i < a.size() && j < b.size())
+  {
+    if (a[i] == b[j])
+      out.push_back(IndexPair{static_cast<std::uint32_t>(i++), static_cast<std::uint32_t>(j++)});
+    else if (a[i] < b[j])
+      ++i;
+    else
+      ++j;
+  }
+  return out;
+}
+
+void expect_kernels_match(const std::vector<int> &a, const std::vector<int> &b)
+{
+  const auto expected = reference_intersection(a, b);
+  for (const auto kernel : {SetKernel::Scalar, SetKernel::Sse, SetKernel::Avx2})
+  {
+    if (!join_server::set_kernel_supported(kernel))
+      continue;
+    std::vector<IndexPair> actual;
+    join_server::intersect_sorted(kernel, a.data(), a.size(), b.data(), b.size(), actual);
+    ASSERT_EQ(expected.size(), actual.size()) << join_server::set_kernel_name(kernel);
+    for (std::size_t k = 0; k < expected.size(); ++k)
+    {
+      ASSERT_EQ(expected[k].a, actual[k].a) << join_server::set_kernel_name(kernel);
+      ASSERT_EQ(expected[k].b, actual[k].b) << join_server::set_kernel_name(kernel);
+    }
+  }
+}
+
+} // namespace
+
+TEST(SetOpsSuite, KernelsMatchScalarMergeOnRandomInput)
+{
+  std::mt19937 rng(11);
+  for (int round = 0; round < 50; ++round)
+  {
+    const auto a = sorted_sample(rng, 1 + rng() % 5000, -20000, 20000);
+    const auto b = sorted_sample(rng, 1 + rng() % 5000, -20000, 20000);
+    expect_kernels_match(a, b);
+  }
+}
+
+TEST(SetOpsSuite, KernelsHandleShortAndBoundaryInputs)
+{
+  for (std::size_t size_a = 0; size_a <= 17; ++size_a)
+  {
+    for (std::size_t size_b = 0; size_b <= 17; ++size_b)
+    {
+      std::vector<int> a(size_a);
+      std::vector<int> b(size_b);
+      for (std::size_t i = 0; i < size_a; ++i)
+        a[i] = static_cast<int>(i * 2);
+      for (std::size_t i = 0; i < size_b; ++i)
+        b[i] = static_cast<int>(i * 3);
+      expect_kernels_match(a, b);
+    }
+  }
+}
+
+TEST(SetOpsSuite, GallopingHandlesSkewedSizes)
+{
+  std::mt19937 rng(5);
+  const auto large = sorted_sample(rng, 200000, 0, 1000000);
+  const auto small = sorted_sample(rng, 100, 0, 1000000);
+  std::vector<int> small_hits(small);
+  small_hits.insert(small_hits.end(), large.begin(), large.begin() + 50);
+  std::sort(small_hits.begin(), small_hits.end());
+  small_hits.erase(std::unique(small_hits.begin(), small_hits.end()), small_hits.end());
+
+  expect_kernels_match(small_hits, large);
+  expect_kernels_match(large, small_hits);
+}
+
+TEST(SetOpsSuite, IdenticalInputsMatchEveryPosition)
+{
+  std::vector<int> keys(1000);
+  for (std::size_t i = 0; i < keys.size(); ++i)
+    keys[i] = static_cast<int>(i) - 500;
+
+  std::vector<IndexPair> out;
+  join_server::intersect_sorted(keys.data(), keys.size(), keys.data(), keys.size(), out);
+  ASSERT_EQ(keys.size(), out.size());
+  for (std::size_t i = 0; i < out.size(); ++i)
+  {
+    EXPECT_EQ(i, out[i].a);
+    EXPECT_EQ(i, out[i].b);
+  }
+}
@@ -0,0 +1,327 @@
+#include <gtest/gtest.h>
+
+#include "join_server/command.hpp"
+#include "join_server/snapshot.hpp"
+#include "join_server/tables.hpp"
+#include "join_server/wal.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+using join_server::TableId;
+
+namespace
+{
+
+std::string temp_path(const std::string &name)
+{
+  const auto path = testing::TempDir() + name;
+  std::remove(path.c_str());
+  return path;
+}
+
+std::vector<std::string> lines(const join_server::JoinResult &result)
+{
+  std::vector<std::string> out;
+  for (const auto &row : result)
+    out.push_back(std::to_string(row.id) + "," + std::string(row.from_a) + "," + std::string(row.from_b));
+  return out;
+}
+
+join_server::StoreOptions with_snapshot(const std::string &path,
+                                        join_server::StorageEngine engine = join_server::StorageEngine::Flat)
+{
+  join_server::StoreOptions options;
+  options.engine = engine;
+  options.snapshot_path = path;
+  return options;
+}
+
+void wait_for_background_save(const join_server::TablesStore &store)
+{
+  while (store.background_save_stats().in_progress)
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+}
+
+} // namespace
+
+TEST(SnapshotSuite, MappedSnapshotServesSameJoins)
+{
+  const auto path = temp_path("joins.snap");
+  join_server::TablesStore store(with_snapshot(path));
+  std::string error;
+  for (int i = -500; i < 20000; ++i)
+  {
+    if (i % 3 != 0)
+    {
+      ASSERT_TRUE(store.insert(TableId::A, i, "a" + std::to_string(i % 50), error));
+    }
+    if (i % 4 != 0)
+    {
+      ASSERT_TRUE(store.insert(TableId::B, i * 2, i % 7 == 0 ? "" : "b" + std::to_string(i), error));
+    }
+  }
+  ASSERT_TRUE(store.save_snapshot(error)) << error;
+
+  for (const auto engine : {join_server::StorageEngine::Flat, join_server::StorageEngine::Map})
+  {
+    join_server::TablesStore restored(with_snapshot(path, engine));
+    std::size_t rows = 0;
+    ASSERT_TRUE(join_server::map_snapshot(restored, path, rows, error)) << error;
+    EXPECT_EQ(store.rows(TableId::A).size() + store.rows(TableId::B).size(), rows);
+    EXPECT_EQ(lines(store.intersection()), lines(restored.intersection()));
+    EXPECT_EQ(lines(store.symmetric_difference()), lines(restored.symmetric_difference()));
+  }
+}
+
+TEST(SnapshotSuite, MappedTablesAcceptNewRows)
+{
+  const auto path = temp_path("writes.snap");
+  std::string error;
+  {
+    join_server::TablesStore store(with_snapshot(path));
+    ASSERT_TRUE(store.insert(TableId::A, 1, "lean", error));
+    ASSERT_TRUE(store.insert(TableId::B, 1, "proposal", error));
+    ASSERT_TRUE(store.save_snapshot(error)) << error;
+  }
+
+  join_server::TablesStore store(with_snapshot(path));
+  std::size_t rows = 0;
+  ASSERT_TRUE(join_server::map_snapshot(store, path, rows, error)) << error;
+  EXPECT_FALSE(store.insert(TableId::A, 1, "again", error));
+  for (int i = 2; i < 3000; ++i)
+    ASSERT_TRUE(store.insert(TableId::A, i, "lean", error));
+  ASSERT_TRUE(store.insert(TableId::B, 2, "sweater", error));
+
+  // Overwriting the file must not disturb the mapped copy.
+  ASSERT_TRUE(store.save_snapshot(error)) << error;
+  EXPECT_EQ((std::vector<std::string>{"1,lean,proposal", "2,lean,sweater"}), lines(store.intersection()));
+
+  ASSERT_TRUE(store.truncate(TableId::A, error)) << error;
+  EXPECT_TRUE(store.intersection().empty());
+}
+
+TEST(SnapshotSuite, RejectsMissingAndCorruptFiles)
+{
+  join_server::TablesStore store;
+  std::size_t rows = 1;
+  std::string error;
+  EXPECT_TRUE(join_server::map_snapshot(store, temp_path("missing.snap"), rows, error));
+  EXPECT_EQ(0U, rows);
+
+  const auto path = temp_path("corrupt.snap");
+  {
+    std::ofstream out(path, std::ios::binary);
+    out << std::string(200, 'x');
+  }
+  EXPECT_FALSE(join_server::map_snapshot(store, path, rows, error));
+  EXPECT_FALSE(error.empty());
+}
+
+TEST(SnapshotSuite, VerifyRejectsOutOfRangeValuesAndUnsortedIds)
+{
+  const auto path = temp_path("checked.snap");
+  std::string error;
+  {
+    join_server::TablesStore store(with_snapshot(path));
+    ASSERT_TRUE(store.insert(TableId::A, 1, "lean", error));
+    ASSERT_TRUE(store.insert(TableId::A, 2, "sweater", error));
+    ASSERT_TRUE(store.save_snapshot(error)) << error;
+  }
+  std::string image;
+  {
+    std::ifstream in(path, std::ios::binary);
+    image.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+  }
+  // Table A starts right after the header: two ids, then two value offsets.
+  constexpr std::size_t kRowsA = 16;
+  constexpr std::size_t kIds = 112;
+  constexpr std::size_t kRefs = kIds + 8;
+
+  const auto write = [&path](const std::string &corrupt)
+  {
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    out << corrupt;
+  };
+  // Mapping checks the header only; the rows are left to verify_snapshot().
+  const auto rejects = [&path, &write](const std::string &corrupt, bool verify)
+  {
+    write(corrupt);
+    join_server::TablesStore store(join_server::StorageEngine::Flat);
+    std::size_t rows = 0;
+    std::string load_error;
+    const bool ok = verify ? join_server::verify_snapshot(path, load_error)
+                           : join_server::map_snapshot(store, path, rows, load_error);
+    return !ok && !load_error.empty();
+  };
+  auto swapped = image;
+  std::swap_ranges(swapped.begin() + kIds, swapped.begin() + kIds + 4, swapped.begin() + kIds + 4);
+  EXPECT_TRUE(rejects(swapped, true));
+  EXPECT_FALSE(rejects(swapped, false));
+  auto dangling = image;
+  dangling[kRefs + 8] = '\x7f';
+  EXPECT_TRUE(rejects(dangling, true));
+  // A row count whose column sizes would wrap around to zero.
+  auto wrapped = image;
+  const std::uint64_t rows = std::uint64_t{1} << 62;
+  std::memcpy(&wrapped[kRowsA], &rows, sizeof(rows));
+  EXPECT_TRUE(rejects(wrapped, false));
+  EXPECT_FALSE(rejects(image, true));
+  EXPECT_FALSE(rejects(image, false));
+
+  // A dangling reference that was never verified reads as an empty value.
+  write(dangling);
+  join_server::TablesStore store(join_server::StorageEngine::Flat);
+  std::size_t loaded = 0;
+  ASSERT_TRUE(join_server::map_snapshot(store, path, loaded, error)) << error;
+  ASSERT_TRUE(store.insert(TableId::B, 1, "x", error));
+  ASSERT_TRUE(store.insert(TableId::B, 2, "y", error));
+  const auto joined = store.intersection();
+  ASSERT_EQ(2U, joined.size());
+  EXPECT_EQ("lean", joined[0].from_a);
+  EXPECT_EQ("", joined[1].from_a);
+}
+
+TEST(SnapshotSuite, WalReplaysOverSnapshot)
+{
+  const auto snapshot = temp_path("wal.snap");
+  const auto log = temp_path("snapshot.wal");
+  std::string error;
+  {
+    join_server::TablesStore store(with_snapshot(snapshot));
+    store.attach_wal(std::make_unique<join_server::WriteAheadLog>(log, join_server::Durability::None));
+    ASSERT_TRUE(store.insert(TableId::A, 1, "x", error));
+    ASSERT_TRUE(store.insert(TableId::B, 1, "y", error));
+    ASSERT_TRUE(store.save_snapshot(error)) << error;
+    ASSERT_TRUE(store.truncate(TableId::A, error)) << error;
+    ASSERT_TRUE(store.insert(TableId::A, 1, "z", error));
+  }
+
+  join_server::TablesStore restored(with_snapshot(snapshot));
+  std::size_t rows = 0;
+  std::size_t records = 0;
+  std::uint64_t lsn = 0;
+  ASSERT_TRUE(join_server::map_snapshot(restored, snapshot, rows, error, &lsn)) << error;
+  EXPECT_EQ(2U, lsn);
+  ASSERT_TRUE(join_server::WriteAheadLog::replay(log, restored, records, error, lsn)) << error;
+  EXPECT_EQ(2U, records);
+  EXPECT_EQ(std::vector<std::string>{"1,z,y"}, lines(restored.intersection()));
+
+  // The snapshot dropped the first two records from the log, so replaying it
+  // on its own would lose rows.
+  join_server::TablesStore empty;
+  EXPECT_FALSE(join_server::WriteAheadLog::replay(log, empty, records, error));
+  EXPECT_NE(std::string::npos, error.find("starts after record 2"));
+}
+
+TEST(SnapshotSuite, BackgroundSaveCheckpointsLog)
+{
+  const auto snapshot = temp_path("bgsave_wal.snap");
+  const auto log = temp_path("bgsave.wal");
+  std::string error;
+  {
+    join_server::TablesStore store(with_snapshot(snapshot, join_server::StorageEngine::Map));
+    store.attach_wal(std::make_unique<join_server::WriteAheadLog>(log, join_server::Durability::Batch));
+    for (int i = 0; i < 100; ++i)
+      ASSERT_TRUE(store.insert(TableId::A, i, "x", error));
+    ASSERT_TRUE(store.background_save(error)) << error;
+    ASSERT_TRUE(store.insert(TableId::B, 1, "y", error));
+    wait_for_background_save(store);
+    ASSERT_TRUE(store.background_save_stats().last_ok);
+    ASSERT_TRUE(store.insert(TableId::B, 2, "z", error));
+  }
+
+  join_server::TablesStore restored(with_snapshot(snapshot, join_server::StorageEngine::Map));
+  std::size_t rows = 0;
+  std::size_t records = 0;
+  std::uint64_t lsn = 0;
+  ASSERT_TRUE(join_server::map_snapshot(restored, snapshot, rows, error, &lsn)) << error;
+  EXPECT_EQ(100U, lsn);
+  ASSERT_TRUE(join_server::WriteAheadLog::replay(log, restored, records, error, lsn)) << error;
+  EXPECT_EQ(2U, records);
+  EXPECT_EQ((std::vector<std::string>{"1,x,y", "2,x,z"}), lines(restored.intersection()));
+}
+
+TEST(SnapshotSuite, SnapshotCommandNeedsConfiguredPath)
+{
+  join_server::TablesStore disabled;
+  join_server::CommandProcessor processor(disabled);
+  const auto output = processor.execute("SNAPSHOT");
+  EXPECT_FALSE(output.success);
+  EXPECT_EQ(std::vector<std::string>{"ERR snapshots are disabled"}, output.lines);
+
+  join_server::TablesStore enabled(with_snapshot(temp_path("command.snap")));
+  join_server::CommandProcessor saver(enabled);
+  EXPECT_EQ(std::vector<std::string>{"OK"}, saver.execute("SNAPSHOT").lines);
+  EXPECT_EQ(std::vector<std::string>{"ERR wrong command format"}, saver.execute("SNAPSHOT now").lines);
+}
+
+TEST(SnapshotSuite, BackgroundSaveWritesForkTimeState)
+{
+  for (const auto engine : {join_server::StorageEngine::Flat, join_server::StorageEngine::Map})
+  {
+    const auto path = temp_path("background.snap");
+    join_server::TablesStore store(with_snapshot(path, engine));
+    std::string error;
+    for (int i = 0; i < 5000; ++i)
+    {
+      ASSERT_TRUE(store.insert(TableId::A, i, "a" + std::to_string(i % 10), error));
+      if (i % 2 == 0)
+      {
+        ASSERT_TRUE(store.insert(TableId::B, i, "b", error));
+      }
+    }
+    const auto intersection = lines(store.intersection());
+    const auto difference = lines(store.symmetric_difference());
+
+    ASSERT_TRUE(store.background_save(error)) << error;
+    // Writes after the fork belong to the parent only.
+    ASSERT_TRUE(store.insert(TableId::B, 1, "late", error));
+    ASSERT_TRUE(store.truncate(TableId::A, error)) << error;
+    wait_for_background_save(store);
+
+    const auto stats = store.background_save_stats();
+    EXPECT_TRUE(stats.last_ok);
+    EXPECT_EQ(1U, stats.completed);
+    EXPECT_EQ(7500U, stats.rows_total);
+    EXPECT_EQ(stats.rows_total, stats.rows_written);
+
+    join_server::TablesStore restored(with_snapshot(path));
+    std::size_t rows = 0;
+    ASSERT_TRUE(join_server::map_snapshot(restored, path, rows, error)) << error;
+    EXPECT_EQ(intersection, lines(restored.intersection()));
+    EXPECT_EQ(difference, lines(restored.symmetric_difference()));
+  }
+}
+
+TEST(SnapshotSuite, BackgroundSaveReportsStats)
+{
+  join_server::TablesStore disabled;
+  join_server::CommandProcessor plain(disabled);
+  EXPECT_EQ(std::vector<std::string>{"ERR snapshots are disabled"}, plain.execute("BGSAVE").lines);
+
+  join_server::TablesStore store(with_snapshot(temp_path("stats.snap")));
+  join_server::CommandProcessor processor(store);
+  EXPECT_EQ(std::vector<std::string>{"OK"}, processor.execute("INSERT A 1 x").lines);
+  const auto idle = processor.execute("STATS");
+  ASSERT_TRUE(idle.success);
+  EXPECT_EQ("bgsave_in_progress 0", idle.lines.front());
+  EXPECT_NE(idle.lines.end(), std::find(idle.lines.begin(), idle.lines.end(), "bgsave_last_status none"));
+
+  EXPECT_EQ(std::vector<std::string>{"OK"}, processor.execute("BGSAVE").lines);
+  wait_for_background_save(store);
+  const auto done = processor.execute("STATS").lines;
+  EXPECT_NE(done.end(), std::find(done.begin(), done.end(), "bgsave_last_status ok"));
+  EXPECT_NE(done.end(), std::find(done.begin(), done.end(), "bgsave_rows_written 1"));
+  EXPECT_EQ("OK", done.back());
+  EXPECT_EQ(std::vector<std::string>{"ERR wrong command format"}, processor.execute("STATS all").lines);
+}
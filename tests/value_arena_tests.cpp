@@ -0,0 +1,49 @@
+#include <gtest/gtest.h>
+
+#include "join_server/value_arena.hpp"
+
+#include <string>
+#include <vector>
+
+using join_server::ValueArena;
+
+TEST(ValueArenaSuite, InternsEqualValuesOnce)
+{
+  ValueArena arena;
+
+  const auto first = arena.intern("lean");
+  const auto second = arena.intern("sweater");
+  EXPECT_NE(first, second);
+  EXPECT_EQ(first, arena.intern("lean"));
+  EXPECT_EQ(2U, arena.distinct());
+
+  EXPECT_EQ("lean", arena.get(first));
+  EXPECT_EQ("sweater", arena.get(second));
+}
+
+TEST(ValueArenaSuite, KeepsValuesAcrossChunksAndRehashes)
+{
+  ValueArena arena;
+
+  std::vector<ValueArena::Ref> refs;
+  for (int i = 0; i < 100000; ++i)
+    refs.push_back(arena.intern("name-" + std::to_string(i)));
+
+  EXPECT_EQ(100000U, arena.distinct());
+  for (int i = 0; i < 100000; i += 997)
+    EXPECT_EQ("name-" + std::to_string(i), arena.get(refs[static_cast<std::size_t>(i)]));
+}
+
+TEST(ValueArenaSuite, StoresEmptyAndOversizedValues)
+{
+  ValueArena arena;
+
+  const std::string big(3 * 1024 * 1024, 'x');
+  const auto empty_ref = arena.intern("");
+  const auto big_ref = arena.intern(big);
+  const auto small_ref = arena.intern("frank");
+
+  EXPECT_TRUE(arena.get(empty_ref).empty());
+  EXPECT_EQ(big, arena.get(big_ref));
+  EXPECT_EQ("frank", arena.get(small_ref));
+}
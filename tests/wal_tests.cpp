@@ -0,0 +1,186 @@
+#include <gtest/gtest.h>
+
+#include "join_server/tables.hpp"
+#include "join_server/wal.hpp"
+
+#include <cstdio>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+using join_server::TableId;
+
+namespace
+{
+
+std::string wal_path(const std::string &name)
+{
+  const auto path = testing::TempDir() + name;
+  std::remove(path.c_str());
+  return path;
+}
+
+std::vector<std::string> lines(const join_server::JoinResult &result)
+{
+  std::vector<std::string> out;
+  for (const auto &row : result)
+    out.push_back(std::to_string(row.id) + "," + std::string(row.from_a) + "," + std::string(row.from_b));
+  return out;
+}
+
+} // namespace
+
+TEST(WriteAheadLogSuite, ReplayRestoresInsertsAndTruncates)
+{
+  const auto path = wal_path("replay.wal");
+  join_server::TablesStore store;
+  store.attach_wal(std::make_unique<join_server::WriteAheadLog>(path, join_server::Durability::Batch));
+
+  std::string error;
+  ASSERT_TRUE(store.insert(TableId::A, 0, "lean", error));
+  ASSERT_TRUE(store.insert(TableId::A, 1, "sweater", error));
+  ASSERT_TRUE(store.insert(TableId::B, 1, "proposal", error));
+  ASSERT_TRUE(store.truncate(TableId::A, error)) << error;
+  ASSERT_TRUE(store.insert(TableId::A, 1, "flour", error));
+  ASSERT_TRUE(store.insert(TableId::A, 2, "", error));
+  EXPECT_FALSE(store.insert(TableId::A, 2, "duplicate", error));
+
+  join_server::TablesStore restored;
+  std::size_t records = 0;
+  ASSERT_TRUE(join_server::WriteAheadLog::replay(path, restored, records, error)) << error;
+  EXPECT_EQ(6U, records);
+  EXPECT_EQ(lines(store.intersection()), lines(restored.intersection()));
+  EXPECT_EQ(lines(store.symmetric_difference()), lines(restored.symmetric_difference()));
+}
+
+TEST(WriteAheadLogSuite, MissingLogIsEmpty)
+{
+  join_server::TablesStore store;
+  std::size_t records = 1;
+  std::string error;
+  EXPECT_TRUE(join_server::WriteAheadLog::replay(wal_path("missing.wal"), store, records, error));
+  EXPECT_EQ(0U, records);
+}
+
+TEST(WriteAheadLogSuite, FailedLogMakesStoreReadOnly)
+{
+  std::ofstream probe("/dev/full");
+  if (!probe)
+    GTEST_SKIP() << "needs /dev/full";
+
+  join_server::TablesStore store;
+  store.attach_wal(std::make_unique<join_server::WriteAheadLog>("/dev/full", join_server::Durability::None));
+  // The file header already fails to write, so no change is ever applied.
+  std::string error;
+  EXPECT_FALSE(store.insert(TableId::A, 1, "lean", error));
+  EXPECT_NE(std::string::npos, error.find("wal write failed"));
+  EXPECT_TRUE(store.rows(TableId::A).empty());
+
+  std::vector<std::string> errors;
+  store.insert_batch({{TableId::B, 2, "frank"}}, errors);
+  EXPECT_EQ(error, errors.at(0));
+  EXPECT_TRUE(store.rows(TableId::B).empty());
+  std::string truncate_error;
+  EXPECT_FALSE(store.truncate(TableId::A, truncate_error));
+  EXPECT_EQ(error, truncate_error);
+}
+
+TEST(WriteAheadLogSuite, TornTailIsDroppedAndLogStaysAppendable)
+{
+  const auto path = wal_path("torn.wal");
+  std::string error;
+  {
+    join_server::TablesStore store;
+    store.attach_wal(std::make_unique<join_server::WriteAheadLog>(path, join_server::Durability::None));
+    ASSERT_TRUE(store.insert(TableId::A, 5, "kept", error));
+  }
+  {
+    std::ofstream out(path, std::ios::binary | std::ios::app);
+    out << "\x20\x00\x00\x00garbage";
+  }
+
+  {
+    join_server::TablesStore store;
+    std::size_t records = 0;
+    ASSERT_TRUE(join_server::WriteAheadLog::replay(path, store, records, error)) << error;
+    EXPECT_EQ(1U, records);
+    store.attach_wal(std::make_unique<join_server::WriteAheadLog>(path, join_server::Durability::EveryOp));
+    ASSERT_TRUE(store.insert(TableId::B, 5, "after", error));
+  }
+
+  join_server::TablesStore restored;
+  std::size_t records = 0;
+  ASSERT_TRUE(join_server::WriteAheadLog::replay(path, restored, records, error)) << error;
+  EXPECT_EQ(2U, records);
+  EXPECT_EQ(std::vector<std::string>{"5,kept,after"}, lines(restored.intersection()));
+}
+
+TEST(WriteAheadLogSuite, ConcurrentWritersShareSyncs)
+{
+  const auto path = wal_path("group.wal");
+  constexpr int kThreads = 4;
+  constexpr int kRowsPerThread = 200;
+
+  join_server::TablesStore store;
+  auto wal = std::make_unique<join_server::WriteAheadLog>(path, join_server::Durability::Batch);
+  const auto *log = wal.get();
+  store.attach_wal(std::move(wal));
+
+  std::vector<std::thread> writers;
+  for (int t = 0; t < kThreads; ++t)
+  {
+    writers.emplace_back([&store, t]
+                         {
+                           std::string error;
+                           const auto table = t % 2 == 0 ? TableId::A : TableId::B;
+                           for (int i = 0; i < kRowsPerThread; ++i)
+                             store.insert(table, t * kRowsPerThread + i, "v", error); });
+  }
+  for (auto &writer : writers)
+    writer.join();
+  EXPECT_LE(log->syncs(), static_cast<std::uint64_t>(kThreads * kRowsPerThread));
+
+  join_server::TablesStore restored;
+  std::size_t records = 0;
+  std::string error;
+  ASSERT_TRUE(join_server::WriteAheadLog::replay(path, restored, records, error)) << error;
+  EXPECT_EQ(static_cast<std::size_t>(kThreads * kRowsPerThread), records);
+  EXPECT_EQ(lines(store.symmetric_difference()), lines(restored.symmetric_difference()));
+}
+
+TEST(WriteAheadLogSuite, CheckpointKeepsRecordsAppendedMeanwhile)
+{
+  const auto path = wal_path("checkpoint.wal");
+  constexpr int kThreads = 2;
+  constexpr int kRowsPerThread = 2000;
+
+  join_server::WriteAheadLog log(path, join_server::Durability::Batch);
+  std::vector<std::thread> writers;
+  for (int t = 0; t < kThreads; ++t)
+  {
+    writers.emplace_back([&log, t]
+                         {
+                           std::string error;
+                           for (int i = 0; i < kRowsPerThread; ++i)
+                             log.commit(log.append_insert(TableId::A, t * kRowsPerThread + i, "v"), error); });
+  }
+
+  std::string error;
+  join_server::WriteAheadLog::Position last;
+  for (int round = 0; round < 50; ++round)
+  {
+    last = log.position();
+    ASSERT_TRUE(log.checkpoint(last, error)) << error;
+  }
+  for (auto &writer : writers)
+    writer.join();
+  const auto end = log.position();
+
+  join_server::TablesStore restored;
+  std::size_t records = 0;
+  ASSERT_TRUE(join_server::WriteAheadLog::replay(path, restored, records, error, last.lsn)) << error;
+  EXPECT_EQ(static_cast<std::size_t>(end.lsn - last.lsn), records);
+  EXPECT_EQ(static_cast<std::uint64_t>(kThreads * kRowsPerThread), end.lsn);
+}